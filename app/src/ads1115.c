@@ -5,37 +5,115 @@
  */
 
 #include "inc/ads1115.h"
+#include "inc/pluto_trace.h"
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/i2c.h>
 #include <stdlib.h>
 
-#define ADS_NODE DT_NODELABEL(ads1115)
-static const struct i2c_dt_spec ads_i2c = I2C_DT_SPEC_GET(ADS_NODE);
-
-uint8_t ads1115_txBuff[3];
-uint8_t ads1115_rxBuff[2];
-
-static void ADS1115_WriteRegister(ADS1115 *ads1115_module, uint8_t reg, uint16_t value);
-static int16_t ADS1115_ReadRegister(ADS1115 *ads1115_module, uint8_t reg);
+static int ADS1115_WriteRegister(ADS1115 *ads1115_module, uint8_t reg, uint16_t value);
+static int ADS1115_ReadRegister(ADS1115 *ads1115_module, uint8_t reg, uint16_t *value);
+static int ADS1115_WriteShadowed(ADS1115 *ads1115_module, uint8_t reg, uint16_t *shadow, uint16_t value);
+static int ADS1115_StartConversion(ADS1115 *ads1115_module, uint16_t config);
+static int ADS1115_WaitConversion(ADS1115 *ads1115_module);
 static float get_lsb_multiplier(adsGain_t gain);
 static uint32_t get_delay_msec(adsSPS_t sps);
 static uint16_t get_adc_config(ADS1115 *ads1115_module);
 
-void ADS1115_WriteRegister (ADS1115 *ads1115_module, uint8_t reg, uint16_t value){
-    ads1115_txBuff[0] = reg;
-    ads1115_txBuff[1] = (value >> 8);
-    ads1115_txBuff[2] = (value & 0xFF);
+/*
+ * A failed transfer leaves the register contents unknown (the chip may also have been
+ * power cycled), so all shadows are dropped and the next access writes them again.
+ */
+int ADS1115_WriteRegister (ADS1115 *ads1115_module, uint8_t reg, uint16_t value){
+    ads1115_module->txBuff[0] = reg;
+    ads1115_module->txBuff[1] = (value >> 8);
+    ads1115_module->txBuff[2] = (value & 0xFF);
+
+    pluto_trace(PLUTO_TRACE_I2C_SUBMIT, ads1115_module->i2c.addr, PLUTO_TRACE_I2C_LEN(3, 0));
+    int ret = i2c_write_dt(&ads1115_module->i2c,ads1115_module->txBuff,3);
+    pluto_trace(PLUTO_TRACE_I2C_COMPLETE, ads1115_module->i2c.addr, (uint16_t)ret);
+    if (ret) {
+        ads1115_module->m_shadowValid = 0;
+    }
+    return ret;
+}
+
+/* Pointer write and register read in one transfer with a repeated start */
+int ADS1115_ReadRegister(ADS1115 *ads1115_module, uint8_t reg, uint16_t *value){
+    ads1115_module->txBuff[0] = reg;
 
-    i2c_write_dt(&ads_i2c,ads1115_txBuff,3);
+    pluto_trace(PLUTO_TRACE_I2C_SUBMIT, ads1115_module->i2c.addr, PLUTO_TRACE_I2C_LEN(1, 2));
+    int ret = i2c_write_read_dt(&ads1115_module->i2c,ads1115_module->txBuff,1,ads1115_module->rxBuff,2);
+    pluto_trace(PLUTO_TRACE_I2C_COMPLETE, ads1115_module->i2c.addr, (uint16_t)ret);
+    if (ret) {
+        ads1115_module->m_shadowValid = 0;
+        return ret;
+    }
+    *value = (ads1115_module->rxBuff[0] << 8) | ads1115_module->rxBuff[1];
+    return 0;
 }
 
-int16_t ADS1115_ReadRegister(ADS1115 *ads1115_module, uint8_t reg){
-    ads1115_txBuff[0] = reg;
+/* Writes a register only if its shadow is unknown or differs from the new value */
+int ADS1115_WriteShadowed(ADS1115 *ads1115_module, uint8_t reg, uint16_t *shadow, uint16_t value){
+    if ((ads1115_module->m_shadowValid & BIT(reg)) && *shadow == value) {
+        return 0;
+    }
+    int ret = ADS1115_WriteRegister(ads1115_module, reg, value);
+    if (ret) {
+        return ret;
+    }
+    *shadow = value;
+    ads1115_module->m_shadowValid |= BIT(reg);
+    return 0;
+}
 
-    i2c_write_dt(&ads_i2c,ads1115_txBuff,1);
-    i2c_read_dt(&ads_i2c,ads1115_rxBuff,2);
+/*
+ * In single-shot mode every conversion is started by writing the config with the OS
+ * bit set. In continuous mode the chip keeps converting, the config is only written
+ * when it changed, and the conversion register always holds the latest result.
+ * Returns 1 if a new conversion was started, 0 if the running one is used.
+ */
+int ADS1115_StartConversion(ADS1115 *ads1115_module, uint16_t config){
+    if ((config & ADS1115_REG_CONFIG_MODE_MASK) == ADS1115_REG_CONFIG_MODE_SINGLE) {
+        int ret = ADS1115_WriteRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG,
+                                        config | ADS1115_REG_CONFIG_OS_SINGLE);
+        if (ret) {
+            return ret;
+        }
+        ads1115_module->config = config;
+        ads1115_module->m_shadowValid |= BIT(ADS1115_REG_POINTER_CONFIG);
+        return 1;
+    }
+    bool changed = !(ads1115_module->m_shadowValid & BIT(ADS1115_REG_POINTER_CONFIG)) ||
+                   ads1115_module->config != config;
+    int ret = ADS1115_WriteShadowed(ads1115_module, ADS1115_REG_POINTER_CONFIG, &ads1115_module->config, config);
+    return ret ? ret : changed;
+}
 
-    return (ads1115_rxBuff[0] << 8) | ads1115_rxBuff[1];
+/*
+ * Sleeps for one conversion and, in single-shot mode, polls the OS bit until the
+ * conversion is done. Gives up after ADS1115_READY_TIMEOUT_MS, a missing chip never
+ * blocks the caller.
+ */
+int ADS1115_WaitConversion(ADS1115 *ads1115_module){
+    k_sleep(K_MSEC(ads1115_module->m_conversionDelay));
+    if ((ads1115_module->config & ADS1115_REG_CONFIG_MODE_MASK) != ADS1115_REG_CONFIG_MODE_SINGLE) {
+        return 0;
+    }
+    int64_t deadline = k_uptime_get() + ADS1115_READY_TIMEOUT_MS;
+    while (1) {
+        uint16_t config;
+        int ret = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG, &config);
+        if (ret) {
+            return ret;
+        }
+        if ((config & ADS1115_REG_CONFIG_OS_MASK) == ADS1115_REG_CONFIG_OS_NOTBUSY) {
+            return 0;
+        }
+        if (k_uptime_get() >= deadline) {
+            return -ETIMEDOUT;
+        }
+        k_sleep(K_MSEC(1));
+    }
 }
 
 float get_lsb_multiplier(adsGain_t gain){
@@ -137,19 +215,22 @@ void ADS1115_init(ADS1115 *ads1115_module){
             ads1115_module->m_mode;					// ADC mode
 
     ads1115_module->m_conversionDelay = (uint8_t)ADS1115_CONVERSIONDELAY;
+    ads1115_module->m_shadowValid = 0;						// Registers are written on first use
 }
 
 /**************************************************************************/
 /*!
     @brief  Reset a ADS1115
     @param  Device struct
+    @return 0 on success, negative errno of the transfer otherwise
 */
 /**************************************************************************/
-void ADS1115_reset(ADS1115 *ads1115_module){
-//	uint8_t cmd = 0x06;
-    ads1115_txBuff[0] = 0x06;
+int ADS1115_reset(ADS1115 *ads1115_module){
+    // The reset command is a general call, addressed to 0x00 on the bus of the chip
+    ads1115_module->txBuff[0] = ADS1115_GENERAL_CALL_RESET;
+    ads1115_module->m_shadowValid = 0;
 
-    i2c_write_dt(&ads_i2c,ads1115_txBuff,1);
+    return i2c_write(ads1115_module->i2c.bus,ads1115_module->txBuff,1,ADS1115_GENERAL_CALL_ADDRESS);
 }
 
 /**************************************************************************/
@@ -212,86 +293,74 @@ adsCONV_t ADS1115_getCONV(ADS1115 *ads1115_module){
     return ads1115_module->m_mode;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Gets the weight of one LSB at the configured gain
+    @return V per LSB
+*/
+/**************************************************************************/
+float ADS1115_getLsbMultiplier(ADS1115 *ads1115_module){
+    return get_lsb_multiplier(ads1115_module->m_gain)/1000;
+}
+
 /**************************************************************************/
 /*!
     @brief  Gets a single-ended ADC reading from the specified channel
     @param channel ADC channel to read
-    @return the ADC reading
+    @param voltage the ADC reading in V
+    @return 0 on success, -EINVAL for an invalid channel, -ETIMEDOUT if the
+            conversion does not finish, negative errno of a failed transfer
 */
 /**************************************************************************/
-float ADS1115_readADC(ADS1115 *ads1115_module, adc_Ch_t channel){
-    if ((channel & ~ADS1115_REG_CONFIG_MUX_MASK) != 0) {
-        return 0;
-    }
-
-    uint16_t config = get_adc_config(ads1115_module);;
-    config |= channel;
-    config |= ADS1115_REG_CONFIG_OS_SINGLE;
-
-    ads1115_module->config = config;
-
-    uint16_t ret_val;
-    do{
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
-    }
-    while( (ret_val & ADS1115_REG_CONFIG_OS_MASK) == ADS1115_REG_CONFIG_OS_BUSY);
-
-    do{
-        ADS1115_WriteRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG, config);
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
-    }while( (ret_val & ADS1115_REG_CONFIG_MUX_MASK) != (config & ADS1115_REG_CONFIG_MUX_MASK) );
-
-    k_sleep(K_MSEC(ads1115_module->m_conversionDelay));
-
-    do{
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
+int ADS1115_readADC(ADS1115 *ads1115_module, adc_Ch_t channel, float *voltage){
+    int16_t raw;
+    int ret = ADS1115_readADC_raw(ads1115_module, channel, &raw);
+    if (ret) {
+        return ret;
     }
-    while( (ret_val & ADS1115_REG_CONFIG_OS_MASK) == ADS1115_REG_CONFIG_OS_BUSY);
-
     if(channel>ADS1115_REG_CONFIG_MUX_DIFF_2_3)
-        return (float)abs(ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONVERT)) * ads1115_module->m_lsbMultiplier;
+        *voltage = (float)abs(raw) * ads1115_module->m_lsbMultiplier;
     else
-        return (float)ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONVERT) * ads1115_module->m_lsbMultiplier;
+        *voltage = (float)raw * ads1115_module->m_lsbMultiplier;
+    return 0;
 }
 
 /**************************************************************************/
 /*!
     @brief  Gets a single-ended ADC reading from the specified channel
     @param channel ADC channel to read
-    @return the ADC reading
+    @param raw the raw ADC reading
+    @return 0 on success, -EINVAL for an invalid channel, -ETIMEDOUT if the
+            conversion does not finish, negative errno of a failed transfer
 */
 /**************************************************************************/
-int16_t ADS1115_readADC_raw(ADS1115 *ads1115_module, adc_Ch_t channel){
+int ADS1115_readADC_raw(ADS1115 *ads1115_module, adc_Ch_t channel, int16_t *raw){
 
     if ((channel & ~ADS1115_REG_CONFIG_MUX_MASK) != 0) {
-        return 0;
+        return -EINVAL;
     }
 
-    uint16_t config = get_adc_config(ads1115_module);;
+    uint16_t config = get_adc_config(ads1115_module);
     config |= channel;
-    config |= ADS1115_REG_CONFIG_OS_SINGLE;
-
-    ads1115_module->config = config;
 
-    uint16_t ret_val = ADS1115_REG_CONFIG_OS_BUSY;
-    do{
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
+    int ret = ADS1115_StartConversion(ads1115_module, config);
+    if (ret < 0) {
+        return ret;
     }
-    while( (ret_val & ADS1115_REG_CONFIG_OS_MASK) == ADS1115_REG_CONFIG_OS_BUSY);
-
-    do{
-        ADS1115_WriteRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG, config);
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
-    }while( (ret_val & ADS1115_REG_CONFIG_MUX_MASK) != (config & ADS1115_REG_CONFIG_MUX_MASK) );
-
-    k_sleep(K_MSEC(ads1115_module->m_conversionDelay));
-
-    do{
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
+    if (ret > 0) {
+        ret = ADS1115_WaitConversion(ads1115_module);
+        if (ret) {
+            return ret;
+        }
     }
-    while( (ret_val & ADS1115_REG_CONFIG_OS_MASK) == ADS1115_REG_CONFIG_OS_BUSY);
 
-    return ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONVERT);
+    uint16_t value;
+    ret = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONVERT, &value);
+    if (ret) {
+        return ret;
+    }
+    *raw = (int16_t)value;
+    return 0;
 }
 
 /**************************************************************************/
@@ -302,9 +371,10 @@ int16_t ADS1115_readADC_raw(ADS1115 *ads1115_module, adc_Ch_t channel){
             This will also set the ADC in continuous conversion mode.
     @param channel ADC channel to use
     @param threshold comparator threshold
+    @return 0 on success, negative errno of a failed transfer
 */
 /**************************************************************************/
-void ADS1115_startComparator_SingleEnded(ADS1115 *ads1115_module, uint8_t channel, int16_t threshold){
+int ADS1115_startComparator_SingleEnded(ADS1115 *ads1115_module, uint8_t channel, int16_t threshold){
     // Start with default values
     uint16_t config =
             ADS1115_REG_CONFIG_CQUE_1CONV |   // Comparator enabled and asserts on 1 match
@@ -331,13 +401,16 @@ void ADS1115_startComparator_SingleEnded(ADS1115 *ads1115_module, uint8_t channe
             break;
     }
 
-    ads1115_module->config = config;
-
     // Set the high threshold register
-    ADS1115_WriteRegister(ads1115_module, ADS1115_REG_POINTER_HITHRESH, threshold);
+    int ret = ADS1115_WriteShadowed(ads1115_module, ADS1115_REG_POINTER_HITHRESH, &ads1115_module->Hi_thresh,
+                                    (uint16_t)threshold);
+    if (ret) {
+        return ret;
+    }
 
     // Write config register to the ADC
-    ADS1115_WriteRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG, config);
+    ret = ADS1115_StartConversion(ads1115_module, config);
+    return ret < 0 ? ret : 0;
 }
 
 /**************************************************************************/
@@ -345,20 +418,26 @@ void ADS1115_startComparator_SingleEnded(ADS1115 *ads1115_module, uint8_t channe
     @brief  In order to clear the comparator, we need to read the
             conversion results.  This function reads the last conversion
             results without changing the config value.
-    @return the last ADC reading
+    @param voltage the last ADC reading in V
+    @return 0 on success, -ETIMEDOUT if the conversion does not finish,
+            negative errno of a failed transfer
 */
 /**************************************************************************/
-float ADS1115_getLastConversionResults(ADS1115 *ads1115_module){
-    uint16_t ret_val = ADS1115_REG_CONFIG_OS_BUSY;
+int ADS1115_getLastConversionResults(ADS1115 *ads1115_module, float *voltage){
     // Wait for the conversion to complete
-    k_sleep(K_MSEC(ads1115_module->m_conversionDelay));
-    do{
-        ret_val = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONFIG);
+    int ret = ADS1115_WaitConversion(ads1115_module);
+    if (ret) {
+        return ret;
     }
-    while( (ret_val & ADS1115_REG_CONFIG_OS_MASK) == ADS1115_REG_CONFIG_OS_BUSY);
 
     // Read the conversion results
-    return (float)ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONVERT) * ads1115_module->m_lsbMultiplier;
+    uint16_t value;
+    ret = ADS1115_ReadRegister(ads1115_module, ADS1115_REG_POINTER_CONVERT, &value);
+    if (ret) {
+        return ret;
+    }
+    *voltage = (float)(int16_t)value * ads1115_module->m_lsbMultiplier;
+    return 0;
 }
 
 /************************************************************************/
@@ -9,11 +9,14 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <zephyr/drivers/i2c.h>
 
 /*=========================================================================
     I2C ADDRESS/BITS
     -----------------------------------------------------------------------*/
 #define ADS1115_ADDRESS (0x48) ///< 100 1000 (ADDR = GND)
+#define ADS1115_GENERAL_CALL_ADDRESS (0x00) ///< General call address
+#define ADS1115_GENERAL_CALL_RESET   (0x06) ///< General call reset command
 /*=========================================================================*/
 
 /*=========================================================================
@@ -21,6 +24,7 @@
     -----------------------------------------------------------------------*/
 //#define ADS1115_CONVERSIONDELAY (1165) ///< Minimum Conversion Delay: usec ( Maximum Sample Rate: 860 SPS )
 #define ADS1115_CONVERSIONDELAY (2) ///< Minimum Conversion Delay: msec ( Maximum Sample Rate: 860 SPS )
+#define ADS1115_READY_TIMEOUT_MS (10) ///< Time a conversion may take beyond its delay before it is given up
 /*=========================================================================*/
 
 /*=========================================================================
@@ -163,6 +167,10 @@ typedef enum {
 /*	Structure to store address and settings of ADS1115 16-bit ADC IC	*/
 typedef struct
 {
+    // Bus and address of the instance, resolved from devicetree by the user of the driver
+    struct i2c_dt_spec	i2c;				    //< I2C bus and address
+    uint8_t			txBuff[3];				  //< transmit buffer
+    uint8_t			rxBuff[2];				  //< receive buffer
     // Instance-specific properties
     uint16_t		config;					    //< ADC config
     uint16_t		m_samplingRate; 		//< sampling rate
@@ -173,19 +181,20 @@ typedef struct
     float			  m_lsbMultiplier;		//< LSB multiplier
     uint16_t		Hi_thresh;				  //< High Threshold value
     uint16_t		Lo_thresh;				  //< Low Threshold value
+    uint8_t			m_shadowValid;			//< bit n set when config/Hi_thresh/Lo_thresh hold register n
 }ADS1115;
 
 
-void ADS1115_reset(ADS1115 *ads1115_module);
+int ADS1115_reset(ADS1115 *ads1115_module);
 
 void ADS1115_init(ADS1115 *ads1115_module);
 
-float ADS1115_readADC(ADS1115 *ads1115_module, adc_Ch_t channel);
-int16_t ADS1115_readADC_raw(ADS1115 *ads1115_module, adc_Ch_t channel);
+int ADS1115_readADC(ADS1115 *ads1115_module, adc_Ch_t channel, float *voltage);
+int ADS1115_readADC_raw(ADS1115 *ads1115_module, adc_Ch_t channel, int16_t *raw);
 
-void ADS1115_startComparator_SingleEnded(ADS1115 *ads1115_module, uint8_t channel, int16_t threshold);
+int ADS1115_startComparator_SingleEnded(ADS1115 *ads1115_module, uint8_t channel, int16_t threshold);
 
-float ADS1115_getLastConversionResults(ADS1115 *ads1115_module);
+int ADS1115_getLastConversionResults(ADS1115 *ads1115_module, float *voltage);
 
 void ADS1115_setGain(ADS1115 *ads1115_module, adsGain_t gain);
 adsGain_t ADS1115_getGain(ADS1115 *ads1115_module);
@@ -196,4 +205,6 @@ adsSPS_t ADS1115_getSPS(ADS1115 *ads1115_module);
 void ADS1115_setCONV(ADS1115 *ads1115_module, adsCONV_t sps);
 adsCONV_t ADS1115_getCONV(ADS1115 *ads1115_module);
 
+float ADS1115_getLsbMultiplier(ADS1115 *ads1115_module);
+
 #endif /* APP_ADS1115_H */
@@ -16,6 +16,7 @@
 #define APP_PLUTO_ADS1115_H
 
 #include <stdio.h>
+#include <zephyr/kernel.h>
 
 struct ads1115_input {
     const char *name;
@@ -23,9 +24,18 @@ struct ads1115_input {
     double voltage;
     bool threshold_enabled;
     double threshold;
+    int64_t timestamp;      // Uptime in ticks of voltage
+    uint32_t tick;          // Control tick which triggered the sample, 0 if unsynchronized
+    uint32_t phase_us;      // Conversion start after the trigger
+    uint32_t latency_us;    // Result available after the trigger
 };
 
 // Function declarations
 void pluto_ads1115_init();
+int ads1115_get_input(int index, double *voltage, int64_t *timestamp);
+bool ads1115_is_guarded(void);
+void ads1115_wakeup(void);
+void ads1115_request(int index);
+void ads1115_sync_update(uint32_t tick);
 
 #endif //APP_PLUTO_ADS1115_H
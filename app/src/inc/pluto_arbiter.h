@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_arbiter.h
+ * @brief Control source arbitration module.
+ *
+ * Header for arbiter module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_ARBITER_H
+#define APP_PLUTO_ARBITER_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+/** @brief Sources which drive the motors, a higher value has the higher priority. */
+enum arbiter_source {
+    ARBITER_SOURCE_SCRIPT,
+    ARBITER_SOURCE_HOST,
+    ARBITER_SOURCE_OPERATOR,
+    ARBITER_SOURCE_SAFETY,
+    ARBITER_SOURCE_COUNT,
+    ARBITER_SOURCE_NONE = -1,
+};
+
+// Function declarations
+void arbiter_update(void);
+int arbiter_acquire(enum arbiter_source source, uint32_t lease_ms);
+void arbiter_release(enum arbiter_source source);
+int arbiter_set(enum arbiter_source source, uint32_t speed1, bool dir1, uint32_t speed2, bool dir2);
+enum arbiter_source arbiter_get_owner(void);
+const char *arbiter_source_to_string(enum arbiter_source source);
+int arbiter_check_unowned(const struct shell *shell);
+
+#endif //APP_PLUTO_ARBITER_H
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_battery.h
+ * @brief Battery monitoring module.
+ *
+ * Header for battery module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_BATTERY_H
+#define APP_PLUTO_BATTERY_H
+
+#include <zephyr/kernel.h>
+
+/** @brief Warning level of the state of charge. */
+enum battery_level {
+    BATTERY_LEVEL_NORMAL,
+    BATTERY_LEVEL_LOW,
+    BATTERY_LEVEL_CRITICAL,
+};
+
+// Function declarations
+void battery_update(void);
+int battery_get_voltage(uint32_t *voltage_mv, int64_t *timestamp);
+int battery_get_soc(uint32_t *soc_permille, int32_t *runtime_s);
+bool battery_uses_input(int index);
+const char *battery_level_to_string(enum battery_level level);
+
+#endif //APP_PLUTO_BATTERY_H
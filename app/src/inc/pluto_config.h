@@ -20,18 +20,161 @@
 /* mcp9808 thread config */
 #define PLUTO_MCP9808_THREAD_STACK_SIZE         512
 #define PLUTO_MCP9808_THREAD_PRIORITY           10u
-#define PLUTO_MCP9808_THREAD_SLEEP_TIME_S      (1)
 #define PLUTO_MCP9808_THRESH_SLEEP_TIME_S      (10)
+#define PLUTO_MCP9808_REFRESH_TIME_S           (60)
+#define PLUTO_MCP9808_WARNING_TEMP_MC          (60000)
+#define PLUTO_MCP9808_CRITICAL_TEMP_MC         (75000)
+#define PLUTO_MCP9808_HYSTERESIS_MC            (5000)
+#define PLUTO_MCP9808_DERATING_SPEED           (50u)
 
 /* ads1115 thread config */
 #define PLUTO_ADS1115_THREAD_STACK_SIZE         512
 #define PLUTO_ADS1115_THREAD_PRIORITY           9u
-#define PLUTO_ADS1115_THREAD_SLEEP_TIME_S      (1)
 #define PLUTO_ADS1115_THRESH_SLEEP_TIME_S      (10)
+#define PLUTO_ADS1115_SYNC_DIVISOR              (0u)        // sample every n-th control tick, 0 for unsynchronized
+#define PLUTO_ADS1115_SYNC_CONVERSION_US        (2000u)     // conversion delay of an input at 860 SPS, as the driver sleeps
+#define PLUTO_ADS1115_SYNC_TRANSFER_US          (1000u)     // I2C of an input at 100 kHz: config write, ready polls, result
 
 /* vl53l0x thread config */
 #define PLUTO_VL53L0X_THREAD_STACK_SIZE         1024
 #define PLUTO_VL53L0X_THREAD_PRIORITY           8u
-#define PLUTO_VL53L0X_THREAD_SLEEP_TIME_MS      (500)
+#define PLUTO_VL53L0X_LANES                     (2u)        // sensor threads ranging concurrently
+#define PLUTO_VL53L0X_RANGING_TIME_MS           (33u)       // timing budget of one sample, for the expected rates
+#define PLUTO_VL53L0X_GROUP_P_0                 (0u)        // sensors of a group never range at the same time
+#define PLUTO_VL53L0X_GROUP_P_1                 (0u)
+#define PLUTO_VL53L0X_GROUP_P_2                 (0u)
+#define PLUTO_VL53L0X_GROUP_P_3                 (0u)
+#define PLUTO_VL53L0X_QUALITY_STATUS_MASK       (0x01u)     // accepted range status, only "range valid"
+#define PLUTO_VL53L0X_QUALITY_MIN_SIGNAL_KCPS   (250u)
+#define PLUTO_VL53L0X_QUALITY_MAX_AMBIENT_KCPS  (5000u)
+#define PLUTO_VL53L0X_QUALITY_MIN_SPADS         (0u)
+#define PLUTO_VL53L0X_CLEAR_DISTANCE_MM         (2000u)     // range put in the sector map for a rejected sample
+
+/* sensor scheduler config */
+#define PLUTO_SENSOR_THREAD_STACK_SIZE          1024
+#define PLUTO_SENSOR_THREAD_PRIORITY            7u          // above the sensor threads it releases
+#define PLUTO_SENSOR_PUBLISH_THREAD_STACK_SIZE  1024
+#define PLUTO_SENSOR_PUBLISH_THREAD_PRIORITY    14u         // prints the subscriptions, below everything else
+#define PLUTO_SENSOR_PUBLISH_QUEUE_SIZE         (16u)
+#define PLUTO_SENSOR_PROXY_PERIOD_MS            (500u)
+#define PLUTO_SENSOR_ADC_PERIOD_MS              (1000u)
+#define PLUTO_SENSOR_TEMP_PERIOD_MS             (1000u)     // polling of MCP9808 sensors without an alert output
+#define PLUTO_SENSOR_MIN_PERIOD_MS              (20u)
+#define PLUTO_SENSOR_SLACK_MS                   (100u)      // a reading older than period + slack is stale
+#define PLUTO_SENSOR_AGE_MARGIN_MS              (300u)      // sample latency on top of the period, for the max periods
+#define PLUTO_SENSOR_PROXY_MAX_PERIOD_MS        (PLUTO_SAFETY_PROXY_MAX_AGE_MS - PLUTO_SENSOR_AGE_MARGIN_MS)
+#define PLUTO_SENSOR_ADC_MAX_PERIOD_MS          (MIN(MIN(PLUTO_SAFETY_ADC_MAX_AGE_MS, PLUTO_STALL_CURRENT_MAX_AGE_MS), \
+                                                     PLUTO_BATTERY_MAX_AGE_MS) - PLUTO_SENSOR_AGE_MARGIN_MS)
+#define PLUTO_SENSOR_TEMP_MAX_PERIOD_MS         (60000u)    // no supervised consumer
+
+/* motor ramp config */
+#define PLUTO_MOTOR_RAMP_RETRY_MS               (1)     // delay of a ramp step that found the motor locked
+
+/* motor pwm config */
+#define PLUTO_MOTOR_PWM_MIN_CYCLES              (1000u) // keeps a duty resolution of 0.1 %
+
+/* motor calibration config */
+#define PLUTO_MOTOR_CALIB_DUTY_STEP             (500u)  // 0.01 %
+#define PLUTO_MOTOR_CALIB_SETTLE_MS             (300)
+#define PLUTO_MOTOR_CALIB_MEASURE_MS            (500)
+#define PLUTO_MOTOR_CALIB_MIN_SPEED             (10u)   // encoder counts/s
+#define PLUTO_MOTOR_CALIB_POLL_MS               (10)    // abort latency of the sweep
+#define PLUTO_MOTOR_CALIB_THREAD_STACK_SIZE     1024
+#define PLUTO_MOTOR_CALIB_THREAD_PRIORITY       13u
+
+/* control loop config */
+#define PLUTO_CONTROL_THREAD_STACK_SIZE         1024
+#define PLUTO_CONTROL_THREAD_PRIORITY           5u
+#define PLUTO_CONTROL_PERIOD_US                 (1000u)
+#define PLUTO_ENCODER_SPEED_WINDOW              (16u)   // control ticks, must be a power of two
+
+/* stall detection config */
+#define PLUTO_STALL_MIN_DUTY                    (2500u) // 0.01 %
+#define PLUTO_STALL_SPEED                       (20)    // encoder counts/s
+#define PLUTO_STALL_CURRENT_MA                  (3000)
+#define PLUTO_STALL_WINDOW_MS                   (300u)
+#define PLUTO_STALL_CURRENT_MAX_AGE_MS          (1500u)
+
+/* odometry config */
+#define PLUTO_ODOM_WHEEL_RADIUS_UM              (35000u)
+#define PLUTO_ODOM_TRACK_UM                     (200000u)   // distance between the wheel contact points
+#define PLUTO_ODOM_COUNTS_PER_REV               (1440u)     // x4 encoder counts per wheel revolution
+
+/* battery config */
+#define PLUTO_BATTERY_ADC_INPUT                 (-1)        // ADS1115 input of the battery divider, -1 for none
+#define PLUTO_BATTERY_DIVIDER                   (11000u)    // battery mV per V at the ADS1115 input
+#define PLUTO_BATTERY_NOMINAL_MV                (24000u)
+#define PLUTO_BATTERY_FILTER_SHIFT              (2u)        // IIR filter, weight 1/4 per new sample
+#define PLUTO_BATTERY_UPDATE_PERIOD_MS          (10u)
+#define PLUTO_BATTERY_MAX_AGE_MS                (3000u)
+#define PLUTO_BATTERY_COMP_MIN_PERMILLE         (900u)
+#define PLUTO_BATTERY_COMP_MAX_PERMILLE         (1250u)
+#define PLUTO_BATTERY_COMP_RATE                 (100u)      // permille per second
+#define PLUTO_BATTERY_CELLS                     (7u)
+#define PLUTO_BATTERY_OCV_CELL_MV               {3000, 3450, 3600, 3670, 3720, 3770, 3830, 3920, 4000, 4090, 4200}
+                                                            // Li-ion cell OCV at 0, 10, .., 100 % SoC and 25 C
+#define PLUTO_BATTERY_OCV_REF_TEMP_MC           (25000)     // temperature of the OCV table
+#define PLUTO_BATTERY_OCV_TEMP_UV_PER_C         (300)       // cell OCV drop per degree below the table temperature
+#define PLUTO_BATTERY_CAPACITY_MAH              (10000u)
+#define PLUTO_BATTERY_RESISTANCE_MOHM           (150u)      // internal resistance of the pack
+#define PLUTO_BATTERY_CURRENT_INPUT             (-1)        // ADS1115 input of the battery current shunt, -1 for none
+#define PLUTO_BATTERY_CURRENT_GAIN              (1000u)     // mA per V at the ADS1115 input, discharge positive
+#define PLUTO_BATTERY_TEMP_SENSOR               (-1)        // MCP9808 sensor next to the battery, -1 for none
+#define PLUTO_BATTERY_REST_CURRENT_MA           (200)
+#define PLUTO_BATTERY_REST_TIME_MS              (30000u)    // relaxation time before the OCV is trusted
+#define PLUTO_BATTERY_LOW_PERMILLE              (200u)
+#define PLUTO_BATTERY_CRITICAL_PERMILLE         (50u)
+#define PLUTO_BATTERY_LEVEL_HYSTERESIS_PERMILLE (20u)
+
+/* position move config */
+#define PLUTO_MOVE_MAX_SPEED                    (2000)      // encoder counts/s at 100 % speed
+#define PLUTO_MOVE_MAX_SPEED_LIMIT              (40000)     // keeps the squared Q16 profile speed in int64
+#define PLUTO_MOVE_KP                           (500)       // 0.001 % speed per count of position error
+#define PLUTO_MOVE_TOLERANCE                    (10)        // encoder counts
+#define PLUTO_MOVE_SETTLE_TIMEOUT_MS            (1000u)
+#define PLUTO_MOVE_FORWARD_DIR                  (0)         // motor direction in which the encoder counts up
+
+/* control source arbitration config */
+#define PLUTO_ARBITER_MAX_LEASE_MS              (60000u)
+#define PLUTO_ARBITER_SAFETY_LEASE_MS           (1000u)     // motors are held at 0 after a fault
+
+/* proximity sector map config */
+#define PLUTO_SECTORMAP_SECTORS                 (8u)        // sector 0 is centred on the front, counterclockwise
+#define PLUTO_SECTORMAP_FOV_DEG                 (25)        // field of view of a VL53L0X
+#define PLUTO_SECTORMAP_CONE_DEG                (45)        // sectors within this angle of the travel direction gate
+#define PLUTO_SECTORMAP_MAX_AGE_MS              (1500u)     // an older minimum is replaced by any sample
+#define PLUTO_SECTORMAP_RELEASE_MS              (10u)       // the gate opens by 1 % speed per period
+#define PLUTO_SECTORMAP_POSE_P_0                {0, 50}     // mounting bearing in degrees, offset from the centre in mm
+#define PLUTO_SECTORMAP_POSE_P_1                {90, 50}
+#define PLUTO_SECTORMAP_POSE_P_2                {180, 50}
+#define PLUTO_SECTORMAP_POSE_P_3                {-90, 50}
+
+/* safety thread config */
+#define PLUTO_SAFETY_THREAD_STACK_SIZE          512
+#define PLUTO_SAFETY_THREAD_PRIORITY            6u
+#define PLUTO_SAFETY_THREAD_SLEEP_TIME_MS       (50)
+#define PLUTO_SAFETY_PROXY_MAX_AGE_MS           (1500)
+#define PLUTO_SAFETY_ADC_MAX_AGE_MS             (3000)
+#define PLUTO_SAFETY_MOTOR_MAX_AGE_MS           (1000)
+
+/* telemetry config */
+#define PLUTO_TELEMETRY_MIN_PERIOD_MS           (20u)
+
+/* motion event config */
+#define PLUTO_EVENTS_QUEUE_SIZE                 (16)
+
+/* trace config */
+#define PLUTO_TRACE_BUFFER_EVENTS               (1024u) // must be a power of two
+#define PLUTO_TRACE_OVERHEAD_EVENTS             (256u)
+
+/* profiler config */
+#define PLUTO_PROFILER_PC_SLOTS                 (512u)  // must be a power of two
+#define PLUTO_PROFILER_THREAD_SLOTS             (16u)
+#define PLUTO_PROFILER_DEFAULT_PERIOD_US        (1000u)
+
+/* scope capture config */
+#define PLUTO_SCOPE_SAMPLES                     (1024u)
+#define PLUTO_SCOPE_PERIOD_US                   (1200u) // one conversion at 860 SPS is 1163 us
+#define PLUTO_SCOPE_DUMP_RECORDS_PER_LINE       (16u)
 
 #endif //APP_PLUTO_CONFIG_H
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_control.h
+ * @brief Control loop module.
+ *
+ * Header for control loop module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_CONTROL_H
+#define APP_PLUTO_CONTROL_H
+
+#include <zephyr/kernel.h>
+
+// Function declarations
+void control_init(void);
+uint32_t control_get_tick(void);
+
+#endif //APP_PLUTO_CONTROL_H
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_encoder.h
+ * @brief Wheel encoder module.
+ *
+ * Header for encoder module. Encoders are optional, they are only used if the
+ * aliases enc1a/enc1b (motor1) and enc2a/enc2b (motor2) exist in the devicetree.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_ENCODER_H
+#define APP_PLUTO_ENCODER_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+
+#define ENC_1_A DT_ALIAS(enc1a)
+#define ENC_1_B DT_ALIAS(enc1b)
+#define ENC_2_A DT_ALIAS(enc2a)
+#define ENC_2_B DT_ALIAS(enc2b)
+
+enum encoder_id {
+    ENCODER_1,
+    ENCODER_2,
+    ENCODER_COUNT
+};
+
+// Function declarations
+void encoder_init(void);
+bool encoder_is_present(enum encoder_id id);
+int32_t encoder_get_count(enum encoder_id id);
+void encoder_update(void);
+int32_t encoder_get_speed(enum encoder_id id);
+
+#endif //APP_PLUTO_ENCODER_H
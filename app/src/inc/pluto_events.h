@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_events.h
+ * @brief Motion event module.
+ *
+ * Header for motion event module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_EVENTS_H
+#define APP_PLUTO_EVENTS_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+/** @brief Outcome of a motion command. */
+enum event_status {
+    EVENT_DONE,
+    EVENT_ABORTED,
+};
+
+/** @brief Why a motion command was aborted. */
+enum event_reason {
+    EVENT_REASON_NONE,
+    EVENT_REASON_SUPERSEDED,    // Replaced by a newer command for the same motor
+    EVENT_REASON_STOPPED,       // Motor was stopped
+    EVENT_REASON_QUICK_STOP,    // Rejected during a quick stop
+    EVENT_REASON_LIMITED,       // Target lowered by the speed limit
+    EVENT_REASON_FAULT,         // A safety fault was raised
+    EVENT_REASON_TIMEOUT,       // Target not reached in time
+    EVENT_REASON_COMMAND,       // Aborted on request
+};
+
+// Function declarations
+uint32_t events_next_id(void);
+void events_post(uint32_t id, const char *source, enum event_status status, enum event_reason reason);
+void events_set_shell(const struct shell *shell);
+const char *events_reason_to_string(enum event_reason reason);
+
+#endif //APP_PLUTO_EVENTS_H
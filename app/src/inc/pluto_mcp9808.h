@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_mcp9808.h
+ * @brief MCP9808 temperature sensor module.
+ *
+ * Header for mcp9808 module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_MCP9808_H
+#define APP_PLUTO_MCP9808_H
+
+#include <zephyr/kernel.h>
+
+/** @brief Thermal state of a temperature sensor (or of the whole system). */
+enum mcp9808_thermal_state {
+    MCP9808_STATE_NORMAL,
+    MCP9808_STATE_WARNING,
+    MCP9808_STATE_CRITICAL,
+    MCP9808_STATE_ERROR
+};
+
+// Function declarations
+void mcp9808_pluto_init(void);
+enum mcp9808_thermal_state mcp9808_get_thermal_state(void);
+int mcp9808_get_temp(int index, int32_t *temp_mc);
+int mcp9808_get_sample(int index, int32_t *temp_mc, int64_t *timestamp);
+void mcp9808_request(int index);
+
+#endif //APP_PLUTO_MCP9808_H
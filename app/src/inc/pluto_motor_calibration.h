@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_motor_calibration.h
+ * @brief Motor calibration module.
+ *
+ * Header for motor calibration module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_MOTOR_CALIBRATION_H
+#define APP_PLUTO_MOTOR_CALIBRATION_H
+
+#include <zephyr/shell/shell.h>
+
+#include "pluto_motordriver.h"
+
+// Function declarations
+int motor_calibrate_start(motor_t *motor, bool dir, const struct shell *shell);
+void motor_print_duty_map(const motor_t *motor, bool dir, const struct shell *shell);
+
+#endif //APP_PLUTO_MOTOR_CALIBRATION_H
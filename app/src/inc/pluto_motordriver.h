@@ -31,36 +31,121 @@
 /** @brief Wait time before moving to opposite direction. */
 #define WAIT_DIR_CHANGE_INTERVAL_MS 100
 
+/** @brief Number of points of a duty map, at speed 0+, 10, 20, .., 100 %. */
+#define MOTOR_DUTY_MAP_POINTS 11
+/** @brief Duty values are given in 0.01 %. */
+#define MOTOR_DUTY_FULL_SCALE 10000u
+/** @brief PWM channels sharing one counter (slice) on the RP2040, channel n is on slice n / 2. */
+#define MOTOR_PWM_CHANNELS_PER_SLICE 2
+/** @brief Largest PWM period in counter cycles (16 bit counter). */
+#define MOTOR_PWM_MAX_CYCLES 65536u
+/** @brief Duty scale is a Q12 factor applied to every duty written to the PWM output. */
+#define MOTOR_DUTY_SCALE_SHIFT 12
+#define MOTOR_DUTY_SCALE_ONE (1u << MOTOR_DUTY_SCALE_SHIFT)
+/** @brief Fractional bits of the pulse length in PWM counter cycles, used by dithering. */
+#define MOTOR_DITHER_BITS 8
+
+/**
+ * @brief Piecewise linear map from speed percent to PWM duty.
+ *
+ * points[0] is the deadband offset, the duty at which the motor starts to turn,
+ * points[k] the duty for a speed of k * 10 %. The lookup table is expanded from the
+ * points, so the PWM write path needs a single table lookup. Speed 0 is always 0 duty.
+ */
+struct motor_duty_map {
+    uint16_t points[MOTOR_DUTY_MAP_POINTS];
+    uint16_t lut[101];
+};
+
+/** @brief How a motor is brought to standstill. */
+enum motor_stop_category {
+    MOTOR_STOP_CONTROLLED,      // Brake with the normal braking profile
+    MOTOR_STOP_QUICK,           // Brake with the emergency braking profile
+    MOTOR_STOP_IMMEDIATE,       // Cut the PWM output at once
+};
+
 typedef struct {
     const char* name;
     struct gpio_dt_spec dir_pin;
     struct pwm_dt_spec pwm_spec;
-    bool emergency_stop;
+    atomic_t emergency_stop;          // Quick stop in progress, new targets are ignored, set lock-free
+    atomic_t output_cut;              // Immediate stop in progress, the PWM output is held at 0
+    atomic_t stop_pending;            // Bit per motor_stop_category, finished by stop_work
+    struct k_spinlock pwm_lock;       // Serializes PWM writes with the lock-free cut
+    struct k_work stop_work;          // Part of a stop which needs the mutex
     bool direction;
     bool target_direction;
     uint32_t speed;
+    int64_t speed_timestamp;          // Uptime in ticks of the last PWM write
     uint32_t target_speed;
+    uint32_t speed_limit;             // Upper bound for speed, lowered by thermal derating
+    uint32_t duty;                    // Current PWM duty in 0.01 %, before duty scale
+    uint32_t gated_duty;              // Duty after the gate speed cap, before duty scale
+    uint32_t duty_scale;              // Q12 factor on the output duty, battery feed-forward
+    uint32_t gate_speed;              // Upper bound for the output speed, lowered by proximity gating
+    uint32_t period_cycles;           // PWM period in counter cycles
+    uint32_t pulse_q8;                // Exact pulse length in counter cycles, MOTOR_DITHER_BITS fraction
+    uint32_t pulse;                   // Pulse length last written in counter cycles
+    bool dither;                      // Sigma-delta dithering of the pulse fraction
+    uint32_t dither_acc;
     uint32_t acceleration_rate;
     int32_t acceleration_rate_delay;
     uint32_t braking_rate;
     int32_t braking_rate_delay;
+    uint32_t emergency_braking_rate;
+    int32_t emergency_braking_rate_delay;
+    uint32_t command_id;              // Motion command in progress, 0 for none
+    struct motor_duty_map duty_map[2]; // Calibration per direction
     struct k_mutex *mutex;            // Mutex for thread-safe access
-    struct k_timer *timer;            // Timer for non-blocking speed control
+    struct k_work_delayable ramp_work; // Steps the non-blocking speed control, never in ISR context
 
 } motor_t;
 
+/**
+ * @brief One step of a first order sigma-delta modulator.
+ *
+ * Returns the integer part of the pulse, plus one whenever the accumulated fraction
+ * overflows. Over 2^MOTOR_DITHER_BITS steps the mean of the returned pulses is
+ * exactly pulse_q8 / 2^MOTOR_DITHER_BITS. Integer only and deterministic.
+ *
+ * @param acc Accumulator, keeps the fraction between calls.
+ * @param pulse_q8 Pulse length with MOTOR_DITHER_BITS fractional bits.
+ * @return Pulse length to write.
+ */
+static inline uint32_t motor_dither_step(uint32_t *acc, uint32_t pulse_q8) {
+    uint32_t pulse = pulse_q8 >> MOTOR_DITHER_BITS;
+    *acc += pulse_q8 & BIT_MASK(MOTOR_DITHER_BITS);
+    if (*acc >= BIT(MOTOR_DITHER_BITS)) {
+        *acc -= BIT(MOTOR_DITHER_BITS);
+        pulse++;
+    }
+    return pulse;
+}
+
 // Function declarations
 void motordriver_init();
 
 // Function declarations
 void init_motor(motor_t* motor);
 void set_speed(motor_t* motor, uint32_t speed_percent);
-void motor_speed_adjust_timer_expiry_function(struct k_timer *timer_id);
-void set_motors(motor_t *motor1, motor_t *motor2, uint32_t speed1, uint32_t speed2, bool dir1, bool dir2);
+uint32_t set_motors(motor_t *motor1, motor_t *motor2, uint32_t speed1, uint32_t speed2, bool dir1, bool dir2);
 void motordriver_set_dir(motor_t* motor, bool dir);
 void motordriver_adjust_motor_speed_blocking(motor_t* motor, uint32_t target_speed);
-void motordriver_adjust_motor_speed_non_blocking(motor_t *motor, uint32_t target_speed);
-void motordriver_stop_motors();
+uint32_t motordriver_adjust_motor_speed_non_blocking(motor_t *motor, uint32_t target_speed);
+void motordriver_set_target_speed(motor_t *motor, uint32_t target_speed, uint32_t id);
+int motordriver_try_set_target_speed(motor_t *motor, uint32_t target_speed);
+int motordriver_try_set_dir(motor_t *motor, bool dir);
+void motordriver_stop_motor(motor_t *motor, enum motor_stop_category category);
+void motordriver_stop_motors(enum motor_stop_category category);
+void motordriver_set_speed_limit(motor_t *motor, uint32_t limit_percent);
+int motordriver_set_duty_map(motor_t *motor, bool dir, const uint16_t points[MOTOR_DUTY_MAP_POINTS]);
+int motordriver_write_duty(motor_t *motor, uint32_t duty);
+int motordriver_set_pwm_period(motor_t *motor, uint32_t period_ns);
+int motordriver_set_duty_scale(motor_t *motor, uint32_t scale);
+int motordriver_set_gate(motor_t *motor, uint32_t speed_percent);
+int motordriver_drive(motor_t *motor, bool dir, uint32_t speed_percent);
+void motordriver_set_dither(motor_t *motor, bool enable);
+void motordriver_dither_update(void);
 
 void cmd_motor1_init();
 void cmd_motor2_init();
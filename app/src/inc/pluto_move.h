@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_move.h
+ * @brief Position move module.
+ *
+ * Header for position move module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_MOVE_H
+#define APP_PLUTO_MOVE_H
+
+#include <zephyr/kernel.h>
+
+#include "pluto_events.h"
+
+/** @brief State of a position move. */
+enum move_state {
+    MOVE_STATE_IDLE,
+    MOVE_STATE_RUNNING,
+    MOVE_STATE_DONE,
+    MOVE_STATE_ABORTED,
+};
+
+/** @brief Moving axes, motor1 and motor2. */
+enum move_axis_id {
+    MOVE_AXIS_1,
+    MOVE_AXIS_2,
+    MOVE_AXIS_COUNT,
+};
+
+// Function declarations
+void move_update(void);
+int move_start(enum move_axis_id axis_id, int32_t counts, uint32_t max_speed_counts, uint32_t acceleration,
+               uint32_t id);
+void move_abort(enum move_axis_id axis_id, enum event_reason reason);
+enum move_state move_get_state(enum move_axis_id axis_id);
+
+#endif //APP_PLUTO_MOVE_H
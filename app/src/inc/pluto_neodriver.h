@@ -23,8 +23,7 @@
     STRUCTURES
     -----------------------------------------------------------------------*/
 struct pluto_neodriver {
-    const struct device *i2c_dev;
-    uint8_t i2c_addr;
+    struct i2c_dt_spec i2c;
 };
 
 /*=========================================================================
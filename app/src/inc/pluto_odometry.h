@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_odometry.h
+ * @brief Wheel odometry module.
+ *
+ * Header for odometry module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_ODOMETRY_H
+#define APP_PLUTO_ODOMETRY_H
+
+#include <zephyr/kernel.h>
+
+/** @brief Dead reckoned pose of the robot. */
+struct odometry_pose {
+    int64_t x_um;
+    int64_t y_um;
+    uint32_t heading;       // binary angle, 2^32 is one turn
+    int32_t v_mm_s;         // forward speed
+    int32_t w_mrad_s;       // turn rate, counter clockwise positive
+    int64_t timestamp;      // uptime in ticks of the last update
+};
+
+/** @brief Convert a binary angle to millidegrees (0..359999). */
+#define ODOMETRY_BAM_TO_MDEG(bam) ((uint32_t)(((uint64_t)(bam) * 360000u) >> 32))
+
+// Function declarations
+void odometry_init(void);
+void odometry_update(void);
+void odometry_get_pose(struct odometry_pose *pose);
+void odometry_reset(int64_t x_um, int64_t y_um, uint32_t heading);
+int32_t odometry_mm_to_counts(int32_t mm);
+
+#endif //APP_PLUTO_ODOMETRY_H
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_safety.h
+ * @brief Safety supervisor module.
+ *
+ * Header for safety module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_SAFETY_H
+#define APP_PLUTO_SAFETY_H
+
+#include <zephyr/kernel.h>
+
+/** @brief Reason codes of faults which stop the motors. */
+enum safety_fault_reason {
+    SAFETY_FAULT_NONE,
+    SAFETY_FAULT_EM_BUTTON,
+    SAFETY_FAULT_PROXIMITY,
+    SAFETY_FAULT_SENSOR_ERROR,
+    SAFETY_FAULT_ADC_THRESHOLD,
+    SAFETY_FAULT_OVERTEMPERATURE,
+    SAFETY_FAULT_STALE_SIGNAL,
+    SAFETY_FAULT_STALL,
+    SAFETY_FAULT_BATTERY_LOW,
+};
+
+/** @brief Signals whose age is supervised. */
+enum safety_signal_id {
+    SAFETY_SIGNAL_PROXY_0,
+    SAFETY_SIGNAL_PROXY_1,
+    SAFETY_SIGNAL_PROXY_2,
+    SAFETY_SIGNAL_PROXY_3,
+    SAFETY_SIGNAL_ADC_0,
+    SAFETY_SIGNAL_ADC_1,
+    SAFETY_SIGNAL_ADC_2,
+    SAFETY_SIGNAL_ADC_3,
+    SAFETY_SIGNAL_MOTOR_1,
+    SAFETY_SIGNAL_MOTOR_2,
+    SAFETY_SIGNAL_COUNT
+};
+
+// Function declarations
+void safety_init(void);
+void safety_raise_fault(enum safety_fault_reason reason, const char *source);
+enum safety_fault_reason safety_get_last_fault(void);
+uint32_t safety_get_fault_count(void);
+const char *safety_fault_to_string(enum safety_fault_reason reason);
+void safety_signal_register(enum safety_signal_id id, const char *name, const int64_t *timestamp);
+void safety_signal_arm(enum safety_signal_id id, bool armed);
+int64_t safety_signal_get_age_ms(enum safety_signal_id id);
+int64_t safety_read_timestamp(const int64_t *timestamp);
+
+#endif //APP_PLUTO_SAFETY_H
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_scope.h
+ * @brief Triggered waveform capture module.
+ *
+ * Header for scope module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_SCOPE_H
+#define APP_PLUTO_SCOPE_H
+
+#include <zephyr/kernel.h>
+
+#include "ads1115.h"
+
+// Function declarations
+void scope_trigger_external(const char *source);
+bool scope_is_active(void);
+void scope_capture(ADS1115 *ads);
+
+#endif //APP_PLUTO_SCOPE_H
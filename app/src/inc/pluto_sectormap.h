@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_sectormap.h
+ * @brief Proximity sector map module.
+ *
+ * Header for proximity sector map module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_SECTORMAP_H
+#define APP_PLUTO_SECTORMAP_H
+
+#include <zephyr/kernel.h>
+
+/** @brief Number of proximity sensors feeding the map. */
+#define SECTORMAP_NUM_SENSORS 4
+
+/** @brief Mounting pose of a proximity sensor. */
+struct sectormap_pose {
+    int16_t bearing_deg;    // direction the sensor looks to, 0 is the front, counter clockwise positive
+    uint16_t offset_mm;     // distance of the sensor from the centre of the robot
+};
+
+/** @brief Nearest obstacle seen in a sector. */
+struct sectormap_sector {
+    uint32_t range_mm;      // from the centre of the robot
+    int64_t timestamp;      // uptime in ticks of range_mm, 0 if there is none
+    uint8_t sensor;         // sensor which measured range_mm
+    uint8_t blocked;        // bit n is set while sensor n is under its threshold in this sector
+};
+
+// Function declarations
+void sectormap_init(void);
+void sectormap_update(void);
+int sectormap_set_pose(int sensor, int16_t bearing_deg, uint16_t offset_mm);
+void sectormap_add_sample(int sensor, uint32_t distance_mm, bool blocked);
+void sectormap_clear_sensor(int sensor);
+uint32_t sectormap_get_blocked(void);
+int sectormap_get_sector(int index, struct sectormap_sector *sector);
+
+#endif //APP_PLUTO_SECTORMAP_H
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_sensor.h
+ * @brief Sensor channel and sampling scheduler module.
+ *
+ * Header for sensor module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_SENSOR_H
+#define APP_PLUTO_SENSOR_H
+
+#include <zephyr/kernel.h>
+
+/** @brief Device behind a sensor channel. */
+enum sensor_device {
+    SENSOR_DEVICE_VL53L0X,
+    SENSOR_DEVICE_ADS1115,
+    SENSOR_DEVICE_MCP9808,
+};
+
+/** @brief Unit of the integer value of a channel. */
+enum sensor_unit {
+    SENSOR_UNIT_MM,         // millimetre
+    SENSOR_UNIT_MV,         // millivolt
+    SENSOR_UNIT_MC,         // milli degree celsius
+};
+
+/** @brief How far a reading can be trusted, worst last. */
+enum sensor_quality {
+    SENSOR_QUALITY_OK,
+    SENSOR_QUALITY_INVALID, // sampled, but rejected by the quality gate of the device
+    SENSOR_QUALITY_STALE,   // older than the period of the channel plus PLUTO_SENSOR_SLACK_MS
+    SENSOR_QUALITY_ERROR,   // the device failed
+    SENSOR_QUALITY_NONE,    // no sample yet
+};
+
+/** @brief Latest reading of a channel. */
+struct sensor_reading {
+    int32_t value;
+    enum sensor_unit unit;
+    int64_t timestamp;      // uptime in ticks, 0 if there is no sample yet
+    enum sensor_quality quality;
+};
+
+// Function declarations
+void sensor_init(void);
+int sensor_find(const char *name);
+int sensor_get(int channel, struct sensor_reading *reading);
+uint32_t sensor_get_period_ms(enum sensor_device device, int index);
+const char *sensor_unit_to_string(enum sensor_unit unit);
+const char *sensor_quality_to_string(enum sensor_quality quality);
+
+#endif //APP_PLUTO_SENSOR_H
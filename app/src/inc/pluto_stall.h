@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_stall.h
+ * @brief Stall and collision detection module.
+ *
+ * Header for stall detection module
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_STALL_H
+#define APP_PLUTO_STALL_H
+
+#include <zephyr/kernel.h>
+
+// Function declarations
+void stall_update(void);
+bool stall_uses_input(int input);
+
+#endif //APP_PLUTO_STALL_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_trace.h
+ * @brief Event tracing module.
+ *
+ * Header for trace module. Without CONFIG_PLUTO_TRACE all trace points compile
+ * to nothing.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifndef APP_PLUTO_TRACE_H
+#define APP_PLUTO_TRACE_H
+
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Trace event IDs.
+ *
+ * Keep in sync with EVENTS in scripts/pluto_trace2ctf.py.
+ */
+enum pluto_trace_event_id {
+    PLUTO_TRACE_THREAD_SWITCHED_IN = 1,   // arg: thread
+    PLUTO_TRACE_THREAD_SWITCHED_OUT = 2,  // arg: thread
+    PLUTO_TRACE_ISR_ENTER = 3,            // arg: exception number
+    PLUTO_TRACE_ISR_EXIT = 4,
+    PLUTO_TRACE_IDLE = 5,
+    PLUTO_TRACE_RAMP_TICK = 16,           // arg: speed, arg2: motor number
+    PLUTO_TRACE_SENSOR_SWEEP_START = 17,
+    PLUTO_TRACE_SENSOR_SWEEP_END = 18,
+    PLUTO_TRACE_I2C_SUBMIT = 19,          // arg: i2c address, arg2: PLUTO_TRACE_I2C_LEN()
+    PLUTO_TRACE_I2C_COMPLETE = 20,        // arg: i2c address, arg2: return value
+    PLUTO_TRACE_LED_FLUSH = 21,
+};
+
+/** @brief Length argument of PLUTO_TRACE_I2C_SUBMIT, bytes written and bytes read. */
+#define PLUTO_TRACE_I2C_LEN(written, read) ((uint16_t)(((read) << 8) | (written)))
+
+/** @brief One record in the trace ring buffer. */
+struct pluto_trace_event {
+    uint32_t timestamp;     // hardware cycles
+    uint32_t arg;
+    uint16_t id;
+    uint16_t arg2;
+};
+
+#ifdef CONFIG_PLUTO_TRACE
+void pluto_trace(enum pluto_trace_event_id id, uint32_t arg, uint16_t arg2);
+#else
+static inline void pluto_trace(enum pluto_trace_event_id id, uint32_t arg, uint16_t arg2) {}
+#endif
+
+#endif //APP_PLUTO_TRACE_H
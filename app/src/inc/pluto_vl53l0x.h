@@ -5,13 +5,30 @@
 #ifndef APP_PLUTO_VL53L0X_H
 #define APP_PLUTO_VL53L0X_H
 
+#include <zephyr/kernel.h>
+
 enum sensor_mode {
     VL53L0X_MODE_DISTANCE,
     VL53L0X_MODE_PROXIMITY,
     VL53L0X_MODE_OFF,
     VL53L0X_MODE_ERROR
 };
+
+/** @brief Latest sample of a sensor with its quality metrics. */
+struct vl53l0x_sample {
+    uint32_t distance_mm;
+    uint8_t range_status;       // VL53L0X_RANGE_STATUS_*, 0 is a valid range
+    uint32_t signal_kcps;       // return signal rate
+    uint32_t ambient_kcps;      // return ambient rate, high in sunlight
+    uint32_t spad_count;        // effective return SPAD count
+    bool is_valid;              // passed the quality gate
+    int64_t timestamp;          // uptime in ticks, 0 if there is no sample yet
+};
+
 // Function declarations
 void vl53l0x_init(void);
+int vl53l0x_get_distance(int index, uint32_t *distance_mm, int64_t *timestamp);
+int vl53l0x_get_sample(int index, struct vl53l0x_sample *sample);
+void vl53l0x_request(int index);
 
 #endif //APP_PLUTO_VL53L0X_H
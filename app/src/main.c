@@ -22,12 +22,20 @@
  * @author Jannis Ruellmann
  */
 
+#include <zephyr/settings/settings.h>
+
 #include "inc/usb_cli.h"
 #include "inc/user_led.h"
 #include "inc/pluto_relays.h"
 #include "inc/pluto_motordriver.h"
 #include "inc/pluto_vl53l0x.h"
 #include "inc/pluto_em_button.h"
+#include "inc/pluto_mcp9808.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_encoder.h"
+#include "inc/pluto_control.h"
+#include "inc/pluto_odometry.h"
+#include "inc/pluto_sensor.h"
 
 /**
  * @brief Entry point for the Pluto_pico application.
@@ -51,13 +59,25 @@ int main(void) {
     user_led_init();
     /* Init relays */
     relay_init();
+    /* Init safety supervisor */
+    safety_init();
+    /* Init wheel encoders */
+    encoder_init();
+    /* Init odometry */
+    odometry_init();
     /* Init motordriver */
     motordriver_init();
+    /* Start control loop */
+    control_init();
+    /* Init persistent settings, loaded by the modules */
+    settings_subsys_init();
     /* Init vl53l0x*/
     vl53l0x_init();
     /* Init emrgency_button */
     emergency_button_init();
     /* Init mcp9808 temperature sensors */
-    //mcp9808_pluto_init();
+    mcp9808_pluto_init();
+    /* Init sensor sampling scheduler */
+    sensor_init();
     return 0;
 }
@@ -6,12 +6,36 @@
 
 #include "inc/pluto_ads1115.h"
 #include "inc/ads1115.h"
-#include "inc/pluto_motordriver.h"
 #include "inc/pluto_config.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_scope.h"
+#include "inc/usb_cli.h"
 
 LOG_MODULE_REGISTER(pluto_ads1115, LOG_LEVEL_WRN);
 
-ADS1115 ads1115;
+#define ADS1115_NODE DT_NODELABEL(ads1115)
+
+/* Bus and address come from devicetree, the driver itself does not assume a controller */
+ADS1115 ads1115 = {
+        .i2c = I2C_DT_SPEC_GET(ADS1115_NODE),
+};
+
+/* Trigger of synchronized sampling, posted by the control loop */
+struct ads1115_trigger {
+    uint32_t tick;
+    uint32_t cycles;
+};
+
+static uint32_t sync_divisor = PLUTO_ADS1115_SYNC_DIVISOR;
+static uint32_t sync_overruns;
+static bool sync_pending;
+static atomic_t sync_busy;
+static struct ads1115_trigger sync_trigger;
+static struct k_spinlock sync_lock;
+static atomic_t requested_inputs;   // Bit per input, set by the sensor scheduler
+
+/* Given by a sync trigger, by a request of the sensor scheduler and by ads1115_wakeup() */
+K_SEM_DEFINE(ads1115_sync_sem, 0, 1);
 
 static struct ads1115_input inputs[] = {
         { "a_0", false, -1.0, false, 0.0 },
@@ -28,71 +52,184 @@ static void double_to_string(double value, char *str, size_t str_size) {
     snprintf(str, str_size, "%d.%06d", integer_part, fractional_part);
 }
 
+/* An input is supervised for staleness while its threshold guards the motors */
+static void ads1115_update_supervision(int index) {
+    safety_signal_arm(SAFETY_SIGNAL_ADC_0 + index, inputs[index].enabled && inputs[index].threshold_enabled);
+}
+
+/**
+ * @brief Get the latest sample of an input with its timestamp.
+ *
+ * @param index Index of the input (0 for "a_0").
+ * @param voltage Voltage of the input.
+ * @param timestamp Uptime in ticks of the sample, 0 if there is none yet.
+ * @return 0 on success, -EINVAL for an unknown input.
+ */
+int ads1115_get_input(int index, double *voltage, int64_t *timestamp) {
+    if (index < 0 || index >= PLUTO_MCP9808_NUM_SENSORS) {
+        return -EINVAL;
+    }
+    unsigned int key = irq_lock();
+    *voltage = inputs[index].voltage;
+    *timestamp = inputs[index].timestamp;
+    irq_unlock(key);
+    return 0;
+}
+
+/**
+ * @brief Check whether the threshold of any input is enabled.
+ *
+ * Such an input has to be sampled regularly, which a scope capture would stop.
+ */
+bool ads1115_is_guarded(void) {
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        if (inputs[i].enabled && inputs[i].threshold_enabled) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Trigger synchronized sampling, called once per control tick.
+ *
+ * Every sync_divisor-th tick the ADC thread is released to sample the enabled inputs.
+ * A trigger while the previous round is still converting is skipped and counted.
+ *
+ * @param tick Number of the control tick.
+ */
+void ads1115_sync_update(uint32_t tick) {
+    uint32_t divisor = sync_divisor;
+    if (divisor == 0 || tick % divisor != 0) {
+        return;
+    }
+    if (atomic_get(&sync_busy)) {
+        sync_overruns++;
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&sync_lock);
+    sync_trigger.tick = tick;
+    sync_trigger.cycles = k_cycle_get_32();
+    sync_pending = true;
+    k_spin_unlock(&sync_lock, key);
+    k_sem_give(&ads1115_sync_sem);
+}
+
+/* Take the pending trigger, a tick of 0 means the round is not synchronized */
+static struct ads1115_trigger ads1115_take_trigger(void) {
+    struct ads1115_trigger trigger = {.tick = 0, .cycles = k_cycle_get_32()};
+    k_spinlock_key_t key = k_spin_lock(&sync_lock);
+    if (sync_pending) {
+        trigger = sync_trigger;
+        sync_pending = false;
+    }
+    k_spin_unlock(&sync_lock, key);
+    return trigger;
+}
+
 void ads1115_thread(void) {
+    ADS1115_init(&ads1115);
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        safety_signal_register(SAFETY_SIGNAL_ADC_0 + i, inputs[i].name, &inputs[i].timestamp);
+    }
     while (1) {
+        if (scope_is_active()) {
+            scope_capture(&ads1115);
+        }
+        struct ads1115_trigger trigger = ads1115_take_trigger();
+        atomic_val_t requested = atomic_clear(&requested_inputs);
+        // A short conversion keeps the sampling window at a known phase of the tick
+        ADS1115_setSPS(&ads1115, trigger.tick != 0 ? SPS_860 : SPS_128);
+        atomic_set(&sync_busy, 1);
         for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+            // A synchronized round samples all inputs, otherwise only the requested ones
+            if (trigger.tick == 0 && !(requested & BIT(i))) {
+                continue;
+            }
             double input = -1.0;
             if (inputs[i].enabled) {
-                switch (i) {
-                    case 0:
-                        input = (double) ADS1115_readADC(&ads1115, CH_0);
-                        break;
-                    case 1:
-                        input = (double) ADS1115_readADC(&ads1115, CH_1);
-                        break;
-                    case 2:
-                        input = (double) ADS1115_readADC(&ads1115, CH_2);
-                        break;
-                    case 3:
-                        input = (double) ADS1115_readADC(&ads1115, CH_3);
-                        break;
-                    default:
-                        input = -1.0;
-                        break;
+                static const adc_Ch_t channels[] = { CH_0, CH_1, CH_2, CH_3 };
+                float voltage;
+                uint32_t start = k_cycle_get_32();
+                int ret = ADS1115_readADC(&ads1115, channels[i], &voltage);
+                uint32_t end = k_cycle_get_32();
+                if (ret) {
+                    // Keep the last sample, its age tells the safety supervisor that the input went stale
+                    LOG_WRN("Reading input %d failed: %d", i, ret);
+                    continue;
                 }
+                input = (double) voltage;
+                unsigned int key = irq_lock();
                 inputs[i].voltage = input;
+                inputs[i].timestamp = k_uptime_ticks();
+                inputs[i].tick = trigger.tick;
+                inputs[i].phase_us = k_cyc_to_us_floor32(start - trigger.cycles);
+                inputs[i].latency_us = k_cyc_to_us_floor32(end - trigger.cycles);
+                irq_unlock(key);
             }
             // Check threshold and perform special action if needed
             if (inputs[i].threshold_enabled && input < inputs[i].threshold) {
-                // Perform special action
-                char vol_str[16];
-                double_to_string(input, vol_str, sizeof(vol_str));
-                LOG_INF("Threshold exceeded for input %d: %s V", i, vol_str);
-                motordriver_stop_motors();
+                // Perform special action, log raw millivolts to keep formatting off the device
+                LOG_INF("Threshold exceeded for input %d: %d mV", i, (int32_t)(input * 1000));
+                safety_raise_fault(SAFETY_FAULT_ADC_THRESHOLD, inputs[i].name);
+                // No samples are taken while holding off, do not report them as stale
+                safety_signal_arm(SAFETY_SIGNAL_ADC_0 + i, false);
                 k_sleep(K_SECONDS(PLUTO_ADS1115_THRESH_SLEEP_TIME_S));
+                ads1115_update_supervision(i);
             }
         }
-        k_sleep(K_SECONDS(PLUTO_ADS1115_THREAD_SLEEP_TIME_S));
+        atomic_clear(&sync_busy);
+        k_sem_take(&ads1115_sync_sem, K_FOREVER);
     }
 }
 
 K_THREAD_DEFINE(ads1115_thread_id, PLUTO_ADS1115_THREAD_STACK_SIZE, ads1115_thread, NULL, NULL, NULL,
                 PLUTO_ADS1115_THREAD_PRIORITY, 0, 0);
 
-static int cmd_ads1115_list_inputs(const struct shell *shell, size_t argc, char **argv) {
-    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
-        shell_print(shell, "Input %d: %s, Enabled: %s", i, inputs[i].name, inputs[i].enabled ? "Yes" : "No");
+/**
+ * @brief Request a sample of an input, called by the sensor scheduler.
+ *
+ * While sampling is synchronized to the control tick, the triggered rounds sample all
+ * inputs and a request does not start an extra round.
+ *
+ * @param index Index of the input (0 for "a_0").
+ */
+void ads1115_request(int index) {
+    if (index < 0 || index >= PLUTO_MCP9808_NUM_SENSORS) {
+        return;
+    }
+    atomic_set_bit(&requested_inputs, index);
+    if (sync_divisor == 0) {
+        k_sem_give(&ads1115_sync_sem);
     }
-    return 0;
 }
 
-static int cmd_ads1115_get_input(const struct shell *shell, size_t argc, char **argv) {
-    if (argc != 2) {
-        shell_error(shell, "Usage: ads1115 get-input <input_index>");
-        return -EINVAL;
-    }
-    int input_index = atoi(argv[1]);
-    if (input_index < 0 || input_index >= PLUTO_MCP9808_NUM_SENSORS) {
-        shell_error(shell, "Invalid input index.");
-        return -EINVAL;
+/**
+ * @brief Wake the ADC thread up early, e.g. to start an armed scope capture.
+ */
+void ads1115_wakeup(void) {
+    k_sem_give(&ads1115_sync_sem);
+}
+
+/*
+ * Smallest tick divisor a synchronized round of the enabled inputs fits in, one input
+ * takes its conversion plus the transfers around it. Shorter divisors overrun every trigger.
+ */
+static uint32_t ads1115_min_sync_divisor(int extra_input) {
+    uint32_t count = 0;
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        if (inputs[i].enabled || i == extra_input) {
+            count++;
+        }
     }
-    if (!inputs[input_index].enabled) {
-        shell_print(shell, "-1");
-        return 0;
+    uint32_t round_us = count * (PLUTO_ADS1115_SYNC_CONVERSION_US + PLUTO_ADS1115_SYNC_TRANSFER_US);
+    return MAX(1u, DIV_ROUND_UP(round_us, PLUTO_CONTROL_PERIOD_US));
+}
+
+static int cmd_ads1115_list_inputs(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        shell_print(shell, "Input %d: %s, Enabled: %s", i, inputs[i].name, inputs[i].enabled ? "Yes" : "No");
     }
-    char vol_str[16];
-    double_to_string(inputs[input_index].voltage, vol_str, sizeof(vol_str));
-    shell_print(shell, "%d: %s", input_index, vol_str);
     return 0;
 }
 
@@ -107,7 +244,13 @@ static int cmd_ads1115_config_input(const struct shell *shell, size_t argc, char
         return -EINVAL;
     }
     bool enable = strcmp(argv[2], "e") == 0;
+    uint32_t min_divisor = ads1115_min_sync_divisor(input_index);
+    if (enable && sync_divisor != 0 && sync_divisor < min_divisor) {
+        shell_error(shell, "Sync divisor %u too short for the inputs, at least %u.", sync_divisor, min_divisor);
+        return -EINVAL;
+    }
     inputs[input_index].enabled = enable;
+    ads1115_update_supervision(input_index);
     shell_print(shell, "ads1115_%d %s", input_index, enable ? "enabled" : "disabled");
     return 0;
 }
@@ -126,25 +269,66 @@ static int cmd_ads1115_config_threshold(const struct shell *shell, size_t argc,
 
     bool enable = strcmp(argv[2], "e") == 0;
     double threshold = atof(argv[3]);
+    if (enable && scope_is_active()) {
+        shell_error(shell, "Scope is armed, the input would not be sampled.");
+        return -EBUSY;
+    }
 
     inputs[input_index].threshold_enabled = enable;
     inputs[input_index].threshold = threshold;
+    ads1115_update_supervision(input_index);
     char thr_str[16];
     double_to_string(inputs[input_index].threshold, thr_str, sizeof(thr_str));
     shell_print(shell, "Threshold for ads1115_%d %s with value %s", input_index, enable ? "enabled" : "disabled", thr_str);
     return 0;
 }
 
+static int cmd_ads1115_config_sync(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Usage: ads1115 config-sync <tick_divisor|0>");
+        return -EINVAL;
+    }
+    uint32_t divisor = simple_strtou32(argv[1]);
+    uint32_t min_divisor = ads1115_min_sync_divisor(-1);
+    if (divisor != 0 && divisor < min_divisor) {
+        shell_error(shell, "A round of the enabled inputs takes %u ticks, use 0 or at least that.", min_divisor);
+        return -EINVAL;
+    }
+    sync_divisor = divisor;
+    sync_overruns = 0;
+    shell_print(shell, "%u", sync_divisor);
+    return 0;
+}
+
+/* Prints "<divisor> <overruns>", then "<name> <tick> <phase_us> <latency_us>" per enabled input */
+static int cmd_ads1115_get_sync(const struct shell *shell, size_t argc, char **argv) {
+    shell_print(shell, "%u %u", sync_divisor, sync_overruns);
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        if (!inputs[i].enabled) {
+            continue;
+        }
+        unsigned int key = irq_lock();
+        struct ads1115_input input = inputs[i];
+        irq_unlock(key);
+        shell_print(shell, "%s %u %u %u", input.name, input.tick, input.phase_us, input.latency_us);
+    }
+    return 0;
+}
+
 void pluto_ads1115_init() {
     LOG_INF("Initializing ads1115 module");
     ADS1115_init(&ads1115);
 }
 
 SHELL_STATIC_SUBCMD_SET_CREATE(sub_ads1115,
-                               SHELL_CMD(get-input, NULL, "Get voltage of ads1115 input <input_index>.", cmd_ads1115_get_input),
                                SHELL_CMD(config-input, NULL, "Enable/disable ads1115 input <input_index>.", cmd_ads1115_config_input),
                                SHELL_CMD(config-threshold, NULL, "Set threshold for ads1115 input <input_index>.", cmd_ads1115_config_threshold),
                                SHELL_CMD(list-inputs, NULL, "List all ads1115 inputs.", cmd_ads1115_list_inputs),
+                               SHELL_CMD(config-sync, NULL, "Sample every <tick_divisor>-th control tick, 0 for the channel periods. "
+                                         "At least 3 ticks per enabled input at a 1 ms tick.",
+                                         cmd_ads1115_config_sync),
+                               SHELL_CMD(get-sync, NULL, "Get trigger tick, phase and latency of the inputs.",
+                                         cmd_ads1115_get_sync),
                                SHELL_SUBCMD_SET_END
 );
 
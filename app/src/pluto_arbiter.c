@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_arbiter.c
+ * @brief Control Source Arbitration Module
+ *
+ * Several sources want to drive the motors: the fleet host, an on-device script,
+ * a maintenance operator on the shell and the safety module. Each source holds a
+ * lease with a timeout and keeps its own setpoints (speed and direction per motor).
+ * Only the setpoints of the live source with the highest priority (the owner) reach
+ * the ramp generator of the motor driver:
+ *
+ *     safety > operator > host > script
+ *
+ * The arbitration runs once per control tick. The live leases are a bitmask indexed
+ * by priority, the owner is its most significant bit; only the lease of the owner
+ * is checked for expiry, so the decision is O(1) per tick. A handover is smooth, the
+ * new owner's setpoints are approached with the normal acceleration and braking
+ * ramps, a direction change brakes to 0 first.
+ *
+ * While any lease is live, the direct motor commands (motor1/motor2/motors/move)
+ * are rejected. When the last lease ends, the motors brake to standstill.
+ *
+ * A safety fault takes a safety lease of PLUTO_ARBITER_SAFETY_LEASE_MS with zero
+ * setpoints and clears the setpoints of all other sources, so that the motors do
+ * not resume on their own after the fault.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <string.h>
+
+#include "inc/pluto_arbiter.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_move.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_arbiter, LOG_LEVEL_WRN);
+
+struct arbiter_setpoint {
+    uint8_t speed;
+    bool dir;
+};
+
+static const char *source_names[ARBITER_SOURCE_COUNT] = {"script", "host", "operator", "safety"};
+
+static uint32_t lease_mask;
+static int64_t lease_expiry[ARBITER_SOURCE_COUNT];
+static struct arbiter_setpoint setpoints[ARBITER_SOURCE_COUNT][2];
+static enum arbiter_source owner = ARBITER_SOURCE_NONE;
+static struct k_spinlock arbiter_lock;
+
+/**
+ * @brief Get the printable name of a source.
+ */
+const char *arbiter_source_to_string(enum arbiter_source source) {
+    if (source < 0 || source >= ARBITER_SOURCE_COUNT) {
+        return "none";
+    }
+    return source_names[source];
+}
+
+/* Highest priority live lease, expired leases on the way are dropped. Lock must be held. */
+static enum arbiter_source arbiter_find_owner(int64_t now) {
+    while (lease_mask != 0) {
+        enum arbiter_source source = find_msb_set(lease_mask) - 1;
+        if (now < lease_expiry[source]) {
+            return source;
+        }
+        lease_mask &= ~BIT(source);
+    }
+    return ARBITER_SOURCE_NONE;
+}
+
+/* Approach the setpoint with the ramp generator, brake to 0 before a direction change */
+static void arbiter_apply(motor_t *motor, const struct arbiter_setpoint *setpoint) {
+    if (atomic_get(&motor->emergency_stop)) {
+        return;
+    }
+    // Never waits for the motor, a motor held by the ramp work or a shell command is retried on the next tick
+    if (motor->direction != setpoint->dir) {
+        if (motor->target_speed != 0) {
+            motordriver_try_set_target_speed(motor, 0);
+        } else if (motor->speed == 0) {
+            motordriver_try_set_dir(motor, setpoint->dir);
+        }
+        return;
+    }
+    uint32_t target_speed = MIN(setpoint->speed, motor->speed_limit);
+    if (motor->target_speed != target_speed) {
+        motordriver_try_set_target_speed(motor, target_speed);
+    }
+}
+
+/**
+ * @brief Select the owner and forward its setpoints, called once per control tick.
+ */
+void arbiter_update(void) {
+    struct arbiter_setpoint current[2];
+    k_spinlock_key_t key = k_spin_lock(&arbiter_lock);
+    enum arbiter_source new_owner = arbiter_find_owner(k_uptime_ticks());
+    if (new_owner != ARBITER_SOURCE_NONE) {
+        memcpy(current, setpoints[new_owner], sizeof(current));
+    }
+    k_spin_unlock(&arbiter_lock, key);
+
+    enum arbiter_source previous = owner;
+    owner = new_owner;
+    if (new_owner != previous) {
+        LOG_INF("Owner %s -> %s", arbiter_source_to_string(previous), arbiter_source_to_string(new_owner));
+        if (previous == ARBITER_SOURCE_NONE) {
+            for (int i = 0; i < MOVE_AXIS_COUNT; i++) {
+                move_abort(i, EVENT_REASON_SUPERSEDED);
+            }
+        }
+        if (new_owner == ARBITER_SOURCE_NONE) {
+            motordriver_stop_motors(MOTOR_STOP_CONTROLLED);
+        }
+    }
+    if (new_owner == ARBITER_SOURCE_NONE) {
+        return;
+    }
+    arbiter_apply(&motor1, &current[0]);
+    arbiter_apply(&motor2, &current[1]);
+}
+
+/**
+ * @brief Take or renew the lease of a source, ISR safe.
+ *
+ * The owner is re-evaluated on the next control tick.
+ *
+ * @param source Source of the lease.
+ * @param lease_ms Lease time, renew before it runs out.
+ * @return 0 on success, -EINVAL for an invalid source or lease time.
+ */
+int arbiter_acquire(enum arbiter_source source, uint32_t lease_ms) {
+    if (source < 0 || source >= ARBITER_SOURCE_COUNT || lease_ms == 0 || lease_ms > PLUTO_ARBITER_MAX_LEASE_MS) {
+        return -EINVAL;
+    }
+    k_spinlock_key_t key = k_spin_lock(&arbiter_lock);
+    if (source == ARBITER_SOURCE_SAFETY) {
+        memset(setpoints, 0, sizeof(setpoints));
+    }
+    lease_expiry[source] = k_uptime_ticks() + k_ms_to_ticks_ceil64(lease_ms);
+    lease_mask |= BIT(source);
+    k_spin_unlock(&arbiter_lock, key);
+    return 0;
+}
+
+/**
+ * @brief End the lease of a source.
+ */
+void arbiter_release(enum arbiter_source source) {
+    if (source < 0 || source >= ARBITER_SOURCE_COUNT) {
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&arbiter_lock);
+    lease_mask &= ~BIT(source);
+    k_spin_unlock(&arbiter_lock, key);
+}
+
+/**
+ * @brief Set the setpoints of a source, applied while it is the owner.
+ *
+ * @return 0 on success, -EINVAL for an invalid source, -EPERM for the safety source
+ *         (always 0).
+ */
+int arbiter_set(enum arbiter_source source, uint32_t speed1, bool dir1, uint32_t speed2, bool dir2) {
+    if (source < 0 || source >= ARBITER_SOURCE_COUNT) {
+        return -EINVAL;
+    }
+    if (source == ARBITER_SOURCE_SAFETY) {
+        return -EPERM;
+    }
+    k_spinlock_key_t key = k_spin_lock(&arbiter_lock);
+    setpoints[source][0].speed = MIN(speed1, 100);
+    setpoints[source][0].dir = dir1;
+    setpoints[source][1].speed = MIN(speed2, 100);
+    setpoints[source][1].dir = dir2;
+    k_spin_unlock(&arbiter_lock, key);
+    return 0;
+}
+
+/**
+ * @brief Get the current owner, ARBITER_SOURCE_NONE if no lease is live.
+ */
+enum arbiter_source arbiter_get_owner(void) {
+    return owner;
+}
+
+/**
+ * @brief Check for shell commands which drive the motors directly.
+ *
+ * @return 0 if no source owns the motors, -EACCES with an error on the shell otherwise.
+ */
+int arbiter_check_unowned(const struct shell *shell) {
+    enum arbiter_source current = owner;
+    if (current != ARBITER_SOURCE_NONE) {
+        shell_error(shell, "Motors are owned by %s.", arbiter_source_to_string(current));
+        return -EACCES;
+    }
+    return 0;
+}
+
+static enum arbiter_source arbiter_parse_source(const struct shell *shell, const char *name) {
+    // The safety source is only taken by the safety module
+    for (int i = 0; i < ARBITER_SOURCE_SAFETY; i++) {
+        if (strcmp(name, source_names[i]) == 0) {
+            return i;
+        }
+    }
+    shell_error(shell, "Invalid source, use script, host or operator.");
+    return ARBITER_SOURCE_NONE;
+}
+
+static int cmd_arbiter_acquire(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: arbiter acquire <source> <lease_ms>");
+        return -EINVAL;
+    }
+    enum arbiter_source source = arbiter_parse_source(shell, argv[1]);
+    if (source == ARBITER_SOURCE_NONE) {
+        return -EINVAL;
+    }
+    if (arbiter_acquire(source, simple_strtou32(argv[2])) != 0) {
+        shell_error(shell, "Lease must be 1..%u ms.", PLUTO_ARBITER_MAX_LEASE_MS);
+        return -EINVAL;
+    }
+    shell_print(shell, "%s", source_names[source]);
+    return 0;
+}
+
+static int cmd_arbiter_release(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments. Usage: arbiter release <source>");
+        return -EINVAL;
+    }
+    enum arbiter_source source = arbiter_parse_source(shell, argv[1]);
+    if (source == ARBITER_SOURCE_NONE) {
+        return -EINVAL;
+    }
+    arbiter_release(source);
+    shell_print(shell, "%s", source_names[source]);
+    return 0;
+}
+
+static int cmd_arbiter_set(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 6) {
+        shell_error(shell, "Invalid number of arguments. "
+                           "Usage: arbiter set <source> <speed_motor1> <dir_motor1> <speed_motor2> <dir_motor2>");
+        return -EINVAL;
+    }
+    enum arbiter_source source = arbiter_parse_source(shell, argv[1]);
+    if (source == ARBITER_SOURCE_NONE) {
+        return -EINVAL;
+    }
+    uint32_t speed1 = MIN(simple_strtou32(argv[2]), 100);
+    bool dir1 = simple_strtou32(argv[3]) != 0;
+    uint32_t speed2 = MIN(simple_strtou32(argv[4]), 100);
+    bool dir2 = simple_strtou32(argv[5]) != 0;
+    arbiter_set(source, speed1, dir1, speed2, dir2);
+    shell_print(shell, "%d %d %d %d", speed1, dir1, speed2, dir2);
+    return 0;
+}
+
+/* Prints "<owner>" followed by "<source>=<lease_left_ms>" for each live lease */
+static int cmd_arbiter_get(const struct shell *shell, size_t argc, char **argv) {
+    int64_t now = k_uptime_ticks();
+    shell_fprintf(shell, SHELL_NORMAL, "%s", arbiter_source_to_string(owner));
+    k_spinlock_key_t key = k_spin_lock(&arbiter_lock);
+    uint32_t mask = lease_mask;
+    int64_t expiry[ARBITER_SOURCE_COUNT];
+    memcpy(expiry, lease_expiry, sizeof(expiry));
+    k_spin_unlock(&arbiter_lock, key);
+    for (int i = ARBITER_SOURCE_COUNT - 1; i >= 0; i--) {
+        if ((mask & BIT(i)) && expiry[i] > now) {
+            shell_fprintf(shell, SHELL_NORMAL, " %s=%lld", source_names[i], k_ticks_to_ms_floor64(expiry[i] - now));
+        }
+    }
+    shell_fprintf(shell, SHELL_NORMAL, "\n");
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "arbiter". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_arbiter,
+                               SHELL_CMD(acquire, NULL, "Take or renew the lease of <script|host|operator> for <lease_ms>.",
+                                         cmd_arbiter_acquire),
+                               SHELL_CMD(release, NULL, "End the lease of <script|host|operator>.",
+                                         cmd_arbiter_release),
+                               SHELL_CMD(set, NULL,
+                                         "Set setpoints of <source> <speed_motor1> <dir_motor1> <speed_motor2> <dir_motor2>.",
+                                         cmd_arbiter_set),
+                               SHELL_CMD(get, NULL, "Get <owner> and <source>=<lease_left_ms> of live leases.",
+                                         cmd_arbiter_get),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "arbiter" */
+SHELL_CMD_REGISTER(arbiter, &sub_arbiter, "Control source arbitration.", NULL);
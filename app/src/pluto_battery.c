@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_battery.c
+ * @brief Battery Monitoring Module
+ *
+ * Measures the battery voltage over a divider on an ADS1115 input and compensates
+ * the motor duty for it (feed-forward). With a draining battery the same duty gives
+ * less wheel speed, so every duty written to the PWM output is scaled by
+ * nominal / actual battery voltage. Open loop speed then stays the same without
+ * encoders.
+ *
+ * The compensation
+ * - uses the battery voltage low pass filtered over the new ADS1115 samples,
+ * - is bounded to PLUTO_BATTERY_COMP_MIN_PERMILLE..PLUTO_BATTERY_COMP_MAX_PERMILLE,
+ * - changes at most by the configured rate, so a voltage drop under load does not
+ *   cause a duty step,
+ * - goes back to 1.0 if the battery sample is older than PLUTO_BATTERY_MAX_AGE_MS,
+ * - is switched on per motor.
+ *
+ * The factor is updated every PLUTO_BATTERY_UPDATE_PERIOD_MS from the control loop,
+ * the factor itself is applied in the PWM write path of the motor driver.
+ *
+ * State of charge (SoC) is estimated from the same samples:
+ * - The open circuit voltage (OCV) is the filtered voltage plus the drop over the
+ *   internal resistance at the battery current. It is corrected to the temperature
+ *   of the OCV table, if a temperature sensor is configured.
+ * - SoC is interpolated from the OCV table of one cell. This is only trusted at rest:
+ *   both motors stopped and, with a current input, the current below
+ *   PLUTO_BATTERY_REST_CURRENT_MA for PLUTO_BATTERY_REST_TIME_MS. The remaining
+ *   charge is re-anchored to it then, and once at the first sample.
+ * - Between anchors the remaining charge is counted down by the current samples
+ *   (coulomb counting). Without a current input SoC only changes at rest.
+ * - The remaining runtime is the remaining charge over the filtered current.
+ * - Falling below PLUTO_BATTERY_LOW_PERMILLE logs a warning, falling below
+ *   PLUTO_BATTERY_CRITICAL_PERMILLE raises SAFETY_FAULT_BATTERY_LOW, once per
+ *   crossing. A level is left with a hysteresis.
+ *
+ * The model runs only when a new ADS1115 sample arrives, a few integer operations
+ * per sample.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "inc/pluto_battery.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_ads1115.h"
+#include "inc/pluto_mcp9808.h"
+#include "inc/pluto_scope.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_battery, LOG_LEVEL_WRN);
+
+#define BATTERY_NO_INPUT (-1)
+#define BATTERY_UPDATE_TICKS (PLUTO_BATTERY_UPDATE_PERIOD_MS * USEC_PER_MSEC / PLUTO_CONTROL_PERIOD_US)
+#define PERMILLE_TO_Q12(permille) ((uint32_t)(permille) * MOTOR_DUTY_SCALE_ONE / 1000u)
+#define Q12_TO_PERMILLE(q12) ((uint32_t)(q12) * 1000u / MOTOR_DUTY_SCALE_ONE)
+#define BATTERY_MAH_TO_UAS(mah) ((int64_t)(mah) * 3600000)
+#define BATTERY_OCV_STEP_PERMILLE (1000u / (ARRAY_SIZE(ocv_cell_mv) - 1u))
+/* Largest change of the factor per update for a rate in permille per second, at least 1 */
+#define BATTERY_STEP_Q12(rate) MAX(1u, PERMILLE_TO_Q12(rate) * PLUTO_BATTERY_UPDATE_PERIOD_MS / MSEC_PER_SEC)
+
+struct battery_compensation {
+    motor_t *motor;
+    bool enabled;
+};
+
+static struct battery_compensation compensations[] = {
+        {.motor = &motor1, .enabled = false},
+        {.motor = &motor2, .enabled = false},
+};
+
+static int8_t input = PLUTO_BATTERY_ADC_INPUT;
+static uint32_t divider = PLUTO_BATTERY_DIVIDER;
+static uint32_t nominal_mv = PLUTO_BATTERY_NOMINAL_MV;
+static uint32_t rate = PLUTO_BATTERY_COMP_RATE;
+static uint32_t step_q12 = BATTERY_STEP_Q12(PLUTO_BATTERY_COMP_RATE);
+static uint32_t factor_q12 = MOTOR_DUTY_SCALE_ONE;
+static uint32_t filtered_mv;
+static int64_t sample_timestamp;
+static uint32_t ticks;
+static struct k_spinlock battery_lock;
+
+static const uint16_t ocv_cell_mv[] = PLUTO_BATTERY_OCV_CELL_MV;
+
+struct battery_soc {
+    uint32_t capacity_mah;
+    uint32_t resistance_mohm;
+    int8_t current_input;           // ADS1115 input of the current shunt, BATTERY_NO_INPUT for none
+    uint32_t current_gain;          // mA per V at the ADS1115 input
+    int8_t temp_sensor;             // MCP9808 sensor, BATTERY_NO_INPUT for none
+    uint32_t low_permille;
+    uint32_t critical_permille;
+    int32_t current_ma;             // filtered, discharge positive
+    int64_t current_timestamp;
+    int64_t voltage_timestamp;      // last voltage sample used by the model
+    uint32_t ocv_mv;
+    int64_t remaining_uas;          // remaining charge in uAs
+    int64_t rest_since;             // uptime in ticks since the battery rests, 0 under load
+    bool anchored;
+    enum battery_level level;
+};
+
+static struct battery_soc soc = {
+        .capacity_mah = PLUTO_BATTERY_CAPACITY_MAH,
+        .resistance_mohm = PLUTO_BATTERY_RESISTANCE_MOHM,
+        .current_input = PLUTO_BATTERY_CURRENT_INPUT,
+        .current_gain = PLUTO_BATTERY_CURRENT_GAIN,
+        .temp_sensor = PLUTO_BATTERY_TEMP_SENSOR,
+        .low_permille = PLUTO_BATTERY_LOW_PERMILLE,
+        .critical_permille = PLUTO_BATTERY_CRITICAL_PERMILLE,
+        .level = BATTERY_LEVEL_NORMAL,
+};
+
+/* Filter a new battery sample, returns true if the filtered voltage is fresh */
+static bool battery_sample(int64_t now) {
+    if (input == BATTERY_NO_INPUT) {
+        return false;
+    }
+    double voltage;
+    int64_t timestamp;
+    ads1115_get_input(input, &voltage, &timestamp);
+    if (timestamp != 0 && timestamp != sample_timestamp && voltage >= 0.0) {
+        uint32_t sample_mv = (uint32_t)(voltage * divider);
+        k_spinlock_key_t key = k_spin_lock(&battery_lock);
+        if (sample_timestamp == 0) {
+            filtered_mv = sample_mv;
+        } else {
+            filtered_mv = (uint32_t)((int32_t)filtered_mv +
+                                     (((int32_t)sample_mv - (int32_t)filtered_mv) >> PLUTO_BATTERY_FILTER_SHIFT));
+        }
+        sample_timestamp = timestamp;
+        k_spin_unlock(&battery_lock, key);
+    }
+    return sample_timestamp != 0 && k_ticks_to_ms_floor64(now - sample_timestamp) <= PLUTO_BATTERY_MAX_AGE_MS;
+}
+
+/* Interpolate the OCV table, the table is per cell */
+static uint32_t battery_ocv_to_permille(uint32_t ocv_mv) {
+    uint32_t cell_mv = ocv_mv / PLUTO_BATTERY_CELLS;
+    if (cell_mv <= ocv_cell_mv[0]) {
+        return 0;
+    }
+    for (int i = 1; i < ARRAY_SIZE(ocv_cell_mv); i++) {
+        if (cell_mv < ocv_cell_mv[i]) {
+            return (i - 1) * BATTERY_OCV_STEP_PERMILLE +
+                   (cell_mv - ocv_cell_mv[i - 1]) * BATTERY_OCV_STEP_PERMILLE / (ocv_cell_mv[i] - ocv_cell_mv[i - 1]);
+        }
+    }
+    return 1000;
+}
+
+/* Voltage without load at the temperature of the OCV table */
+static uint32_t battery_estimate_ocv(void) {
+    int32_t ocv_mv = (int32_t)filtered_mv + soc.current_ma * (int32_t)soc.resistance_mohm / 1000;
+    int32_t temp_mc;
+    if (soc.temp_sensor != BATTERY_NO_INPUT && mcp9808_get_temp(soc.temp_sensor, &temp_mc) == 0) {
+        ocv_mv += (PLUTO_BATTERY_OCV_REF_TEMP_MC - temp_mc) / 1000 * PLUTO_BATTERY_OCV_TEMP_UV_PER_C *
+                  (int32_t)PLUTO_BATTERY_CELLS / 1000;
+    }
+    return (uint32_t)MAX(ocv_mv, 0);
+}
+
+static uint32_t battery_soc_permille(void) {
+    int64_t capacity_uas = BATTERY_MAH_TO_UAS(soc.capacity_mah);
+    return capacity_uas ? (uint32_t)(soc.remaining_uas * 1000 / capacity_uas) : 0;
+}
+
+/* Count the charge of a new current sample, the current is held since the previous sample */
+static void battery_update_current(void) {
+    if (soc.current_input == BATTERY_NO_INPUT) {
+        return;
+    }
+    double voltage;
+    int64_t timestamp;
+    ads1115_get_input(soc.current_input, &voltage, &timestamp);
+    if (timestamp == 0 || timestamp == soc.current_timestamp) {
+        return;
+    }
+    int32_t current_ma = (int32_t)(voltage * soc.current_gain);
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    if (soc.current_timestamp == 0) {
+        soc.current_ma = current_ma;
+    } else {
+        int64_t dt_ms = MIN(k_ticks_to_ms_floor64(timestamp - soc.current_timestamp), PLUTO_BATTERY_MAX_AGE_MS);
+        if (soc.anchored) {
+            // mA times ms is uAs
+            soc.remaining_uas = CLAMP(soc.remaining_uas - (int64_t)current_ma * dt_ms, 0,
+                                      BATTERY_MAH_TO_UAS(soc.capacity_mah));
+        }
+        soc.current_ma += (current_ma - soc.current_ma) >> PLUTO_BATTERY_FILTER_SHIFT;
+    }
+    soc.current_timestamp = timestamp;
+    k_spin_unlock(&battery_lock, key);
+}
+
+static bool battery_at_rest(void) {
+    if (motor1.speed != 0 || motor2.speed != 0) {
+        return false;
+    }
+    return soc.current_input == BATTERY_NO_INPUT || abs(soc.current_ma) <= PLUTO_BATTERY_REST_CURRENT_MA;
+}
+
+static void battery_update_level(void) {
+    uint32_t permille = battery_soc_permille();
+    enum battery_level level = BATTERY_LEVEL_NORMAL;
+    if (permille <= soc.critical_permille ||
+        (soc.level == BATTERY_LEVEL_CRITICAL && permille <= soc.critical_permille + PLUTO_BATTERY_LEVEL_HYSTERESIS_PERMILLE)) {
+        level = BATTERY_LEVEL_CRITICAL;
+    } else if (permille <= soc.low_permille ||
+               (soc.level != BATTERY_LEVEL_NORMAL && permille <= soc.low_permille + PLUTO_BATTERY_LEVEL_HYSTERESIS_PERMILLE)) {
+        level = BATTERY_LEVEL_LOW;
+    }
+    if (level == soc.level) {
+        return;
+    }
+    if (level > soc.level) {
+        LOG_WRN("Battery %s at %u permille", battery_level_to_string(level), permille);
+    }
+    if (level == BATTERY_LEVEL_CRITICAL) {
+        safety_raise_fault(SAFETY_FAULT_BATTERY_LOW, "battery");
+    }
+    soc.level = level;
+}
+
+/* Run the SoC model on a new voltage sample */
+static void battery_update_soc(int64_t now) {
+    if (sample_timestamp == 0 || sample_timestamp == soc.voltage_timestamp) {
+        return;
+    }
+    if (!battery_at_rest()) {
+        soc.rest_since = 0;
+    } else if (soc.rest_since == 0) {
+        soc.rest_since = now;
+    }
+    bool settled = soc.rest_since != 0 && k_ticks_to_ms_floor64(now - soc.rest_since) >= PLUTO_BATTERY_REST_TIME_MS;
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    soc.voltage_timestamp = sample_timestamp;
+    soc.ocv_mv = battery_estimate_ocv();
+    if (!soc.anchored || settled) {
+        soc.remaining_uas = BATTERY_MAH_TO_UAS(soc.capacity_mah) * battery_ocv_to_permille(soc.ocv_mv) / 1000;
+        soc.anchored = true;
+    }
+    k_spin_unlock(&battery_lock, key);
+    battery_update_level();
+}
+
+/**
+ * @brief Get a printable name of a battery level.
+ */
+const char *battery_level_to_string(enum battery_level level) {
+    switch (level) {
+        case BATTERY_LEVEL_NORMAL:
+            return "normal";
+        case BATTERY_LEVEL_LOW:
+            return "low";
+        case BATTERY_LEVEL_CRITICAL:
+            return "critical";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Get the state of charge and the remaining runtime at the present current.
+ *
+ * @param soc_permille State of charge in permille.
+ * @param runtime_s Remaining runtime in s, -1 without a current input or at rest.
+ * @return 0 on success, -ENODATA if there is no estimate yet.
+ */
+int battery_get_soc(uint32_t *soc_permille, int32_t *runtime_s) {
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    if (!soc.anchored) {
+        k_spin_unlock(&battery_lock, key);
+        return -ENODATA;
+    }
+    *soc_permille = battery_soc_permille();
+    *runtime_s = -1;
+    if (soc.current_input != BATTERY_NO_INPUT && soc.current_ma > PLUTO_BATTERY_REST_CURRENT_MA) {
+        *runtime_s = (int32_t)(soc.remaining_uas / soc.current_ma / 1000);
+    }
+    k_spin_unlock(&battery_lock, key);
+    return 0;
+}
+
+/**
+ * @brief Check whether an ADS1115 input is the voltage or current input of the battery.
+ *
+ * @param index Index of the input, -1 for any input.
+ */
+bool battery_uses_input(int index) {
+    int8_t current_input = soc.current_input;
+    return (input != BATTERY_NO_INPUT && (index < 0 || input == index)) ||
+           (current_input != BATTERY_NO_INPUT && (index < 0 || current_input == index));
+}
+
+/**
+ * @brief Update the battery voltage and the duty compensation, called once per control tick.
+ */
+void battery_update(void) {
+    if (++ticks < BATTERY_UPDATE_TICKS) {
+        return;
+    }
+    ticks = 0;
+    int64_t now = k_uptime_ticks();
+    uint32_t target_q12 = MOTOR_DUTY_SCALE_ONE;
+    bool fresh = battery_sample(now);
+    battery_update_current();
+    battery_update_soc(now);
+    if (fresh && filtered_mv != 0) {
+        target_q12 = (uint32_t)((uint64_t)nominal_mv * MOTOR_DUTY_SCALE_ONE / filtered_mv);
+        target_q12 = CLAMP(target_q12, PERMILLE_TO_Q12(PLUTO_BATTERY_COMP_MIN_PERMILLE),
+                           PERMILLE_TO_Q12(PLUTO_BATTERY_COMP_MAX_PERMILLE));
+    }
+    if (target_q12 > factor_q12) {
+        factor_q12 = MIN(target_q12, factor_q12 + step_q12);
+    } else if (target_q12 < factor_q12) {
+        factor_q12 = MAX(target_q12, factor_q12 - step_q12);
+    }
+    for (int i = 0; i < ARRAY_SIZE(compensations); i++) {
+        uint32_t scale = compensations[i].enabled ? factor_q12 : MOTOR_DUTY_SCALE_ONE;
+        // A busy motor is updated on the next period
+        motordriver_set_duty_scale(compensations[i].motor, scale);
+    }
+}
+
+/**
+ * @brief Get the filtered battery voltage.
+ *
+ * @param voltage_mv Filtered battery voltage in mV.
+ * @param timestamp Uptime in ticks of the last sample, 0 if there is none.
+ * @return 0 on success, -ENODEV if no battery input is configured.
+ */
+int battery_get_voltage(uint32_t *voltage_mv, int64_t *timestamp) {
+    if (input == BATTERY_NO_INPUT) {
+        return -ENODEV;
+    }
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    *voltage_mv = filtered_mv;
+    *timestamp = sample_timestamp;
+    k_spin_unlock(&battery_lock, key);
+    return 0;
+}
+
+/* Prints "<battery_mV> <age_ms> <factor_permille> <motor1_scale_permille> <motor2_scale_permille>" */
+static int cmd_battery_get(const struct shell *shell, size_t argc, char **argv) {
+    uint32_t voltage_mv = 0;
+    int64_t timestamp = 0;
+    battery_get_voltage(&voltage_mv, &timestamp);
+    int64_t age_ms = timestamp ? k_ticks_to_ms_floor64(k_uptime_ticks() - timestamp) : -1;
+    shell_print(shell, "%u %lld %u %u %u", voltage_mv, age_ms, Q12_TO_PERMILLE(factor_q12),
+                Q12_TO_PERMILLE(motor1.duty_scale), Q12_TO_PERMILLE(motor2.duty_scale));
+    return 0;
+}
+
+/* Prints "<soc_permille> <remaining_mAh> <runtime_s> <current_mA> <ocv_mV> <level>" */
+static int cmd_battery_get_soc(const struct shell *shell, size_t argc, char **argv) {
+    uint32_t soc_permille;
+    int32_t runtime_s;
+    if (battery_get_soc(&soc_permille, &runtime_s) != 0) {
+        shell_print(shell, "-1");
+        return 0;
+    }
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    uint32_t remaining_mah = (uint32_t)(soc.remaining_uas / 3600000);
+    int32_t current_ma = soc.current_ma;
+    uint32_t ocv_mv = soc.ocv_mv;
+    k_spin_unlock(&battery_lock, key);
+    shell_print(shell, "%u %u %d %d %u %s", soc_permille, remaining_mah, runtime_s, current_ma, ocv_mv,
+                battery_level_to_string(soc.level));
+    return 0;
+}
+
+static int cmd_battery_config_current(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: battery config-current <input|-1> <mA_per_V>");
+        return -EINVAL;
+    }
+    int index = atoi(argv[1]);
+    uint32_t gain = simple_strtou32(argv[2]);
+    if (index < BATTERY_NO_INPUT || index > 3 || gain == 0) {
+        shell_error(shell, "Invalid input index or gain.");
+        return -EINVAL;
+    }
+    if (index != BATTERY_NO_INPUT && scope_is_active()) {
+        shell_error(shell, "Scope is armed, the input would not be sampled.");
+        return -EBUSY;
+    }
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    soc.current_input = (int8_t)index;
+    soc.current_gain = gain;
+    soc.current_timestamp = 0;
+    soc.current_ma = 0;
+    k_spin_unlock(&battery_lock, key);
+    shell_print(shell, "%d %u", soc.current_input, soc.current_gain);
+    return 0;
+}
+
+static int cmd_battery_config_model(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 4) {
+        shell_error(shell, "Invalid number of arguments. "
+                           "Usage: battery config-model <capacity_mAh> <resistance_mOhm> <temp_sensor|-1>");
+        return -EINVAL;
+    }
+    uint32_t capacity_mah = simple_strtou32(argv[1]);
+    uint32_t resistance_mohm = simple_strtou32(argv[2]);
+    int temp_sensor = atoi(argv[3]);
+    if (capacity_mah == 0 || temp_sensor < BATTERY_NO_INPUT) {
+        shell_error(shell, "Invalid capacity or temperature sensor.");
+        return -EINVAL;
+    }
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    soc.capacity_mah = capacity_mah;
+    soc.resistance_mohm = resistance_mohm;
+    soc.temp_sensor = (int8_t)temp_sensor;
+    // Start over from the OCV of the next sample
+    soc.anchored = false;
+    k_spin_unlock(&battery_lock, key);
+    shell_print(shell, "%u %u %d", soc.capacity_mah, soc.resistance_mohm, soc.temp_sensor);
+    return 0;
+}
+
+static int cmd_battery_config_levels(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: battery config-levels <low_permille> <critical_permille>");
+        return -EINVAL;
+    }
+    uint32_t low_permille = simple_strtou32(argv[1]);
+    uint32_t critical_permille = simple_strtou32(argv[2]);
+    if (low_permille > 1000 || critical_permille > low_permille) {
+        shell_error(shell, "Invalid levels, expected critical <= low <= 1000.");
+        return -EINVAL;
+    }
+    soc.low_permille = low_permille;
+    soc.critical_permille = critical_permille;
+    shell_print(shell, "%u %u", soc.low_permille, soc.critical_permille);
+    return 0;
+}
+
+static int cmd_battery_config_input(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: battery config-input <input|-1> <mV_per_V>");
+        return -EINVAL;
+    }
+    int index = atoi(argv[1]);
+    uint32_t new_divider = simple_strtou32(argv[2]);
+    if (index < BATTERY_NO_INPUT || index > 3 || new_divider == 0) {
+        shell_error(shell, "Invalid input index or divider.");
+        return -EINVAL;
+    }
+    if (index != BATTERY_NO_INPUT && scope_is_active()) {
+        shell_error(shell, "Scope is armed, the input would not be sampled.");
+        return -EBUSY;
+    }
+    k_spinlock_key_t key = k_spin_lock(&battery_lock);
+    input = (int8_t)index;
+    divider = new_divider;
+    sample_timestamp = 0;
+    filtered_mv = 0;
+    k_spin_unlock(&battery_lock, key);
+    shell_print(shell, "%d %u", input, divider);
+    return 0;
+}
+
+static int cmd_battery_config_comp(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: battery config-comp <nominal_mV> <rate_permille_per_s>");
+        return -EINVAL;
+    }
+    uint32_t new_nominal_mv = simple_strtou32(argv[1]);
+    uint32_t new_rate = simple_strtou32(argv[2]);
+    if (new_nominal_mv == 0 || new_rate == 0) {
+        shell_error(shell, "Invalid nominal voltage or rate.");
+        return -EINVAL;
+    }
+    nominal_mv = new_nominal_mv;
+    rate = new_rate;
+    step_q12 = BATTERY_STEP_Q12(new_rate);
+    shell_print(shell, "%u %u", nominal_mv, rate);
+    return 0;
+}
+
+static int cmd_battery_enable_comp(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: battery enable-comp <1|2> <0|1>");
+        return -EINVAL;
+    }
+    uint8_t number = simple_strtou8(argv[1]);
+    if (number < 1 || number > ARRAY_SIZE(compensations)) {
+        shell_error(shell, "Invalid motor.");
+        return -EINVAL;
+    }
+    compensations[number - 1].enabled = simple_strtou8(argv[2]) != 0;
+    shell_print(shell, "%d", compensations[number - 1].enabled);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "battery". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_battery,
+                               SHELL_CMD(get, NULL,
+                                         "Get <battery_mV> <age_ms> <factor_permille> <motor1_scale> <motor2_scale>.",
+                                         cmd_battery_get),
+                               SHELL_CMD(get-soc, NULL,
+                                         "Get <soc_permille> <remaining_mAh> <runtime_s> <current_mA> <ocv_mV> <level>.",
+                                         cmd_battery_get_soc),
+                               SHELL_CMD(config-current, NULL, "Set ADS1115 current input <input|-1> and gain <mA_per_V>.",
+                                         cmd_battery_config_current),
+                               SHELL_CMD(config-model, NULL,
+                                         "Set <capacity_mAh> <resistance_mOhm> and MCP9808 <temp_sensor|-1>.",
+                                         cmd_battery_config_model),
+                               SHELL_CMD(config-levels, NULL, "Set SoC warning levels <low_permille> <critical_permille>.",
+                                         cmd_battery_config_levels),
+                               SHELL_CMD(config-input, NULL, "Set ADS1115 battery input <input|-1> and divider <mV_per_V>.",
+                                         cmd_battery_config_input),
+                               SHELL_CMD(config-comp, NULL, "Set <nominal_mV> and compensation rate <permille_per_s>.",
+                                         cmd_battery_config_comp),
+                               SHELL_CMD(enable-comp, NULL, "Enable(1)/disable(0) voltage compensation of motor <1|2>.",
+                                         cmd_battery_enable_comp),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "battery" */
+SHELL_CMD_REGISTER(battery, &sub_battery, "Battery voltage, state of charge and motor feed-forward.", NULL);
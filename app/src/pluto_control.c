@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_control.c
+ * @brief Control Loop Module
+ *
+ * Runs the periodic control tasks (encoder speed estimation, odometry, control
+ * source arbitration, position moves, proximity gating, stall detection, battery
+ * feed-forward, duty dithering, analog sample trigger) in a high priority thread which is released by a kernel timer every
+ * PLUTO_CONTROL_PERIOD_US. Each task does a bounded amount of work per tick.
+ *
+ * The loop counts its ticks, overruns (a tick released before the previous one was
+ * done) and the longest execution time, shown with "control get-stats".
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "inc/pluto_control.h"
+#include "inc/pluto_encoder.h"
+#include "inc/pluto_stall.h"
+#include "inc/pluto_odometry.h"
+#include "inc/pluto_battery.h"
+#include "inc/pluto_move.h"
+#include "inc/pluto_arbiter.h"
+#include "inc/pluto_sectormap.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_ads1115.h"
+#include "inc/pluto_config.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_control, LOG_LEVEL_WRN);
+
+K_THREAD_STACK_DEFINE(control_stack, PLUTO_CONTROL_THREAD_STACK_SIZE);
+static struct k_thread control_thread_data;
+
+K_SEM_DEFINE(control_tick_sem, 0, 1);
+
+static uint32_t tick;
+static uint32_t overruns;
+static uint32_t max_exec_cycles;
+
+static void control_timer_expiry(struct k_timer *timer_id) {
+    if (k_sem_count_get(&control_tick_sem) != 0) {
+        overruns++;
+    }
+    k_sem_give(&control_tick_sem);
+}
+
+K_TIMER_DEFINE(control_timer, control_timer_expiry, NULL);
+
+/**
+ * @brief Get the number of control ticks since start.
+ */
+uint32_t control_get_tick(void) {
+    return tick;
+}
+
+static void control_thread(void *arg1, void *arg2, void *arg3) {
+    while (1) {
+        k_sem_take(&control_tick_sem, K_FOREVER);
+        uint32_t start = k_cycle_get_32();
+        tick++;
+        // First, so that the analog samples start at a fixed phase of the tick
+        ads1115_sync_update(tick);
+        encoder_update();
+        odometry_update();
+        arbiter_update();
+        move_update();
+        sectormap_update();
+        stall_update();
+        battery_update();
+        motordriver_dither_update();
+        max_exec_cycles = MAX(max_exec_cycles, k_cycle_get_32() - start);
+    }
+}
+
+void control_init(void) {
+    k_tid_t tid = k_thread_create(&control_thread_data, control_stack,
+                                  K_THREAD_STACK_SIZEOF(control_stack),
+                                  control_thread, NULL, NULL, NULL,
+                                  PLUTO_CONTROL_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "control");
+    k_timer_start(&control_timer, K_USEC(PLUTO_CONTROL_PERIOD_US), K_USEC(PLUTO_CONTROL_PERIOD_US));
+}
+
+/* Prints "<tick> <period_us> <overruns> <max_exec_us>" */
+static int cmd_control_get_stats(const struct shell *shell, size_t argc, char **argv) {
+    shell_print(shell, "%u %u %u %u", tick, PLUTO_CONTROL_PERIOD_US, overruns,
+                k_cyc_to_us_ceil32(max_exec_cycles));
+    return 0;
+}
+
+static int cmd_control_reset_stats(const struct shell *shell, size_t argc, char **argv) {
+    overruns = 0;
+    max_exec_cycles = 0;
+    shell_print(shell, "0");
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "control". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_control,
+                               SHELL_CMD(get-stats, NULL, "Get <tick> <period_us> <overruns> <max_exec_us>.",
+                                         cmd_control_get_stats),
+                               SHELL_CMD(reset-stats, NULL, "Reset overruns and max execution time.",
+                                         cmd_control_reset_stats),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "control" */
+SHELL_CMD_REGISTER(control, &sub_control, "Control loop.", NULL);
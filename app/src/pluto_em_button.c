@@ -10,7 +10,7 @@
 #include <string.h>
 
 #include "inc/pluto_em_button.h"
-#include "inc/pluto_motordriver.h"
+#include "inc/pluto_safety.h"
 #include "inc/usb_cli.h"
 
 /* Enable logging for module. Change Log Level for debugging. */
@@ -24,11 +24,12 @@ static bool motor_stop_enabled = false;
 /* Function prototypes */
 bool get_em_button_by_name(const char *name);
 
+/* GPIO interrupt, safety_raise_fault() cuts the motors without waiting for a lock */
 void emergency_button_pressed(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
 {
     LOG_DBG("State of emergency button changed!");
     if (motor_stop_enabled) {
-        motordriver_stop_motors();
+        safety_raise_fault(SAFETY_FAULT_EM_BUTTON, "em_0");
     } else {
         LOG_DBG("Motor stop not enabled.");
     }
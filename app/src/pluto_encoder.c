@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_encoder.c
+ * @brief Quadrature Wheel Encoder Module
+ *
+ * Counts the edges of the A and B channels of a quadrature encoder per motor in
+ * GPIO interrupts (x4 decoding). The count is signed, positive for direction 1 of
+ * the motor if the channels are wired accordingly.
+ *
+ * The speed is estimated in the control loop from the count difference over the
+ * last PLUTO_ENCODER_SPEED_WINDOW control ticks.
+ *
+ * The encoder channels are taken from the devicetree aliases enc1a/enc1b and
+ * enc2a/enc2b. Without the aliases the encoder is reported as not present and the
+ * users of this module fall back to open loop operation.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "inc/pluto_encoder.h"
+#include "inc/usb_cli.h"
+#include "inc/pluto_config.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_encoder, LOG_LEVEL_WRN);
+
+struct encoder {
+    struct gpio_dt_spec a;
+    struct gpio_dt_spec b;
+    struct gpio_callback cb_a;
+    struct gpio_callback cb_b;
+    uint8_t state;          // Last AB state, A in bit 1
+    atomic_t count;
+    int32_t history[PLUTO_ENCODER_SPEED_WINDOW];
+    int32_t speed;          // counts/s
+};
+
+BUILD_ASSERT((PLUTO_ENCODER_SPEED_WINDOW & (PLUTO_ENCODER_SPEED_WINDOW - 1)) == 0,
+             "PLUTO_ENCODER_SPEED_WINDOW must be a power of two");
+
+static uint32_t history_index;
+
+static struct encoder encoders[ENCODER_COUNT] = {
+        [ENCODER_1] = {
+                .a = GPIO_DT_SPEC_GET_OR(ENC_1_A, gpios, {0}),
+                .b = GPIO_DT_SPEC_GET_OR(ENC_1_B, gpios, {0}),
+        },
+        [ENCODER_2] = {
+                .a = GPIO_DT_SPEC_GET_OR(ENC_2_A, gpios, {0}),
+                .b = GPIO_DT_SPEC_GET_OR(ENC_2_B, gpios, {0}),
+        },
+};
+
+/* Count change indexed by (previous AB state << 2) | new AB state, 0 for invalid transitions */
+static const int8_t quadrature_table[16] = {
+        0, -1, 1, 0,
+        1, 0, 0, -1,
+        -1, 0, 0, 1,
+        0, 1, -1, 0,
+};
+
+static uint8_t encoder_read_state(const struct encoder *encoder) {
+    return (uint8_t)((gpio_pin_get_dt(&encoder->a) << 1) | gpio_pin_get_dt(&encoder->b));
+}
+
+static void encoder_edge(const struct device *dev, struct gpio_callback *cb, uint32_t pins) {
+    for (int i = 0; i < ENCODER_COUNT; i++) {
+        struct encoder *encoder = &encoders[i];
+        if (cb != &encoder->cb_a && cb != &encoder->cb_b) {
+            continue;
+        }
+        uint8_t state = encoder_read_state(encoder);
+        atomic_add(&encoder->count, quadrature_table[(encoder->state << 2) | state]);
+        encoder->state = state;
+    }
+}
+
+bool encoder_is_present(enum encoder_id id) {
+    return encoders[id].a.port != NULL && encoders[id].b.port != NULL;
+}
+
+/**
+ * @brief Get the accumulated count of an encoder.
+ *
+ * @param id Encoder ID.
+ * @return Count in quadrature edges, 0 if the encoder is not present.
+ */
+int32_t encoder_get_count(enum encoder_id id) {
+    return (int32_t)atomic_get(&encoders[id].count);
+}
+
+/**
+ * @brief Update the speed estimate of all encoders, called once per control tick.
+ */
+void encoder_update(void) {
+    uint32_t index = history_index++ & (PLUTO_ENCODER_SPEED_WINDOW - 1);
+    for (int i = 0; i < ENCODER_COUNT; i++) {
+        struct encoder *encoder = &encoders[i];
+        int32_t count = (int32_t)atomic_get(&encoder->count);
+        encoder->speed = (int32_t)((int64_t)(count - encoder->history[index]) * USEC_PER_SEC /
+                                   (PLUTO_ENCODER_SPEED_WINDOW * PLUTO_CONTROL_PERIOD_US));
+        encoder->history[index] = count;
+    }
+}
+
+/**
+ * @brief Get the speed of an encoder.
+ *
+ * @param id Encoder ID.
+ * @return Speed in counts/s, averaged over PLUTO_ENCODER_SPEED_WINDOW control ticks.
+ */
+int32_t encoder_get_speed(enum encoder_id id) {
+    return encoders[id].speed;
+}
+
+static int encoder_configure_pin(const struct gpio_dt_spec *pin, struct gpio_callback *cb) {
+    int ret = gpio_pin_configure_dt(pin, GPIO_INPUT);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = gpio_pin_interrupt_configure_dt(pin, GPIO_INT_EDGE_BOTH);
+    if (ret != 0) {
+        return ret;
+    }
+    gpio_init_callback(cb, encoder_edge, BIT(pin->pin));
+    return gpio_add_callback(pin->port, cb);
+}
+
+void encoder_init(void) {
+    for (int i = 0; i < ENCODER_COUNT; i++) {
+        struct encoder *encoder = &encoders[i];
+        if (!encoder_is_present(i)) {
+            LOG_INF("Encoder %d not present.", i + 1);
+            continue;
+        }
+        int ret = encoder_configure_pin(&encoder->a, &encoder->cb_a);
+        if (ret == 0) {
+            ret = encoder_configure_pin(&encoder->b, &encoder->cb_b);
+        }
+        encoder->state = encoder_read_state(encoder);
+        if (ret != 0) {
+            LOG_ERR("Error %d: failed to configure encoder %d", ret, i + 1);
+            encoder->a.port = NULL;
+        }
+    }
+}
+
+static int cmd_encoder_get_count(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments. Usage: encoder get-count <1|2>");
+        return -EINVAL;
+    }
+    uint8_t number = simple_strtou8(argv[1]);
+    if (number < 1 || number > ENCODER_COUNT) {
+        shell_error(shell, "Invalid encoder.");
+        return -EINVAL;
+    }
+    if (!encoder_is_present(number - 1)) {
+        shell_error(shell, "Encoder %d not present.", number);
+        return -ENODEV;
+    }
+    shell_print(shell, "%d", encoder_get_count(number - 1));
+    return 0;
+}
+
+static int cmd_encoder_get_speed(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments. Usage: encoder get-speed <1|2>");
+        return -EINVAL;
+    }
+    uint8_t number = simple_strtou8(argv[1]);
+    if (number < 1 || number > ENCODER_COUNT || !encoder_is_present(number - 1)) {
+        shell_error(shell, "Encoder %d not present.", number);
+        return -ENODEV;
+    }
+    shell_print(shell, "%d", encoder_get_speed(number - 1));
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "encoder". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_encoder,
+                               SHELL_CMD(get-count, NULL, "Get count of encoder <1|2>.", cmd_encoder_get_count),
+                               SHELL_CMD(get-speed, NULL, "Get speed of encoder <1|2> in counts/s.", cmd_encoder_get_speed),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "encoder" */
+SHELL_CMD_REGISTER(encoder, &sub_encoder, "Wheel encoders.", NULL);
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_events.c
+ * @brief Motion Event Module
+ *
+ * Every motion command (set-speed, set-dir, motors set, move) gets a command ID,
+ * which the command prints. When the command has completed or was aborted, an event
+ * is pushed to the shell which issued the last motion command, so the host does not
+ * need to poll the speed:
+ * ```
+ * event <id> <source> <done|aborted> <reason> <uptime_ms>
+ * ```
+ * The uptime is the time of completion, not of printing.
+ *
+ * Events can be posted from any context including ISRs (the e-stop path). They
+ * are queued and printed from the system work queue. If the queue is full the event
+ * is dropped and counted, see "events get-stats".
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "inc/pluto_events.h"
+#include "inc/pluto_config.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_events, LOG_LEVEL_WRN);
+
+struct event {
+    uint32_t id;
+    const char *source;
+    enum event_status status;
+    enum event_reason reason;
+    int64_t timestamp;
+};
+
+K_MSGQ_DEFINE(event_queue, sizeof(struct event), PLUTO_EVENTS_QUEUE_SIZE, 4);
+
+static const struct shell *event_shell;
+static atomic_t next_id = ATOMIC_INIT(0);
+static atomic_t posted;
+static atomic_t dropped;
+
+static void events_work_handler(struct k_work *work);
+
+K_WORK_DEFINE(events_work, events_work_handler);
+
+/**
+ * @brief Get a printable name of an abort reason.
+ */
+const char *events_reason_to_string(enum event_reason reason) {
+    switch (reason) {
+        case EVENT_REASON_NONE:
+            return "none";
+        case EVENT_REASON_SUPERSEDED:
+            return "superseded";
+        case EVENT_REASON_STOPPED:
+            return "stopped";
+        case EVENT_REASON_QUICK_STOP:
+            return "quick-stop";
+        case EVENT_REASON_LIMITED:
+            return "limited";
+        case EVENT_REASON_FAULT:
+            return "fault";
+        case EVENT_REASON_TIMEOUT:
+            return "timeout";
+        case EVENT_REASON_COMMAND:
+            return "command";
+        default:
+            return "unknown";
+    }
+}
+
+static void events_work_handler(struct k_work *work) {
+    struct event event;
+    while (k_msgq_get(&event_queue, &event, K_NO_WAIT) == 0) {
+        if (event_shell == NULL) {
+            continue;
+        }
+        shell_print(event_shell, "event %u %s %s %s %lld", event.id, event.source,
+                    event.status == EVENT_DONE ? "done" : "aborted", events_reason_to_string(event.reason),
+                    k_ticks_to_ms_floor64(event.timestamp));
+    }
+}
+
+/**
+ * @brief Get a new motion command ID, never 0.
+ */
+uint32_t events_next_id(void) {
+    uint32_t id = (uint32_t)atomic_inc(&next_id) + 1;
+    return (id == 0) ? (uint32_t)atomic_inc(&next_id) + 1 : id;
+}
+
+/**
+ * @brief Report the completion or abort of a motion command, ISR safe.
+ *
+ * @param id Command ID from events_next_id(), 0 is ignored.
+ * @param source Name of the motor or module, must stay valid.
+ * @param status Done or aborted.
+ * @param reason Reason of an abort, EVENT_REASON_NONE when done.
+ */
+void events_post(uint32_t id, const char *source, enum event_status status, enum event_reason reason) {
+    if (id == 0) {
+        return;
+    }
+    struct event event = {
+            .id = id,
+            .source = source,
+            .status = status,
+            .reason = reason,
+            .timestamp = k_uptime_ticks(),
+    };
+    if (k_msgq_put(&event_queue, &event, K_NO_WAIT) != 0) {
+        atomic_inc(&dropped);
+        return;
+    }
+    atomic_inc(&posted);
+    k_work_submit(&events_work);
+}
+
+/**
+ * @brief Set the shell events are printed on, NULL to stop printing.
+ */
+void events_set_shell(const struct shell *shell) {
+    event_shell = shell;
+}
+
+static int cmd_events_subscribe(const struct shell *shell, size_t argc, char **argv) {
+    events_set_shell(shell);
+    shell_print(shell, "1");
+    return 0;
+}
+
+static int cmd_events_unsubscribe(const struct shell *shell, size_t argc, char **argv) {
+    events_set_shell(NULL);
+    shell_print(shell, "0");
+    return 0;
+}
+
+/* Prints "<last_id> <posted> <dropped>" */
+static int cmd_events_get_stats(const struct shell *shell, size_t argc, char **argv) {
+    shell_print(shell, "%u %u %u", (uint32_t)atomic_get(&next_id), (uint32_t)atomic_get(&posted),
+                (uint32_t)atomic_get(&dropped));
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "events". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_events,
+                               SHELL_CMD(subscribe, NULL, "Print motion events on this shell.", cmd_events_subscribe),
+                               SHELL_CMD(unsubscribe, NULL, "Stop printing motion events.", cmd_events_unsubscribe),
+                               SHELL_CMD(get-stats, NULL, "Get <last_id> <posted> <dropped>.", cmd_events_get_stats),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "events" */
+SHELL_CMD_REGISTER(events, &sub_events, "Motion command completion events.", NULL);
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_i2c_stats.c
+ * @brief I2C Bus Utilization Module
+ *
+ * The VL53L0X sensors sit on i2c1, the ADS1115, MCP9808 and NeoDriver on i2c0, so
+ * transfers of the proximity lanes and of the ADC thread run on both controllers at
+ * the same time. This module reports how busy each bus is, based on the transfer
+ * counters that the I2C API keeps per controller (CONFIG_I2C_STATS). They count every
+ * transfer, including those issued inside the Zephyr sensor drivers.
+ *
+ * The bus time is estimated from the counted bytes: every byte and every address byte
+ * takes 9 clocks, start and stop conditions add 2 clocks per message. Clock stretching
+ * and the gaps between messages are not included, so the estimate is a lower bound.
+ *
+ * "i2cbus get-stats" prints per bus, since the last reset:
+ * ```
+ * <bus> <transfers> <messages> <bytes> <busy_us> <utilization_permille>
+ * ```
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_i2c_stats, LOG_LEVEL_WRN);
+
+#define I2C_STATS_CLOCKS_PER_BYTE    9u
+#define I2C_STATS_CLOCKS_PER_MESSAGE 2u
+
+struct i2c_bus_counters {
+    uint32_t transfers;
+    uint32_t messages;
+    uint32_t bytes;
+};
+
+struct i2c_bus {
+    const char *name;
+    const struct device *dev;
+    uint32_t bitrate;
+    struct i2c_bus_counters baseline;
+    int64_t baseline_ms;
+};
+
+#define I2C_STATS_BUS(label) \
+    { #label, DEVICE_DT_GET(DT_NODELABEL(label)), DT_PROP(DT_NODELABEL(label), clock_frequency) }
+
+static struct i2c_bus buses[] = {
+        I2C_STATS_BUS(i2c0),
+        I2C_STATS_BUS(i2c1),
+};
+
+static void i2c_stats_read(const struct i2c_bus *bus, struct i2c_bus_counters *counters) {
+    /* Same lookup as the I2C API uses when it counts a transfer */
+    const struct i2c_device_state *state = CONTAINER_OF(bus->dev->state, struct i2c_device_state, devstate);
+    counters->transfers = state->stats.transfer_call_count;
+    counters->messages = state->stats.message_count;
+    counters->bytes = state->stats.bytes_read + state->stats.bytes_written;
+}
+
+/* Counters and uptime start at 0 at boot, so the first window needs no reset */
+static void i2c_stats_reset(void) {
+    for (int i = 0; i < ARRAY_SIZE(buses); i++) {
+        i2c_stats_read(&buses[i], &buses[i].baseline);
+        buses[i].baseline_ms = k_uptime_get();
+    }
+}
+
+static int cmd_i2c_stats_get(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = 0; i < ARRAY_SIZE(buses); i++) {
+        struct i2c_bus *bus = &buses[i];
+        struct i2c_bus_counters now;
+        i2c_stats_read(bus, &now);
+        uint32_t transfers = now.transfers - bus->baseline.transfers;
+        uint32_t messages = now.messages - bus->baseline.messages;
+        uint32_t bytes = now.bytes - bus->baseline.bytes;
+        uint64_t clocks = (uint64_t)(bytes + messages) * I2C_STATS_CLOCKS_PER_BYTE +
+                          (uint64_t)messages * I2C_STATS_CLOCKS_PER_MESSAGE;
+        uint32_t busy_us = bus->bitrate ? (uint32_t)(clocks * 1000000u / bus->bitrate) : 0;
+        int64_t elapsed_ms = k_uptime_get() - bus->baseline_ms;
+        uint32_t permille = elapsed_ms > 0 ? (uint32_t)(busy_us / elapsed_ms) : 0;
+        shell_print(shell, "%s %u %u %u %u %u", bus->name, transfers, messages, bytes, busy_us,
+                    MIN(permille, 1000u));
+    }
+    return 0;
+}
+
+static int cmd_i2c_stats_reset(const struct shell *shell, size_t argc, char **argv) {
+    i2c_stats_reset();
+    shell_print(shell, "0");
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "i2cbus". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_i2cbus,
+                               SHELL_CMD(get-stats, NULL, "Print transfers and utilization per bus since the last reset.",
+                                         cmd_i2c_stats_get),
+                               SHELL_CMD(reset-stats, NULL, "Start a new measurement window.", cmd_i2c_stats_reset),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "i2cbus" */
+SHELL_CMD_REGISTER(i2cbus, &sub_i2cbus, "Utilization of the I2C buses.", NULL);
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_mcp9808.c
+ * @brief MCP9808 Temperature Monitoring Module
+ *
+ * This module monitors the temperature of the motors and the motor driver with
+ * MCP9808 sensors and derates the motors when they get too hot.
+ *
+ * The sensors are not polled. Each sensor gets a temperature window programmed into
+ * its upper/lower limit registers and signals leaving that window on its ALERT output.
+ * The alert wakes the monitoring thread, which reads the temperatures, updates the
+ * thermal state and moves the window to the next state:
+ * - normal:   window [min, warning]
+ * - warning:  window [warning - hysteresis, critical]
+ * - critical: window [critical - hysteresis, max]
+ *
+ * The worst state of all sensors is applied to the motors:
+ * - normal:   no speed limit.
+ * - warning:  speed limited to PLUTO_MCP9808_DERATING_SPEED.
+ * - critical: motors are stopped and held at 0 for at least
+ *             PLUTO_MCP9808_THRESH_SLEEP_TIME_S seconds.
+ *
+ * Sensors without a wired ALERT output (no int-gpios in the devicetree) fall back to
+ * polling, the sensor scheduler requests a read at the period of their channel.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inc/pluto_mcp9808.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_mcp9808, LOG_LEVEL_WRN);
+
+/** @brief Measurement range of the MCP9808 in milli degree celsius. */
+#define MCP9808_TEMP_MIN_MC     (-40000)
+#define MCP9808_TEMP_MAX_MC     (125000)
+
+struct mcp9808_sensor {
+    const char *name;
+    const struct device *dev;
+    bool is_ready;
+    bool has_alert;
+    int32_t temp_mc;
+    int64_t timestamp;      // Uptime in ticks of temp_mc
+    enum mcp9808_thermal_state state;
+};
+
+static struct mcp9808_sensor mcp9808_sensors[] = {
+        { "t_0", DEVICE_DT_GET(DT_NODELABEL(mcp9808_0)), false, false, 0, 0, MCP9808_STATE_NORMAL },
+        { "t_1", DEVICE_DT_GET(DT_NODELABEL(mcp9808_1)), false, false, 0, 0, MCP9808_STATE_NORMAL },
+};
+
+#define PLUTO_MCP9808_NUM_SENSORS ARRAY_SIZE(mcp9808_sensors)
+
+static struct k_thread mcp9808_thread_data;
+K_THREAD_STACK_DEFINE(mcp9808_stack_area, PLUTO_MCP9808_THREAD_STACK_SIZE);
+
+/* Given by the ALERT handler, by configuration changes and by the sensor scheduler */
+K_SEM_DEFINE(mcp9808_alert_sem, 0, 1);
+
+static const struct sensor_trigger mcp9808_trigger = {
+        .type = SENSOR_TRIG_THRESHOLD,
+        .chan = SENSOR_CHAN_AMBIENT_TEMP,
+};
+
+static int32_t warning_temp_mc = PLUTO_MCP9808_WARNING_TEMP_MC;
+static int32_t critical_temp_mc = PLUTO_MCP9808_CRITICAL_TEMP_MC;
+static enum mcp9808_thermal_state thermal_state = MCP9808_STATE_NORMAL;
+
+static const char *mcp9808_state_to_string(enum mcp9808_thermal_state state) {
+    switch (state) {
+        case MCP9808_STATE_NORMAL:
+            return "normal";
+        case MCP9808_STATE_WARNING:
+            return "warning";
+        case MCP9808_STATE_CRITICAL:
+            return "critical";
+        case MCP9808_STATE_ERROR:
+            return "error";
+        default:
+            return "unknown";
+    }
+}
+
+static void mcp9808_alert_handler(const struct device *dev, const struct sensor_trigger *trig) {
+    k_sem_give(&mcp9808_alert_sem);
+}
+
+/**
+ * @brief Classify a temperature, applying hysteresis when leaving a state.
+ *
+ * @param prev Previous thermal state of the sensor.
+ * @param temp_mc Current temperature in milli degree celsius.
+ * @return New thermal state of the sensor.
+ */
+static enum mcp9808_thermal_state mcp9808_classify(enum mcp9808_thermal_state prev, int32_t temp_mc) {
+    if (temp_mc >= critical_temp_mc ||
+        (prev == MCP9808_STATE_CRITICAL && temp_mc > critical_temp_mc - PLUTO_MCP9808_HYSTERESIS_MC)) {
+        return MCP9808_STATE_CRITICAL;
+    }
+    if (temp_mc >= warning_temp_mc ||
+        (prev != MCP9808_STATE_NORMAL && temp_mc > warning_temp_mc - PLUTO_MCP9808_HYSTERESIS_MC)) {
+        return MCP9808_STATE_WARNING;
+    }
+    return MCP9808_STATE_NORMAL;
+}
+
+/**
+ * @brief Program the alert window of a sensor around its current state.
+ *
+ * @param sensor Pointer to the sensor.
+ * @return 0 on success, error code on failure.
+ */
+static int mcp9808_set_window(struct mcp9808_sensor *sensor) {
+    int32_t lower_mc;
+    int32_t upper_mc;
+    switch (sensor->state) {
+        case MCP9808_STATE_NORMAL:
+            lower_mc = MCP9808_TEMP_MIN_MC;
+            upper_mc = warning_temp_mc;
+            break;
+        case MCP9808_STATE_WARNING:
+            lower_mc = warning_temp_mc - PLUTO_MCP9808_HYSTERESIS_MC;
+            upper_mc = critical_temp_mc;
+            break;
+        default:
+            lower_mc = critical_temp_mc - PLUTO_MCP9808_HYSTERESIS_MC;
+            upper_mc = MCP9808_TEMP_MAX_MC;
+            break;
+    }
+    struct sensor_value val;
+    sensor_value_from_milli(&val, lower_mc);
+    int ret = sensor_attr_set(sensor->dev, SENSOR_CHAN_AMBIENT_TEMP, SENSOR_ATTR_LOWER_THRESH, &val);
+    if (ret) {
+        return ret;
+    }
+    sensor_value_from_milli(&val, upper_mc);
+    return sensor_attr_set(sensor->dev, SENSOR_CHAN_AMBIENT_TEMP, SENSOR_ATTR_UPPER_THRESH, &val);
+}
+
+/**
+ * @brief Read one sensor and update its thermal state and alert window.
+ *
+ * @param sensor Pointer to the sensor.
+ */
+static void mcp9808_update_sensor(struct mcp9808_sensor *sensor) {
+    struct sensor_value temp;
+    int ret = sensor_sample_fetch(sensor->dev);
+    if (!ret) {
+        ret = sensor_channel_get(sensor->dev, SENSOR_CHAN_AMBIENT_TEMP, &temp);
+    }
+    if (ret) {
+        LOG_ERR("reading %s failed, ret %d", sensor->name, ret);
+        sensor->state = MCP9808_STATE_ERROR;
+        return;
+    }
+    sensor->temp_mc = (int32_t)sensor_value_to_milli(&temp);
+    sensor->timestamp = k_uptime_ticks();
+    enum mcp9808_thermal_state state = mcp9808_classify(sensor->state, sensor->temp_mc);
+    if (state != sensor->state) {
+        LOG_INF("%s changed from %s to %s", sensor->name,
+                mcp9808_state_to_string(sensor->state), mcp9808_state_to_string(state));
+    }
+    sensor->state = state;
+    if (sensor->has_alert) {
+        ret = mcp9808_set_window(sensor);
+        if (ret) {
+            LOG_ERR("setting alert window of %s failed, ret %d", sensor->name, ret);
+        }
+    }
+}
+
+/**
+ * @brief Apply the thermal state to the motors.
+ *
+ * @param state Worst thermal state of all sensors.
+ */
+static void mcp9808_apply_derating(enum mcp9808_thermal_state state) {
+    uint32_t limit = 100;
+    switch (state) {
+        case MCP9808_STATE_WARNING:
+            // Also used if a sensor fails, without it we are blind
+            limit = PLUTO_MCP9808_DERATING_SPEED;
+            break;
+        case MCP9808_STATE_CRITICAL:
+            limit = 0;
+            break;
+        default:
+            break;
+    }
+    if (state == MCP9808_STATE_CRITICAL) {
+        safety_raise_fault(SAFETY_FAULT_OVERTEMPERATURE, "mcp9808");
+    }
+    motordriver_set_speed_limit(&motor1, limit);
+    motordriver_set_speed_limit(&motor2, limit);
+}
+
+/**
+ * @brief Temperature monitoring thread function.
+ *
+ * Waits for ALERT events of the sensors, re-reads the temperatures and applies
+ * the derating. The motors stay stopped for at least PLUTO_MCP9808_THRESH_SLEEP_TIME_S
+ * after a critical temperature has been seen.
+ *
+ * @param unused1 Unused parameter.
+ * @param unused2 Unused parameter.
+ * @param unused3 Unused parameter.
+ */
+void mcp9808_thread(void *unused1, void *unused2, void *unused3) {
+    int64_t last_critical_ms = 0;
+    bool was_critical = false;
+    while (1) {
+        enum mcp9808_thermal_state state = MCP9808_STATE_NORMAL;
+        for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+            if (!mcp9808_sensors[i].is_ready) {
+                continue;
+            }
+            mcp9808_update_sensor(&mcp9808_sensors[i]);
+            // A failing sensor counts as warning, see mcp9808_apply_derating()
+            if (mcp9808_sensors[i].state == MCP9808_STATE_ERROR) {
+                state = MAX(state, MCP9808_STATE_WARNING);
+            } else {
+                state = MAX(state, mcp9808_sensors[i].state);
+            }
+        }
+        // Sensors without an alert are polled by the sensor scheduler
+        k_timeout_t timeout = K_SECONDS(PLUTO_MCP9808_REFRESH_TIME_S);
+        // Hold the motors after a critical temperature for a cool down period
+        if (state == MCP9808_STATE_CRITICAL) {
+            last_critical_ms = k_uptime_get();
+            was_critical = true;
+        } else if (was_critical) {
+            int64_t hold_ms = last_critical_ms + PLUTO_MCP9808_THRESH_SLEEP_TIME_S * 1000 - k_uptime_get();
+            if (hold_ms > 0) {
+                state = MCP9808_STATE_CRITICAL;
+                timeout = K_MSEC(hold_ms);
+            } else {
+                was_critical = false;
+            }
+        }
+        if (state != thermal_state) {
+            thermal_state = state;
+            mcp9808_apply_derating(state);
+        }
+        k_sem_take(&mcp9808_alert_sem, timeout);
+    }
+}
+
+/**
+ * @brief Get the worst thermal state of all temperature sensors.
+ *
+ * @return Current thermal state used for derating.
+ */
+enum mcp9808_thermal_state mcp9808_get_thermal_state(void) {
+    return thermal_state;
+}
+
+/**
+ * @brief Get the last temperature of a sensor.
+ *
+ * @param index Index of the sensor (0 for "t_0").
+ * @param temp_mc Temperature in milli degree celsius.
+ * @return 0 on success, -EINVAL for an unknown sensor, -ENODATA if the sensor failed.
+ */
+int mcp9808_get_temp(int index, int32_t *temp_mc) {
+    if (index < 0 || index >= PLUTO_MCP9808_NUM_SENSORS) {
+        return -EINVAL;
+    }
+    const struct mcp9808_sensor *sensor = &mcp9808_sensors[index];
+    if (!sensor->is_ready || sensor->state == MCP9808_STATE_ERROR) {
+        return -ENODATA;
+    }
+    *temp_mc = sensor->temp_mc;
+    return 0;
+}
+
+/**
+ * @brief Get the last temperature of a sensor with its timestamp.
+ *
+ * @param index Index of the sensor (0 for "t_0").
+ * @param temp_mc Temperature in milli degree celsius.
+ * @param timestamp Uptime in ticks of the temperature, 0 if there is none yet.
+ * @return 0 on success, -EINVAL for an unknown sensor, -ENODATA if the sensor failed.
+ */
+int mcp9808_get_sample(int index, int32_t *temp_mc, int64_t *timestamp) {
+    if (index < 0 || index >= PLUTO_MCP9808_NUM_SENSORS) {
+        return -EINVAL;
+    }
+    const struct mcp9808_sensor *sensor = &mcp9808_sensors[index];
+    *temp_mc = sensor->temp_mc;
+    *timestamp = sensor->timestamp;
+    if (!sensor->is_ready || sensor->state == MCP9808_STATE_ERROR) {
+        return -ENODATA;
+    }
+    return 0;
+}
+
+/**
+ * @brief Request a read of the sensors, called by the sensor scheduler.
+ *
+ * The monitoring thread reads all sensors on each wakeup.
+ *
+ * @param index Index of the sensor, unused.
+ */
+void mcp9808_request(int index) {
+    ARG_UNUSED(index);
+    k_sem_give(&mcp9808_alert_sem);
+}
+
+static int cmd_mcp9808_list_sensors(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        shell_print(shell, "Sensor %d: %s, Ready: %s, Alert: %s", i, mcp9808_sensors[i].name,
+                    mcp9808_sensors[i].is_ready ? "Yes" : "No", mcp9808_sensors[i].has_alert ? "Yes" : "No");
+    }
+    return 0;
+}
+
+static int cmd_mcp9808_get_state(const struct shell *shell, size_t argc, char **argv) {
+    shell_print(shell, "%s", mcp9808_state_to_string(thermal_state));
+    return 0;
+}
+
+static int cmd_mcp9808_config_thresholds(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Usage: mcp9808 config-thresholds <warning[C]> <critical[C]>");
+        return -EINVAL;
+    }
+    // Range check in whole degrees, the scaling to millidegrees happens on valid values only
+    uint32_t warning_c = simple_strtou32(argv[1]);
+    uint32_t critical_c = simple_strtou32(argv[2]);
+    if (critical_c >= MCP9808_TEMP_MAX_MC / 1000 || warning_c >= critical_c ||
+        warning_c * 1000 <= PLUTO_MCP9808_HYSTERESIS_MC) {
+        shell_error(shell, "Invalid thresholds.");
+        return -EINVAL;
+    }
+    int32_t warning_mc = (int32_t)warning_c * 1000;
+    int32_t critical_mc = (int32_t)critical_c * 1000;
+    warning_temp_mc = warning_mc;
+    critical_temp_mc = critical_mc;
+    // Re-evaluate states and alert windows with the new thresholds
+    k_sem_give(&mcp9808_alert_sem);
+    shell_print(shell, "%d %d", warning_mc / 1000, critical_mc / 1000);
+    return 0;
+}
+
+/**
+ * @brief Initialize the MCP9808 sensors and start the monitoring thread.
+ */
+void mcp9808_pluto_init(void) {
+    for (int i = 0; i < PLUTO_MCP9808_NUM_SENSORS; i++) {
+        struct mcp9808_sensor *sensor = &mcp9808_sensors[i];
+        if (!device_is_ready(sensor->dev)) {
+            LOG_ERR("%s Error: device not ready.", sensor->name);
+            continue;
+        }
+        sensor->is_ready = true;
+        sensor->has_alert = sensor_trigger_set(sensor->dev, &mcp9808_trigger, mcp9808_alert_handler) == 0;
+        if (!sensor->has_alert) {
+            LOG_WRN("%s has no alert output, polling.", sensor->name);
+        }
+    }
+    k_tid_t mcp9808_tid = k_thread_create(&mcp9808_thread_data, mcp9808_stack_area,
+                                          K_THREAD_STACK_SIZEOF(mcp9808_stack_area),
+                                          mcp9808_thread, NULL, NULL, NULL,
+                                          PLUTO_MCP9808_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(mcp9808_tid, "mcp9808");
+    k_thread_start(mcp9808_tid);
+    LOG_INF("mcp9808 module initialized");
+}
+
+/* Creating subcommands (level 1 command) array for command "mcp9808". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_mcp9808,
+                               SHELL_CMD(get-state, NULL, "Get thermal state (normal, warning, critical).",
+                                         cmd_mcp9808_get_state),
+                               SHELL_CMD(config-thresholds, NULL,
+                                         "Configure derating thresholds <warning[C]> <critical[C]>.",
+                                         cmd_mcp9808_config_thresholds),
+                               SHELL_CMD(list-sensors, NULL, "List all temperature sensors.",
+                                         cmd_mcp9808_list_sensors),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "mcp9808" */
+SHELL_CMD_REGISTER(mcp9808, &sub_mcp9808, "Monitor MCP9808 temperature sensors.", NULL);
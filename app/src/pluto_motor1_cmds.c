@@ -11,6 +11,9 @@
 #include <zephyr/logging/log.h>
 
 #include "inc/pluto_motordriver.h"
+#include "inc/pluto_motor_calibration.h"
+#include "inc/pluto_events.h"
+#include "inc/pluto_arbiter.h"
 #include "inc/usb_cli.h"
 
 /* Enable logging for module. Change Log Level for debugging. */
@@ -24,10 +27,17 @@ static int cmd_motor1(const struct shell *shell, size_t argc, char **argv) {
 /* Subcommand implementations motor1 */
 
 static int cmd_motor1_set_dir(const struct shell *shell, size_t argc, char **argv) {
+    if (arbiter_check_unowned(shell) != 0) {
+        return -EACCES;
+    }
     if (argc == 2) {
         bool target_direction = simple_strtou8(argv[1]) != 0;
-        shell_print(shell, "%d", target_direction);
+        uint32_t id = events_next_id();
+        shell_print(shell, "%d %u", target_direction, id);
+        events_set_shell(shell);
+        // Blocking, the direction is set when it returns
         motordriver_set_dir(&motor1, target_direction);
+        events_post(id, motor1.name, EVENT_DONE, EVENT_REASON_NONE);
     } else {
         shell_error(shell, "Usage: motor1 set-dir <0/1>");
     }
@@ -35,10 +45,14 @@ static int cmd_motor1_set_dir(const struct shell *shell, size_t argc, char **arg
 }
 
 static int cmd_motor1_set_speed(const struct shell *shell, size_t argc, char **argv) {
+    if (arbiter_check_unowned(shell) != 0) {
+        return -EACCES;
+    }
     if (argc == 2) {
         uint32_t target_speed = simple_strtou8(argv[1]);
-        shell_print(shell, "%d", target_speed);
-        motordriver_adjust_motor_speed_non_blocking(&motor1, target_speed);
+        events_set_shell(shell);
+        uint32_t id = motordriver_adjust_motor_speed_non_blocking(&motor1, target_speed);
+        shell_print(shell, "%d %u", target_speed, id);
     } else {
         shell_error(shell, "Usage: motor1 set-speed <0-100>");
     }
@@ -46,6 +60,9 @@ static int cmd_motor1_set_speed(const struct shell *shell, size_t argc, char **a
 }
 
 static int cmd_motor1_unsafe_set_speed(const struct shell *shell, size_t argc, char **argv) {
+    if (arbiter_check_unowned(shell) != 0) {
+        return -EACCES;
+    }
     if (argc == 2) {
         uint32_t speed = simple_strtou8(argv[1]);
         set_speed(&motor1, speed);
@@ -67,9 +84,14 @@ static int cmd_motor1_get_dir(const struct shell *shell, size_t argc, char **arg
 
 static int cmd_motor1_get_motor(const struct shell *shell, size_t argc, char **argv) {
     shell_print(shell, "name: %s\ndirection: %d\nspeed: %d\nacceleration_rate: %d\n"
-                       "acceleration_rate_delay: %dms\nbraking_rate: %d\nbraking_rate_delay: %dms",
+                       "acceleration_rate_delay: %dms\nbraking_rate: %d\nbraking_rate_delay: %dms\n"
+                       "emergency_braking_rate: %d\nemergency_braking_rate_delay: %dms\n"
+                       "pwm_period: %dns\npwm_period_cycles: %d\npulse_cycles: %d.%03d\ndither: %d",
                 motor1.name, motor1.direction, motor1.speed, motor1.acceleration_rate,
-                motor1.acceleration_rate_delay, motor1.braking_rate, motor1.braking_rate_delay);
+                motor1.acceleration_rate_delay, motor1.braking_rate, motor1.braking_rate_delay,
+                motor1.emergency_braking_rate, motor1.emergency_braking_rate_delay, motor1.pwm_spec.period,
+                motor1.period_cycles, motor1.pulse_q8 >> MOTOR_DITHER_BITS,
+                (motor1.pulse_q8 & BIT_MASK(MOTOR_DITHER_BITS)) * 1000 >> MOTOR_DITHER_BITS, motor1.dither);
     return 0;
 }
 
@@ -133,6 +155,109 @@ static int cmd_motor1_config_brak_rate_delay(const struct shell *shell, size_t a
     return 0;
 }
 
+static int cmd_motor1_config_emerg_brak_rate(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 2) {
+        uint32_t emergency_braking_rate = simple_strtou8(argv[1]);
+        if (emergency_braking_rate != 0 && emergency_braking_rate <= 100) {
+            shell_print(shell, "%d", emergency_braking_rate);
+            motor1.emergency_braking_rate = emergency_braking_rate;
+        } else {
+            shell_error(shell, "Invalid emergency braking rate.");
+        }
+    } else {
+        shell_error(shell, "Usage: motor1 config-emerg-brak-rate <1-100>");
+    }
+    return 0;
+}
+
+static int cmd_motor1_config_emerg_brak_rate_delay(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 2) {
+        int32_t emergency_braking_rate_delay = (int32_t)simple_strtou32(argv[1]);
+        if (emergency_braking_rate_delay != 0) {
+            shell_print(shell, "%d", emergency_braking_rate_delay);
+            motor1.emergency_braking_rate_delay = emergency_braking_rate_delay;
+        } else {
+            shell_error(shell, "Invalid emergency braking rate delay.");
+        }
+    } else {
+        shell_error(shell, "Usage: motor1 config-emerg-brak-rate-delay <ms>");
+    }
+    return 0;
+}
+
+static int cmd_motor1_get_duty_map(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 2) {
+        bool dir = simple_strtou8(argv[1]) != 0;
+        motor_print_duty_map(&motor1, dir, shell);
+    } else {
+        shell_error(shell, "Usage: motor1 get-duty-map <0/1>");
+    }
+    return 0;
+}
+
+static int cmd_motor1_config_duty_map(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == MOTOR_DUTY_MAP_POINTS + 2) {
+        bool dir = simple_strtou8(argv[1]) != 0;
+        uint16_t points[MOTOR_DUTY_MAP_POINTS];
+        for (int k = 0; k < MOTOR_DUTY_MAP_POINTS; k++) {
+            points[k] = simple_strtou16(argv[k + 2]);
+        }
+        if (motordriver_set_duty_map(&motor1, dir, points) == 0) {
+            motor_print_duty_map(&motor1, dir, shell);
+        } else {
+            shell_error(shell, "Invalid duty map, points must rise and not exceed 10000.");
+        }
+    } else {
+        shell_error(shell, "Usage: motor1 config-duty-map <0/1> <deadband> <duty10> .. <duty100>");
+    }
+    return 0;
+}
+
+static int cmd_motor1_calibrate(const struct shell *shell, size_t argc, char **argv) {
+    if (arbiter_check_unowned(shell) != 0) {
+        return -EACCES;
+    }
+    if (argc != 2) {
+        shell_error(shell, "Usage: motor1 calibrate <0/1>");
+        return -EINVAL;
+    }
+    bool dir = simple_strtou8(argv[1]) != 0;
+    int ret = motor_calibrate_start(&motor1, dir, shell);
+    if (ret == -ENODEV) {
+        shell_error(shell, "No encoder, configure the duty map with config-duty-map.");
+    } else if (ret == -EALREADY) {
+        shell_error(shell, "A calibration is already running.");
+    } else if (ret < 0) {
+        shell_error(shell, "Calibration failed: %d", ret);
+    }
+    return ret;
+}
+
+static int cmd_motor1_config_pwm_freq(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 2) {
+        uint32_t frequency = simple_strtou32(argv[1]);
+        if (frequency != 0 && motordriver_set_pwm_period(&motor1, PWM_HZ(frequency)) == 0) {
+            shell_print(shell, "%d", frequency);
+        } else {
+            shell_error(shell, "Invalid PWM frequency.");
+        }
+    } else {
+        shell_error(shell, "Usage: motor1 config-pwm-freq <Hz> (shared with motors on the same slice)");
+    }
+    return 0;
+}
+
+static int cmd_motor1_config_dither(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 2) {
+        bool enable = simple_strtou8(argv[1]) != 0;
+        motordriver_set_dither(&motor1, enable);
+        shell_print(shell, "%d", enable);
+    } else {
+        shell_error(shell, "Usage: motor1 config-dither <0/1>");
+    }
+    return 0;
+}
+
 void cmd_motor1_init() {
     LOG_INF("Adding motor1 commands.");
 }
@@ -149,6 +274,13 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_motor1,
                                SHELL_CMD(config-brak-rate, NULL, "Configure braking rate <rate[0..99]>", cmd_motor1_config_brak_rate),
                                SHELL_CMD(config-acc-rate-delay, NULL, "Configure acceleration rate delay <delay[0..0xFFFF]>", cmd_motor1_config_acc_rate_delay),
                                SHELL_CMD(config-brak-rate-delay, NULL, "Configure braking rate delay <delay[0..0xFFFF]>", cmd_motor1_config_brak_rate_delay),
+                               SHELL_CMD(config-pwm-freq, NULL, "Configure PWM frequency <Hz>", cmd_motor1_config_pwm_freq),
+                               SHELL_CMD(config-dither, NULL, "Configure sigma-delta duty dithering <enable[1||0]>", cmd_motor1_config_dither),
+                               SHELL_CMD(get-duty-map, NULL, "Get duty map <dir[1||0]>", cmd_motor1_get_duty_map),
+                               SHELL_CMD(config-duty-map, NULL, "Configure duty map <dir[1||0]> <deadband> <duty10> .. <duty100> (0.01 %)", cmd_motor1_config_duty_map),
+                               SHELL_CMD(calibrate, NULL, "Calibrate duty map with encoder, wheels lifted <dir[1||0]>", cmd_motor1_calibrate),
+                               SHELL_CMD(config-emerg-brak-rate, NULL, "Configure emergency braking rate <rate[1..100]>", cmd_motor1_config_emerg_brak_rate),
+                               SHELL_CMD(config-emerg-brak-rate-delay, NULL, "Configure emergency braking rate delay <delay[1..0xFFFF]>", cmd_motor1_config_emerg_brak_rate_delay),
                                SHELL_SUBCMD_SET_END
 );
 
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_motor_calibration.c
+ * @brief Motor Calibration Module
+ *
+ * Measures the speed response of a motor over its duty range and derives the duty
+ * map (deadband offset and piecewise linear speed to duty map) for one direction.
+ *
+ * The sweep steps the raw duty from 0 to 100 % in PLUTO_MOTOR_CALIB_DUTY_STEP,
+ * waits PLUTO_MOTOR_CALIB_SETTLE_MS at each step and measures the speed with the
+ * wheel encoder over PLUTO_MOTOR_CALIB_MEASURE_MS. The deadband is the first duty
+ * at which the motor turns, the map points are the duties at which the motor
+ * reaches 10, 20, .., 100 % of its top speed. Without an encoder the map has to be
+ * configured manually.
+ *
+ * The motor must be free to turn (wheels lifted). The sweep runs in its own low
+ * priority thread, so the shell stays responsive. It is aborted within
+ * PLUTO_MOTOR_CALIB_POLL_MS if a safety fault is raised or the motor is stopped
+ * meanwhile; the raw duty is then cut through the immediate stop path.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "inc/pluto_motor_calibration.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_encoder.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_config.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(motor_calibration, LOG_LEVEL_WRN);
+
+#define CALIB_STEPS (MOTOR_DUTY_FULL_SCALE / PLUTO_MOTOR_CALIB_DUTY_STEP + 1)
+
+BUILD_ASSERT(MOTOR_DUTY_FULL_SCALE % PLUTO_MOTOR_CALIB_DUTY_STEP == 0,
+             "PLUTO_MOTOR_CALIB_DUTY_STEP must divide the duty full scale");
+
+/* Measured speed in encoder counts/s per duty step */
+static uint32_t response[CALIB_STEPS];
+
+/* Request handed to the calibration thread */
+static K_SEM_DEFINE(calib_sem, 0, 1);
+static atomic_t calib_busy = ATOMIC_INIT(0);
+static motor_t *calib_motor;
+static bool calib_dir;
+static const struct shell *calib_shell;
+
+static bool calib_aborted(motor_t *motor, uint32_t fault_count) {
+    return safety_get_fault_count() != fault_count || atomic_get(&motor->emergency_stop) ||
+           atomic_get(&motor->output_cut) || atomic_get(&motor->stop_pending);
+}
+
+/* Sleeps in slices of PLUTO_MOTOR_CALIB_POLL_MS, returns -ECANCELED as soon as the sweep is aborted */
+static int calib_sleep(motor_t *motor, uint32_t fault_count, int32_t ms) {
+    while (ms > 0) {
+        if (calib_aborted(motor, fault_count)) {
+            return -ECANCELED;
+        }
+        k_msleep(MIN(ms, PLUTO_MOTOR_CALIB_POLL_MS));
+        ms -= PLUTO_MOTOR_CALIB_POLL_MS;
+    }
+    return calib_aborted(motor, fault_count) ? -ECANCELED : 0;
+}
+
+static int calib_measure_speed(motor_t *motor, enum encoder_id encoder, uint32_t fault_count, uint32_t *speed) {
+    int32_t start = encoder_get_count(encoder);
+    int ret = calib_sleep(motor, fault_count, PLUTO_MOTOR_CALIB_MEASURE_MS);
+    int32_t counts = encoder_get_count(encoder) - start;
+    *speed = (uint32_t)abs(counts) * 1000u / PLUTO_MOTOR_CALIB_MEASURE_MS;
+    return ret;
+}
+
+/* Duty at which the (monotonic) response reaches the target speed, interpolated between steps */
+static uint16_t calib_find_duty(uint32_t target) {
+    if (response[0] >= target) {
+        return 0;
+    }
+    for (int i = 1; i < CALIB_STEPS; i++) {
+        if (response[i] >= target) {
+            // response[i - 1] < target <= response[i]
+            uint32_t duty = (i - 1) * PLUTO_MOTOR_CALIB_DUTY_STEP;
+            duty += (target - response[i - 1]) * PLUTO_MOTOR_CALIB_DUTY_STEP / (response[i] - response[i - 1]);
+            return (uint16_t)duty;
+        }
+    }
+    return MOTOR_DUTY_FULL_SCALE;
+}
+
+void motor_print_duty_map(const motor_t *motor, bool dir, const struct shell *shell) {
+    const uint16_t *points = motor->duty_map[dir].points;
+    shell_print(shell, "%u %u %u %u %u %u %u %u %u %u %u", points[0], points[1], points[2], points[3],
+                points[4], points[5], points[6], points[7], points[8], points[9], points[10]);
+}
+
+/* Runs the sweep, called from the calibration thread */
+static int motor_calibrate(motor_t *motor, bool dir, const struct shell *shell) {
+    enum encoder_id encoder = (motor == &motor1) ? ENCODER_1 : ENCODER_2;
+    motordriver_set_dir(motor, dir);
+    uint32_t fault_count = safety_get_fault_count();
+    int ret = 0;
+    for (int i = 0; i < CALIB_STEPS; i++) {
+        uint32_t duty = i * PLUTO_MOTOR_CALIB_DUTY_STEP;
+        if (calib_aborted(motor, fault_count)) {
+            ret = -ECANCELED;
+            break;
+        }
+        ret = motordriver_write_duty(motor, duty);
+        if (ret < 0) {
+            break;
+        }
+        ret = calib_sleep(motor, fault_count, PLUTO_MOTOR_CALIB_SETTLE_MS);
+        if (ret == 0) {
+            ret = calib_measure_speed(motor, encoder, fault_count, &response[i]);
+        }
+        if (ret < 0) {
+            break;
+        }
+        shell_print(shell, "%u %u", duty, response[i]);
+    }
+    if (ret < 0) {
+        // Cut the raw duty lock-free, the stop work sets it back to 0
+        motordriver_stop_motor(motor, MOTOR_STOP_IMMEDIATE);
+        return ret;
+    }
+    motordriver_write_duty(motor, 0);
+    uint16_t points[MOTOR_DUTY_MAP_POINTS];
+    int start = 0;
+    while (start < CALIB_STEPS && response[start] < PLUTO_MOTOR_CALIB_MIN_SPEED) {
+        start++;
+    }
+    if (start == CALIB_STEPS) {
+        return -EIO;
+    }
+    // Only the rising part of the response can be inverted, flatten dips from noise
+    for (int i = 1; i < CALIB_STEPS; i++) {
+        response[i] = MAX(response[i], response[i - 1]);
+    }
+    uint32_t top_speed = response[CALIB_STEPS - 1];
+    points[0] = start * PLUTO_MOTOR_CALIB_DUTY_STEP;
+    for (int k = 1; k < MOTOR_DUTY_MAP_POINTS; k++) {
+        uint32_t target = top_speed * k / (MOTOR_DUTY_MAP_POINTS - 1);
+        points[k] = MAX(calib_find_duty(target), points[k - 1]);
+    }
+    ret = motordriver_set_duty_map(motor, dir, points);
+    if (ret == 0) {
+        motor_print_duty_map(motor, dir, shell);
+    }
+    return ret;
+}
+
+static void motor_calibration_thread(void *p1, void *p2, void *p3) {
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+    while (true) {
+        k_sem_take(&calib_sem, K_FOREVER);
+        int ret = motor_calibrate(calib_motor, calib_dir, calib_shell);
+        if (ret == -EIO) {
+            shell_error(calib_shell, "Calibration failed, the motor did not turn.");
+        } else if (ret < 0) {
+            shell_error(calib_shell, "Calibration aborted: %d", ret);
+        }
+        atomic_clear(&calib_busy);
+    }
+}
+
+K_THREAD_DEFINE(motor_calibration_tid, PLUTO_MOTOR_CALIB_THREAD_STACK_SIZE, motor_calibration_thread,
+                NULL, NULL, NULL, PLUTO_MOTOR_CALIB_THREAD_PRIORITY, 0, 0);
+
+/**
+ * @brief Starts the calibration of the duty map of a motor for one direction.
+ *
+ * Returns at once, the sweep runs in the calibration thread (about 17 s) and prints
+ * "<duty> <counts/s>" per step and the resulting map to the shell. Stopping the
+ * motor or a safety fault aborts the sweep.
+ *
+ * @param motor Pointer to the motor structure, the motor must stand still.
+ * @param dir Direction to calibrate.
+ * @param shell Shell to print the response and the resulting map to.
+ * @return 0 if the sweep was started, -ENODEV without encoder, -EBUSY if the motor
+ *         is moving, -EALREADY if a calibration is running.
+ */
+int motor_calibrate_start(motor_t *motor, bool dir, const struct shell *shell) {
+    enum encoder_id encoder = (motor == &motor1) ? ENCODER_1 : ENCODER_2;
+    if (!encoder_is_present(encoder)) {
+        return -ENODEV;
+    }
+    if (motor->speed != 0 || motor->target_speed != 0) {
+        return -EBUSY;
+    }
+    if (!atomic_cas(&calib_busy, 0, 1)) {
+        return -EALREADY;
+    }
+    calib_motor = motor;
+    calib_dir = dir;
+    calib_shell = shell;
+    k_sem_give(&calib_sem);
+    return 0;
+}
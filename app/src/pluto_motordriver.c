@@ -36,8 +36,16 @@
 #include <zephyr/device.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <string.h>
+#ifdef CONFIG_PWM_RPI_PICO
+#include <hardware/structs/pwm.h>
+#endif
 
 #include "inc/pluto_motordriver.h"
+#include "inc/pluto_trace.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_events.h"
+#include "inc/pluto_config.h"
 
 /* Enable logging for module. Change Log Level for debugging. */
 LOG_MODULE_REGISTER(motordriver, LOG_LEVEL_WRN);
@@ -48,47 +56,61 @@ static const struct pwm_dt_spec pwm_2 = PWM_DT_SPEC_GET_OR(PWM_2, {0});
 static const struct gpio_dt_spec dir_1 = GPIO_DT_SPEC_GET_OR(DIR_1, gpios, {0});
 static const struct gpio_dt_spec dir_2 = GPIO_DT_SPEC_GET_OR(DIR_2, gpios,{0});
 
-// Define global mutexes and timers
+// Define global mutexes
 struct k_mutex motor1_mutex;
-struct k_timer motor1_timer;
 
 struct k_mutex motor2_mutex;
-struct k_timer motor2_timer;
 
 motor_t motor1 = {
         .name = "motor1",
         .dir_pin = dir_1,
         .pwm_spec = pwm_1,
-        .emergency_stop = 0,
+        .emergency_stop = ATOMIC_INIT(0),
         .direction = 0,
         .target_direction = 0,
         .speed = 0,
         .target_speed = 0,
+        .speed_limit = 100,
         .acceleration_rate = 10,
         .acceleration_rate_delay = 100,
         .braking_rate = 10,
         .braking_rate_delay = 100,
+        .emergency_braking_rate = 25,
+        .emergency_braking_rate_delay = 20,
+        .duty_scale = MOTOR_DUTY_SCALE_ONE,
+        .gate_speed = 100,
         .mutex = &motor1_mutex,
-        .timer = &motor1_timer,
 };
 
 motor_t motor2 = {
         .name = "motor2",
         .dir_pin = dir_2,
         .pwm_spec = pwm_2,
-        .emergency_stop = 0,
+        .emergency_stop = ATOMIC_INIT(0),
         .direction = 0,
         .target_direction = 0,
         .speed = 0,
         .target_speed = 0,
+        .speed_limit = 100,
         .acceleration_rate = 10,
         .acceleration_rate_delay = 100,
         .braking_rate = 10,
         .braking_rate_delay = 100,
+        .emergency_braking_rate = 25,
+        .emergency_braking_rate_delay = 20,
+        .duty_scale = MOTOR_DUTY_SCALE_ONE,
+        .gate_speed = 100,
         .mutex = &motor2_mutex,
-        .timer = &motor2_timer,
 };
 
+/* Report the end of the motion command in progress, the motor mutex must be held */
+static void motor_end_command(motor_t *motor, enum event_status status, enum event_reason reason) {
+    if (motor->command_id != 0) {
+        events_post(motor->command_id, motor->name, status, reason);
+        motor->command_id = 0;
+    }
+}
+
 /**
  * @brief Sets the direction of a motor.
  *
@@ -109,6 +131,7 @@ void motordriver_set_dir(motor_t* motor, bool dir) {
     k_mutex_lock(motor->mutex, K_FOREVER);
     if (motor->direction != dir)
     {
+        motor_end_command(motor, EVENT_ABORTED, EVENT_REASON_SUPERSEDED);
         uint32_t target_speed = 0;
         motordriver_adjust_motor_speed_blocking(motor, target_speed);
         motor->direction = dir;
@@ -118,11 +141,63 @@ void motordriver_set_dir(motor_t* motor, bool dir) {
     k_mutex_unlock(motor->mutex);
 }
 
+/* Linear map, used until a motor is calibrated */
+static const uint16_t default_duty_map_points[MOTOR_DUTY_MAP_POINTS] = {
+        0, 1000, 2000, 3000, 4000, 5000, 6000, 7000, 8000, 9000, 10000
+};
+
+/*
+ * Write the pulse length in counter cycles to the PWM output. While the output is cut
+ * by an immediate stop, 0 is written instead, so a thread which held the mutex during
+ * the cut cannot switch the motor on again.
+ */
+static int motor_write_pulse(motor_t *motor, uint32_t pulse) {
+    k_spinlock_key_t key = k_spin_lock(&motor->pwm_lock);
+    if (atomic_get(&motor->output_cut)) {
+        pulse = 0;
+    }
+    int ret = pwm_set_cycles(motor->pwm_spec.dev,
+                             motor->pwm_spec.channel,
+                             motor->period_cycles,
+                             pulse, motor->pwm_spec.flags);
+    if (ret == 0) {
+        motor->pulse = pulse;
+    }
+    k_spin_unlock(&motor->pwm_lock, key);
+    return ret;
+}
+
+/*
+ * Write a duty in 0.01 % scaled by the duty scale to the PWM output, the motor mutex
+ * must be held. The output is capped to the duty of the gate speed. The pulse length
+ * is kept with a fraction of a counter cycle, which is dithered over the control ticks
+ * if enabled and truncated otherwise.
+ */
+static int motor_write_duty(motor_t *motor, uint32_t duty) {
+    uint32_t gated = duty;
+    if (motor->gate_speed < 100) {
+        gated = MIN(duty, motor->duty_map[motor->direction].lut[motor->gate_speed]);
+    }
+    uint64_t output = MIN((uint64_t)gated * motor->duty_scale, (uint64_t)MOTOR_DUTY_FULL_SCALE << MOTOR_DUTY_SCALE_SHIFT);
+    motor->pulse_q8 = (uint32_t)(((uint64_t)motor->period_cycles * output << MOTOR_DITHER_BITS) /
+                                 ((uint64_t)MOTOR_DUTY_FULL_SCALE << MOTOR_DUTY_SCALE_SHIFT));
+    uint32_t pulse = motor->dither ? motor_dither_step(&motor->dither_acc, motor->pulse_q8)
+                                   : motor->pulse_q8 >> MOTOR_DITHER_BITS;
+    LOG_DBG("Setting pulse for %s: %d cycles", motor->name, pulse);
+    int ret = motor_write_pulse(motor, pulse);
+    if (ret == 0) {
+        motor->duty = duty;
+        motor->gated_duty = gated;
+    }
+    return ret;
+}
+
 /**
  * @brief Sets the speed of the motor.
  *
  * Sets the speed of the motor by adjusting the PWM duty cycle. Speed is represented
- * as a percentage of the maximum speed.
+ * as a percentage of the maximum speed and mapped to the duty with the duty map of
+ * the current direction.
  *
  * **Usage**
  * ```
@@ -139,27 +214,47 @@ void set_speed(motor_t* motor, uint32_t speed_percent) {
     if (speed_percent > 100) {
         speed_percent = 100;
     }
-    // Calculate the duty cycle based on the speed percentage
-    uint32_t duty_cycle_ns = motor->pwm_spec.period * speed_percent / 100;
-    // Set the PWM duty cycle
-    LOG_DBG("Setting duty_cycle_ns for %s: %d", motor->name, duty_cycle_ns);
-    int ret = pwm_set(motor->pwm_spec.dev,
-                      motor->pwm_spec.channel,
-                      motor->pwm_spec.period,
-                      duty_cycle_ns, motor->pwm_spec.flags);
+    // Never accelerate above the speed limit, braking down to it is allowed
+    if (speed_percent > motor->speed_limit && speed_percent > motor->speed) {
+        speed_percent = MAX(motor->speed_limit, motor->speed);
+    }
+    // A ramp which was running when a quick stop was raised must not accelerate
+    if (atomic_get(&motor->emergency_stop) && speed_percent > motor->speed) {
+        speed_percent = motor->speed;
+    }
+    // Set the PWM duty cycle from the calibrated duty map
+    int ret = motor_write_duty(motor, motor->duty_map[motor->direction].lut[speed_percent]);
     if (ret < 0) {
         LOG_ERR("Error setting PWM speed for %s: %d", motor->name, ret);
     } else {
         // Update the motors speed in the struct
         motor->speed = speed_percent;
+        motor->speed_timestamp = k_uptime_ticks();
     }
     k_mutex_unlock(motor->mutex);
 }
 
+static void motor_stop_work_handler(struct k_work *work);
+static void motor_ramp_work_handler(struct k_work *work);
+
+/*
+ * Take the motor mutex without waiting, for the control loop and the ramp work. The
+ * mutex is only ever taken in thread context; the interrupt paths (stops, PWM cut)
+ * use atomics and the PWM spinlock, so a held mutex only delays the next try.
+ */
+static int motor_try_lock(motor_t *motor) {
+    __ASSERT(!k_is_in_isr(), "%s mutex taken in ISR context", motor->name);
+    return k_mutex_lock(motor->mutex, K_NO_WAIT);
+}
+
+static enum safety_signal_id motor_get_signal(const motor_t *motor) {
+    return (motor == &motor1) ? SAFETY_SIGNAL_MOTOR_1 : SAFETY_SIGNAL_MOTOR_2;
+}
+
 /**
  * @brief Initializes a motor.
  *
- * Initializes a motor by setting up GPIO and PWM, and initializing the mutex and timer.
+ * Initializes a motor by setting up GPIO and PWM, and initializing the mutex and the ramp work.
  * It also sets the initial direction and speed to OFF.
  *
  * **Usage**
@@ -175,11 +270,17 @@ void init_motor(motor_t* motor) {
         LOG_ERR("%s Error: PWM not ready.", motor->name);
         return;
     }
+    uint64_t cycles_per_sec;
+    if (pwm_get_cycles_per_sec(motor->pwm_spec.dev, motor->pwm_spec.channel, &cycles_per_sec) == 0) {
+        motor->period_cycles = (uint32_t)((uint64_t)motor->pwm_spec.period * cycles_per_sec / NSEC_PER_SEC);
+    }
     // Initialize GPIO pins as outputs for direction and PWM
     gpio_pin_configure_dt(&motor->dir_pin, GPIO_OUTPUT);
     k_mutex_init(motor->mutex);
-    k_timer_init(motor->timer, motor_speed_adjust_timer_expiry_function, NULL);
-    k_timer_user_data_set(motor->timer, motor);
+    k_work_init_delayable(&motor->ramp_work, motor_ramp_work_handler);
+    k_work_init(&motor->stop_work, motor_stop_work_handler);
+    motordriver_set_duty_map(motor, 0, default_duty_map_points);
+    motordriver_set_duty_map(motor, 1, default_duty_map_points);
     // Set initial direction and speed (PWM) to OFF
     bool initial_direction = 0;
     uint32_t initial_speed = 0;
@@ -211,8 +312,8 @@ void motordriver_adjust_motor_speed_blocking(motor_t* motor, uint32_t target_spe
         return;
     }
     // Ensure target speed is within bounds
-    if (target_speed > 100) {
-        target_speed = 100;
+    if (target_speed > motor->speed_limit) {
+        target_speed = motor->speed_limit;
     }
     while (motor->speed != target_speed) {
         if (motor->speed < target_speed) {
@@ -233,88 +334,193 @@ void motordriver_adjust_motor_speed_blocking(motor_t* motor, uint32_t target_spe
 }
 
 /**
- * @brief Timer expiry function for motor speed adjustment.
+ * @brief Ramp step of the motor speed adjustment.
  *
- * Invoked when the motor's timer expires. It adjusts the motor speed towards the
- * target speed, either by accelerating or braking, based on the current and target
- * speeds. This function is usually used in conjunction with non-blocking speed adjustment.
+ * Runs in the system workqueue when the ramp work of the motor is due. It adjusts the
+ * motor speed towards the target speed by one acceleration or braking step and
+ * schedules the next step. This is used in conjunction with non-blocking speed
+ * adjustment.
  *
- * **Usage**
- * Typically called internally by a timer and not directly used in application code.
+ * The step needs the motor mutex, so it must not run in ISR context. It never waits
+ * for the mutex either, which would stall the workqueue; if the motor is busy the
+ * step is retried after PLUTO_MOTOR_RAMP_RETRY_MS.
  *
- * @param timer_id Pointer to the expired timer.
+ * @param work Pointer to the ramp work of the motor.
  */
-void motor_speed_adjust_timer_expiry_function(struct k_timer *timer_id) {
-    motor_t *motor = k_timer_user_data_get(timer_id);
-    k_mutex_lock(motor->mutex, K_FOREVER);
+static void motor_ramp_work_handler(struct k_work *work) {
+    struct k_work_delayable *ramp_work = k_work_delayable_from_work(work);
+    motor_t *motor = CONTAINER_OF(ramp_work, motor_t, ramp_work);
+    if (motor_try_lock(motor) != 0) {
+        k_work_reschedule(ramp_work, K_MSEC(PLUTO_MOTOR_RAMP_RETRY_MS));
+        return;
+    }
+    pluto_trace(PLUTO_TRACE_RAMP_TICK, motor->speed, (motor == &motor1) ? 1 : 2);
     if (motor->speed < motor->target_speed) {
         // Accelerate
         uint32_t speed_increment = MIN(motor->acceleration_rate, motor->target_speed - motor->speed);
         motor->speed += speed_increment;
         set_speed(motor, motor->speed);
     } else if (motor->speed > motor->target_speed) {
-        // Brake
-        uint32_t speed_decrement = MIN(motor->braking_rate, motor->speed - motor->target_speed);
+        // Brake, with the emergency profile during a quick stop
+        uint32_t braking_rate = atomic_get(&motor->emergency_stop) ? motor->emergency_braking_rate
+                                                                   : motor->braking_rate;
+        uint32_t speed_decrement = MIN(braking_rate, motor->speed - motor->target_speed);
         motor->speed -= speed_decrement;
         set_speed(motor, motor->speed);
     }
 
     if (motor->speed != motor->target_speed) {
         if (motor->speed < motor->target_speed) {
-            //acceleration timer
-            k_timer_start(timer_id, K_MSEC(motor->acceleration_rate_delay), K_NO_WAIT);
+            // next acceleration step
+            k_work_reschedule(ramp_work, K_MSEC(motor->acceleration_rate_delay));
         } else {
-            //braking timer
-            k_timer_start(timer_id, K_MSEC(motor->braking_rate_delay), K_NO_WAIT);
+            // next braking step
+            int32_t braking_rate_delay = atomic_get(&motor->emergency_stop) ? motor->emergency_braking_rate_delay
+                                                                            : motor->braking_rate_delay;
+            k_work_reschedule(ramp_work, K_MSEC(braking_rate_delay));
         }
     } else {
         LOG_DBG("%s target speed: %d reached.", motor->name, motor->speed);
+        motor_end_command(motor, EVENT_DONE, EVENT_REASON_NONE);
+        if (motor->speed == 0) {
+            atomic_clear(&motor->emergency_stop);
+        }
+    }
+    // PWM writes are only expected while ramping
+    safety_signal_arm(motor_get_signal(motor), motor->speed != motor->target_speed);
+    k_mutex_unlock(motor->mutex);
+}
+
+/* Set the target speed and start the ramp, the motor mutex must be held */
+static void motor_set_target_speed(motor_t *motor, uint32_t target_speed, uint32_t id) {
+    motor_end_command(motor, EVENT_ABORTED, EVENT_REASON_SUPERSEDED);
+    motor->command_id = id;
+    uint32_t new_target_speed = MIN(target_speed, motor->speed_limit);
+    // Only start or restart the ramp if the target speed has changed
+    if (motor->target_speed != new_target_speed) {
+        motor->target_speed = new_target_speed;
+        // wait a bit before starting adjusting speed
+        k_work_reschedule(&motor->ramp_work, K_MSEC(ADJUST_SPEED_DELAY_MS));
+        safety_signal_arm(motor_get_signal(motor), motor->speed != motor->target_speed);
+    }
+    if (motor->speed == motor->target_speed) {
+        motor_end_command(motor, EVENT_DONE, EVENT_REASON_NONE);
     }
+}
 
+/**
+ * @brief Sets a new target speed and starts the ramp, like
+ * motordriver_adjust_motor_speed_non_blocking() with a given command ID.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param target_speed The target speed as a percentage (0-100).
+ * @param id Motion command ID reported on completion, 0 for an untracked target.
+ */
+void motordriver_set_target_speed(motor_t *motor, uint32_t target_speed, uint32_t id) {
+    k_mutex_lock(motor->mutex, K_FOREVER);
+    if (atomic_get(&motor->emergency_stop) && target_speed != 0) {
+        LOG_WRN("%s quick stop in progress, target speed %d ignored.", motor->name, target_speed);
+        k_mutex_unlock(motor->mutex);
+        events_post(id, motor->name, EVENT_ABORTED, EVENT_REASON_QUICK_STOP);
+        return;
+    }
+    motor_set_target_speed(motor, target_speed, id);
     k_mutex_unlock(motor->mutex);
 }
 
+/**
+ * @brief Sets a new untracked target speed and starts the ramp, without waiting.
+ *
+ * Like motordriver_set_target_speed(), but never waits for the motor mutex, so it
+ * can be called from the control loop; if the motor is busy the caller retries on
+ * its next update.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param target_speed The target speed as a percentage (0-100).
+ * @return 0 on success, -EBUSY if the motor is locked, -EPERM during a quick stop.
+ */
+int motordriver_try_set_target_speed(motor_t *motor, uint32_t target_speed) {
+    if (motor_try_lock(motor) != 0) {
+        return -EBUSY;
+    }
+    if (atomic_get(&motor->emergency_stop) && target_speed != 0) {
+        k_mutex_unlock(motor->mutex);
+        return -EPERM;
+    }
+    motor_set_target_speed(motor, target_speed, 0);
+    k_mutex_unlock(motor->mutex);
+    return 0;
+}
+
+/**
+ * @brief Sets the direction of a standing motor, without waiting.
+ *
+ * Unlike motordriver_set_dir() it does not ramp the motor down, the caller brakes
+ * first and retries once the motor stands still. Never waits for the motor mutex.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param dir The new direction for the motor.
+ * @return 0 on success, -EBUSY if the motor is locked or not standing still.
+ */
+int motordriver_try_set_dir(motor_t *motor, bool dir) {
+    if (motor_try_lock(motor) != 0) {
+        return -EBUSY;
+    }
+    int ret = 0;
+    if (motor->direction != dir) {
+        if (motor->speed != 0 || motor->target_speed != 0) {
+            ret = -EBUSY;
+        } else {
+            motor_end_command(motor, EVENT_ABORTED, EVENT_REASON_SUPERSEDED);
+            motor->direction = dir;
+            gpio_pin_set(motor->dir_pin.port, motor->dir_pin.pin, motor->direction);
+        }
+    }
+    k_mutex_unlock(motor->mutex);
+    return ret;
+}
+
 /**
  * @brief Gradually adjusts the motor speed in a non-blocking manner.
  *
- * Starts or restarts a timer to adjust the motor speed towards the target speed.
- * The actual speed adjustment is performed in the timer callback function. This
+ * Starts or restarts the ramp work to adjust the motor speed towards the target speed.
+ * The actual speed adjustment is performed in the ramp work handler. This
  * function allows other operations to continue while the motor speed is being adjusted.
  *
+ * The adjustment is a motion command: a completion event with the returned ID is
+ * posted when the target speed is reached, or an abort event if it is superseded,
+ * stopped or limited before.
+ *
  * **Usage**
  * ```
  * motor_t motor; // Assume this is initialized
- * motordriver_adjust_motor_speed_non_blocking(&motor, 75); // Adjust speed to 75%
+ * uint32_t id = motordriver_adjust_motor_speed_non_blocking(&motor, 75); // Adjust speed to 75%
  * ```
  *
  * @param motor Pointer to the motor structure.
  * @param target_speed The target speed as a percentage (0-100).
+ * @return Motion command ID, 0 if the rates are invalid.
  */
-void motordriver_adjust_motor_speed_non_blocking(motor_t *motor, uint32_t target_speed) {
+uint32_t motordriver_adjust_motor_speed_non_blocking(motor_t *motor, uint32_t target_speed) {
     if (motor->acceleration_rate == 0 || motor->braking_rate == 0) {
         LOG_ERR("Rate of speed change cannot be zero.");
-        return;
-    }
-    k_mutex_lock(motor->mutex, K_FOREVER);
-    uint32_t new_target_speed = MIN(target_speed, 100);
-    // Only start or restart the timer if the target speed has changed
-    if (motor->target_speed != new_target_speed) {
-        motor->target_speed = new_target_speed;
-        // wait a bit before starting adjusting speed
-        k_timer_start(motor->timer, K_MSEC(ADJUST_SPEED_DELAY_MS), K_NO_WAIT);
+        return 0;
     }
-    k_mutex_unlock(motor->mutex);
+    uint32_t id = events_next_id();
+    motordriver_set_target_speed(motor, target_speed, id);
+    return id;
 }
 
-void set_motors(motor_t *m1, motor_t *m2, uint32_t speed1, uint32_t speed2, bool dir1, bool dir2) {
+uint32_t set_motors(motor_t *m1, motor_t *m2, uint32_t speed1, uint32_t speed2, bool dir1, bool dir2) {
+    uint32_t id = events_next_id();
     // Brake both motors to zero speed non-blocking if direction change is needed
     bool needToStopM1 = (m1->direction != dir1);
     bool needToStopM2 = (m2->direction != dir2);
     if (needToStopM1 || speed1 == 0) {
-        motordriver_adjust_motor_speed_non_blocking(m1, 0);
+        motordriver_set_target_speed(m1, 0, 0);
     }
     if (needToStopM2 || speed2 == 0) {
-        motordriver_adjust_motor_speed_non_blocking(m2, 0);
+        motordriver_set_target_speed(m2, 0, 0);
     }
     // Monitor the speed of both motors if needed
     while ((needToStopM1 && m1->speed != 0) || (needToStopM2 && m2->speed != 0)) {
@@ -331,19 +537,409 @@ void set_motors(motor_t *m1, motor_t *m2, uint32_t speed1, uint32_t speed2, bool
     if (needToStopM2) {
         motordriver_set_dir(m2, dir2);
     }
-    // Set the new speeds
-    motordriver_adjust_motor_speed_non_blocking(m1, speed1);
-    motordriver_adjust_motor_speed_non_blocking(m2, speed2);
+    // Set the new speeds, both motors report the same command ID
+    motordriver_set_target_speed(m1, speed1, id);
+    motordriver_set_target_speed(m2, speed2, id);
+    return id;
+}
+
+/* Finish a stop, runs in the system workqueue because it waits for the motor mutex */
+static void motor_stop_work_handler(struct k_work *work) {
+    motor_t *motor = CONTAINER_OF(work, motor_t, stop_work);
+    atomic_val_t pending = atomic_clear(&motor->stop_pending);
+    if (pending == 0) {
+        return;
+    }
+    k_mutex_lock(motor->mutex, K_FOREVER);
+    motor_end_command(motor, EVENT_ABORTED, EVENT_REASON_STOPPED);
+    if (pending & BIT(MOTOR_STOP_IMMEDIATE)) {
+        k_work_cancel_delayable(&motor->ramp_work);
+        motor->target_speed = 0;
+        set_speed(motor, 0);
+        atomic_clear(&motor->emergency_stop);
+        atomic_clear(&motor->output_cut);
+        safety_signal_arm(motor_get_signal(motor), false);
+    } else if (pending & BIT(MOTOR_STOP_QUICK)) {
+        motor->target_speed = 0;
+        k_work_reschedule(&motor->ramp_work, K_NO_WAIT);
+        safety_signal_arm(motor_get_signal(motor), motor->speed != 0);
+    } else if (motor->target_speed != 0) {
+        motor->target_speed = 0;
+        k_work_reschedule(&motor->ramp_work, K_MSEC(ADJUST_SPEED_DELAY_MS));
+        safety_signal_arm(motor_get_signal(motor), motor->speed != 0);
+    }
+    if (motor->speed == 0 && motor->duty != 0) {
+        // Raw duty written by the calibration, there is no ramp to bring it down
+        set_speed(motor, 0);
+    }
+    k_mutex_unlock(motor->mutex);
+    LOG_INF("%s stopped (categories 0x%x).", motor->name, (uint32_t)pending);
+}
+
+/**
+ * @brief Stops a motor.
+ *
+ * A controlled stop brakes with the normal braking profile, like setting the speed
+ * to 0. A quick stop brakes with the emergency braking profile and ignores new
+ * target speeds until the motor stands still. An immediate stop cuts the PWM output
+ * at once and lets the motor coast.
+ *
+ * Never waits for the motor mutex and is safe to call from ISRs. The immediate cut
+ * and the quick stop flag take effect at once, lock-free; the rest (ending the
+ * motion command, the braking ramp) is done in the system workqueue. Until then a
+ * cut output stays at 0 and a quick stopped motor does not accelerate, whoever holds
+ * the mutex.
+ *
+ * **Usage**
+ * ```
+ * motordriver_stop_motor(&motor1, MOTOR_STOP_QUICK);
+ * ```
+ *
+ * @param motor Pointer to the motor structure.
+ * @param category How the motor is stopped.
+ */
+void motordriver_stop_motor(motor_t *motor, enum motor_stop_category category) {
+    switch (category) {
+        case MOTOR_STOP_IMMEDIATE: {
+            k_spinlock_key_t key = k_spin_lock(&motor->pwm_lock);
+            atomic_set(&motor->output_cut, 1);
+            if (pwm_set_cycles(motor->pwm_spec.dev, motor->pwm_spec.channel, motor->period_cycles, 0,
+                               motor->pwm_spec.flags) == 0) {
+                motor->pulse = 0;
+            }
+            k_spin_unlock(&motor->pwm_lock, key);
+            break;
+        }
+        case MOTOR_STOP_QUICK:
+            atomic_set(&motor->emergency_stop, 1);
+            break;
+        case MOTOR_STOP_CONTROLLED:
+            break;
+    }
+    atomic_or(&motor->stop_pending, BIT(category));
+    k_work_submit(&motor->stop_work);
 }
 
 /**
- * @brief Stops both motors by gradually reducing their speed to zero.
+ * @brief Stops both motors.
+ *
+ * @param category How the motors are stopped, see motordriver_stop_motor().
  */
-void motordriver_stop_motors() {
-    // Set the speed of both motors to zero
-    motordriver_adjust_motor_speed_non_blocking(&motor1, 0);
-    motordriver_adjust_motor_speed_non_blocking(&motor2, 0);
-    LOG_INF("Both motors are stopping.");
+void motordriver_stop_motors(enum motor_stop_category category) {
+    motordriver_stop_motor(&motor1, category);
+    motordriver_stop_motor(&motor2, category);
+}
+
+/**
+ * @brief Limits the maximum speed of a motor.
+ *
+ * Sets the upper bound for the speed of the motor, e.g. for thermal derating. If the
+ * motor currently runs or ramps above the new limit, it is braked down to the limit
+ * using its normal braking profile. Raising the limit does not accelerate the motor.
+ *
+ * **Usage**
+ * ```
+ * motordriver_set_speed_limit(&motor1, 50); // Derate motor1 to 50%
+ * ```
+ *
+ * @param motor Pointer to the motor structure.
+ * @param limit_percent The maximum speed as a percentage (0-100).
+ */
+void motordriver_set_speed_limit(motor_t *motor, uint32_t limit_percent) {
+    k_mutex_lock(motor->mutex, K_FOREVER);
+    motor->speed_limit = MIN(limit_percent, 100);
+    if (motor->target_speed > motor->speed_limit || motor->speed > motor->speed_limit) {
+        motor_end_command(motor, EVENT_ABORTED, EVENT_REASON_LIMITED);
+        motor->target_speed = motor->speed_limit;
+        k_work_reschedule(&motor->ramp_work, K_MSEC(ADJUST_SPEED_DELAY_MS));
+    }
+    k_mutex_unlock(motor->mutex);
+    LOG_DBG("%s speed limit set to %d", motor->name, motor->speed_limit);
+}
+
+/**
+ * @brief Sets the duty map of a motor for one direction.
+ *
+ * Expands the points into the lookup table used by set_speed(). The points must
+ * not decrease and must not exceed MOTOR_DUTY_FULL_SCALE.
+ *
+ * **Usage**
+ * ```
+ * // Motor starts turning at 18 % duty, linear above
+ * uint16_t points[MOTOR_DUTY_MAP_POINTS] = {1800, 2620, 3440, 4260, 5080, 5900,
+ *                                           6720, 7540, 8360, 9180, 10000};
+ * motordriver_set_duty_map(&motor1, 0, points);
+ * ```
+ *
+ * @param motor Pointer to the motor structure.
+ * @param dir Direction the map applies to.
+ * @param points Duty in 0.01 % at speed 0+ (deadband) and at 10, 20, .., 100 %.
+ * @return 0 on success, -EINVAL for invalid points.
+ */
+int motordriver_set_duty_map(motor_t *motor, bool dir, const uint16_t points[MOTOR_DUTY_MAP_POINTS]) {
+    for (int k = 0; k < MOTOR_DUTY_MAP_POINTS; k++) {
+        if (points[k] > MOTOR_DUTY_FULL_SCALE || (k > 0 && points[k] < points[k - 1])) {
+            return -EINVAL;
+        }
+    }
+    struct motor_duty_map *map = &motor->duty_map[dir];
+    k_mutex_lock(motor->mutex, K_FOREVER);
+    memcpy(map->points, points, sizeof(map->points));
+    map->lut[0] = 0;
+    for (int speed = 1; speed <= 100; speed++) {
+        int k = MIN(speed / 10, MOTOR_DUTY_MAP_POINTS - 2);
+        int offset = speed - k * 10;
+        map->lut[speed] = points[k] + (points[k + 1] - points[k]) * offset / 10;
+    }
+    k_mutex_unlock(motor->mutex);
+    return 0;
+}
+
+/**
+ * @brief Writes a raw duty to the PWM output of a motor, bypassing ramp and duty map.
+ *
+ * Only meant for calibration, the speed of the motor is not updated. A non-zero duty
+ * is refused while a stop of the motor is pending or in progress; the stop work sets
+ * a raw duty back to 0.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param duty Duty in 0.01 %.
+ * @return 0 on success, -ECANCELED while the motor is stopped, negative error code
+ *         from the PWM driver on failure.
+ */
+int motordriver_write_duty(motor_t *motor, uint32_t duty) {
+    k_mutex_lock(motor->mutex, K_FOREVER);
+    int ret = -ECANCELED;
+    if (duty == 0 || (!atomic_get(&motor->emergency_stop) && !atomic_get(&motor->output_cut) &&
+                      !atomic_get(&motor->stop_pending))) {
+        ret = motor_write_duty(motor, MIN(duty, MOTOR_DUTY_FULL_SCALE));
+    }
+    k_mutex_unlock(motor->mutex);
+    return ret;
+}
+
+/**
+ * @brief Sets the factor applied to every duty written to the PWM output of a motor.
+ *
+ * Used for the battery voltage feed-forward. The current duty is re-written at once
+ * if the scale changes. Never waits for the motor mutex, so it can be called from
+ * the control loop; if the motor is busy the caller retries on its next update.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param scale Q12 factor, MOTOR_DUTY_SCALE_ONE for no scaling.
+ * @return 0 on success, -EBUSY if the motor is locked, negative error code from the
+ *         PWM driver on failure.
+ */
+int motordriver_set_duty_scale(motor_t *motor, uint32_t scale) {
+    if (motor_try_lock(motor) != 0) {
+        return -EBUSY;
+    }
+    int ret = 0;
+    if (scale != motor->duty_scale) {
+        motor->duty_scale = scale;
+        if (motor->duty != 0) {
+            ret = motor_write_duty(motor, motor->duty);
+        }
+    }
+    k_mutex_unlock(motor->mutex);
+    return ret;
+}
+
+/**
+ * @brief Caps the output speed of a motor, used for the proximity gating.
+ *
+ * Unlike the speed limit the cap applies at once and only to the PWM output, the
+ * ramp keeps its speed. When the cap is raised the output follows up to the ramp
+ * speed again. Never waits for the motor mutex, so it can be called from the control
+ * loop; if the motor is busy the caller retries on its next update.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param speed_percent Largest output speed as a percentage (0-100), 100 for no cap.
+ * @return 0 on success, -EBUSY if the motor is locked, negative error code from the
+ *         PWM driver on failure.
+ */
+int motordriver_set_gate(motor_t *motor, uint32_t speed_percent) {
+    if (motor_try_lock(motor) != 0) {
+        return -EBUSY;
+    }
+    int ret = 0;
+    speed_percent = MIN(speed_percent, 100u);
+    if (speed_percent != motor->gate_speed) {
+        motor->gate_speed = speed_percent;
+        if (motor->duty != 0) {
+            ret = motor_write_duty(motor, motor->duty);
+        }
+    }
+    k_mutex_unlock(motor->mutex);
+    return ret;
+}
+
+/**
+ * @brief Drives a motor directly with a speed and direction, bypassing the ramp.
+ *
+ * Meant for closed loop control from the control loop, which does its own profile.
+ * A running ramp is cancelled. A reversal first writes speed 0 and only switches
+ * the direction on a later call, when the motor is already at speed 0. Never waits
+ * for the motor mutex.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param dir Direction of the motor.
+ * @param speed_percent Speed of the motor as a percentage (0-100).
+ * @return 0 on success, -EBUSY if the motor is locked, -EPERM during a quick stop.
+ */
+int motordriver_drive(motor_t *motor, bool dir, uint32_t speed_percent) {
+    if (motor_try_lock(motor) != 0) {
+        return -EBUSY;
+    }
+    if (atomic_get(&motor->emergency_stop)) {
+        k_mutex_unlock(motor->mutex);
+        return -EPERM;
+    }
+    k_work_cancel_delayable(&motor->ramp_work);
+    motor_end_command(motor, EVENT_ABORTED, EVENT_REASON_SUPERSEDED);
+    if (dir != motor->direction) {
+        if (motor->speed != 0) {
+            speed_percent = 0;
+        } else {
+            motor->direction = dir;
+            gpio_pin_set(motor->dir_pin.port, motor->dir_pin.pin, motor->direction);
+        }
+    }
+    if (speed_percent != motor->speed || motor->target_speed != motor->speed) {
+        set_speed(motor, speed_percent);
+        motor->target_speed = motor->speed;
+    }
+    k_mutex_unlock(motor->mutex);
+    return 0;
+}
+
+/**
+ * @brief Enables or disables sigma-delta dithering of the PWM pulse of a motor.
+ *
+ * Without dithering the pulse length is truncated to whole counter cycles. With
+ * dithering the fraction is accumulated and the pulse is one cycle longer on
+ * some control ticks, so the mean duty has a resolution of 1/256 cycle. This
+ * mainly helps at low duty and high PWM frequency, where one cycle is a noticeable
+ * step in speed.
+ *
+ * @param motor Pointer to the motor structure.
+ * @param enable Dithering on or off.
+ */
+void motordriver_set_dither(motor_t *motor, bool enable) {
+    k_mutex_lock(motor->mutex, K_FOREVER);
+    motor->dither = enable;
+    motor->dither_acc = 0;
+    motor_write_pulse(motor, motor->pulse_q8 >> MOTOR_DITHER_BITS);
+    k_mutex_unlock(motor->mutex);
+}
+
+/**
+ * @brief Advances the dithering of all motors, called once per control tick.
+ *
+ * Only writes the PWM output if the pulse changes. A busy motor skips the tick.
+ */
+void motordriver_dither_update(void) {
+    motor_t *motors[] = {&motor1, &motor2};
+    for (int i = 0; i < ARRAY_SIZE(motors); i++) {
+        motor_t *motor = motors[i];
+        if (!motor->dither || (motor->pulse_q8 & BIT_MASK(MOTOR_DITHER_BITS)) == 0) {
+            continue;
+        }
+        if (motor_try_lock(motor) != 0) {
+            continue;
+        }
+        uint32_t pulse = motor_dither_step(&motor->dither_acc, motor->pulse_q8);
+        if (pulse != motor->pulse) {
+            motor_write_pulse(motor, pulse);
+        }
+        k_mutex_unlock(motor->mutex);
+    }
+}
+
+static bool motor_shares_slice(const motor_t *a, const motor_t *b) {
+    return a->pwm_spec.dev == b->pwm_spec.dev &&
+           a->pwm_spec.channel / MOTOR_PWM_CHANNELS_PER_SLICE == b->pwm_spec.channel / MOTOR_PWM_CHANNELS_PER_SLICE;
+}
+
+/*
+ * Lock interrupts while the slice counter is in the first half of its period. The new
+ * TOP and compare values are double buffered by the hardware and latched together at
+ * the next wrap, which is then at least half a period away.
+ *
+ * The wait for the first half runs with interrupts enabled. An interrupt between the
+ * wait and the lock may take the counter past the middle, so it is checked again
+ * under the lock and the wait repeats. Only the writes run with interrupts locked.
+ */
+static unsigned int motor_pwm_lock_period_start(const motor_t *motor) {
+#ifdef CONFIG_PWM_RPI_PICO
+    uint32_t slice = motor->pwm_spec.channel / MOTOR_PWM_CHANNELS_PER_SLICE;
+    uint32_t top = pwm_hw->slice[slice].top;
+    while (1) {
+        while (pwm_hw->slice[slice].ctr > top / 2) {
+        }
+        unsigned int key = irq_lock();
+        if (pwm_hw->slice[slice].ctr <= top / 2) {
+            return key;
+        }
+        irq_unlock(key);
+    }
+#else
+    return irq_lock();
+#endif
+}
+
+/**
+ * @brief Sets the PWM period of a motor.
+ *
+ * All motors on the same PWM slice share the counter and therefore the period,
+ * they are all re-programmed. The duty of every affected motor is kept
+ * proportionally. The new period takes effect at a period boundary, so no
+ * shortened or stretched pulse is output.
+ *
+ * **Usage**
+ * ```
+ * motordriver_set_pwm_period(&motor1, PWM_HZ(20000)); // 20 kHz
+ * ```
+ *
+ * @param motor Pointer to the motor structure.
+ * @param period_ns PWM period in nanoseconds.
+ * @return 0 on success, -EINVAL if the period is out of the slice's range
+ *         (see PLUTO_MOTOR_PWM_MIN_CYCLES and MOTOR_PWM_MAX_CYCLES), negative
+ *         error code from the PWM driver on failure.
+ */
+int motordriver_set_pwm_period(motor_t *motor, uint32_t period_ns) {
+    uint64_t cycles_per_sec;
+    int ret = pwm_get_cycles_per_sec(motor->pwm_spec.dev, motor->pwm_spec.channel, &cycles_per_sec);
+    if (ret < 0) {
+        return ret;
+    }
+    uint64_t period_cycles = (uint64_t)period_ns * cycles_per_sec / NSEC_PER_SEC;
+    if (period_cycles < PLUTO_MOTOR_PWM_MIN_CYCLES || period_cycles > MOTOR_PWM_MAX_CYCLES) {
+        LOG_ERR("%s period %d ns out of range (%d..%d cycles at %d Hz)", motor->name, period_ns,
+                PLUTO_MOTOR_PWM_MIN_CYCLES, MOTOR_PWM_MAX_CYCLES, (uint32_t)cycles_per_sec);
+        return -EINVAL;
+    }
+    motor_t *motors[] = {&motor1, &motor2};
+    // Always lock in the same order
+    for (int i = 0; i < ARRAY_SIZE(motors); i++) {
+        k_mutex_lock(motors[i]->mutex, K_FOREVER);
+    }
+    unsigned int key = motor_pwm_lock_period_start(motor);
+    for (int i = 0; i < ARRAY_SIZE(motors); i++) {
+        if (!motor_shares_slice(motor, motors[i])) {
+            continue;
+        }
+        motors[i]->pwm_spec.period = period_ns;
+        motors[i]->period_cycles = (uint32_t)period_cycles;
+        int err = motor_write_duty(motors[i], motors[i]->duty);
+        ret = (ret == 0) ? err : ret;
+    }
+    irq_unlock(key);
+    for (int i = ARRAY_SIZE(motors) - 1; i >= 0; i--) {
+        k_mutex_unlock(motors[i]->mutex);
+    }
+    LOG_DBG("%s PWM period set to %d ns", motor->name, period_ns);
+    return ret;
 }
 
 /**
@@ -361,6 +957,8 @@ void motordriver_stop_motors() {
 void motordriver_init() {
     init_motor(&motor1);
     init_motor(&motor2);
+    safety_signal_register(SAFETY_SIGNAL_MOTOR_1, motor1.name, &motor1.speed_timestamp);
+    safety_signal_register(SAFETY_SIGNAL_MOTOR_2, motor2.name, &motor2.speed_timestamp);
     LOG_INF("All motors configured and set to OFF!");
     cmd_motor1_init();
     cmd_motor2_init();
@@ -22,6 +22,8 @@
 
 
 #include "inc/pluto_motordriver.h"
+#include "inc/pluto_events.h"
+#include "inc/pluto_arbiter.h"
 #include "inc/usb_cli.h"
 
 /* Enable logging for module. Change Log Level for debugging. */
@@ -35,6 +37,9 @@ static int cmd_motors(const struct shell *shell, size_t argc, char **argv) {
 /* Subcommand implementations for motors */
 
 static int cmd_motors_set(const struct shell *shell, size_t argc, char **argv) {
+    if (arbiter_check_unowned(shell) != 0) {
+        return -EACCES;
+    }
     if (argc == 5) {
         uint32_t speed_motor1 = simple_strtou32(argv[1]);
         bool dir_motor1 = simple_strtou32(argv[2]) != 0;
@@ -44,8 +49,10 @@ static int cmd_motors_set(const struct shell *shell, size_t argc, char **argv) {
         // Ensuring the speeds are within the valid range
         speed_motor1 = (speed_motor1 > 100) ? 100 : speed_motor1;
         speed_motor2 = (speed_motor2 > 100) ? 100 : speed_motor2;
-        shell_print(shell, "%d %d %d %d", speed_motor1, dir_motor1, speed_motor2, dir_motor2);
-        set_motors(&motor1, &motor2, speed_motor1, speed_motor2, dir_motor1, dir_motor2);
+        events_set_shell(shell);
+        // Blocks for a direction change, the ID is printed once the new speeds are set
+        uint32_t id = set_motors(&motor1, &motor2, speed_motor1, speed_motor2, dir_motor1, dir_motor2);
+        shell_print(shell, "%d %d %d %d %u", speed_motor1, dir_motor1, speed_motor2, dir_motor2, id);
         LOG_DBG("Motors set: Motor1 - Speed %d, Direction %d; Motor2 - Speed %d, Direction %d",
                     speed_motor1, dir_motor1, speed_motor2, dir_motor2);
     } else {
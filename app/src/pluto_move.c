@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_move.c
+ * @brief Position Move Module
+ *
+ * Moves a motor, or both motors together, by a distance in encoder counts with a
+ * trapezoidal speed profile: accelerate with the given acceleration up to the max
+ * speed, cruise, and brake so that the profile stops at the target.
+ *
+ * The profile is planned and executed in the control loop, one step per control
+ * tick in fixed point (Q16 counts). The motor speed is the profile speed as feed
+ * forward plus a proportional correction of the position error measured by the
+ * encoder, written directly to the motor (bypassing the motor ramp).
+ *
+ * A move is
+ * - done when the profile has ended and the position is within the tolerance,
+ * - aborted on "move abort", on a safety fault (the safety module stops the motor),
+ *   or if the target is not reached within the settle timeout after the profile.
+ * Both are reported as motion event (see pluto_events.c) with the ID of the move.
+ * A move of both motors has one ID and reports one event per motor; if one motor
+ * aborts, the other one is aborted with the same reason.
+ *
+ * A move needs the encoder of the motor and a motor at standstill.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "inc/pluto_move.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_encoder.h"
+#include "inc/pluto_odometry.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_arbiter.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_move, LOG_LEVEL_WRN);
+
+struct move_axis {
+    motor_t *motor;
+    enum encoder_id encoder;
+    enum move_state state;
+    enum event_reason reason;
+    uint32_t id;                // motion command ID
+    int32_t start;              // encoder count at the start
+    int32_t sign;               // 1 for forward, -1 for backward
+    int64_t distance_q16;       // distance to move, always positive
+    int64_t ref_q16;            // profile position
+    int64_t speed_q16;          // profile speed in counts/s
+    int64_t max_speed_q16;
+    int64_t acceleration_q16;   // counts/s^2
+    int64_t speed_step_q16;     // speed change per control tick
+    bool profile_done;
+    bool stop_pending;          // brake after an abort, done by the control loop
+    uint32_t settle_ticks;
+    uint32_t fault_count;
+};
+
+static struct move_axis axes[MOVE_AXIS_COUNT] = {
+        {.motor = &motor1, .encoder = ENCODER_1},
+        {.motor = &motor2, .encoder = ENCODER_2},
+};
+
+static int32_t max_speed = PLUTO_MOVE_MAX_SPEED;
+static int32_t kp = PLUTO_MOVE_KP;
+static int32_t tolerance = PLUTO_MOVE_TOLERANCE;
+static uint32_t settle_timeout_ms = PLUTO_MOVE_SETTLE_TIMEOUT_MS;
+static struct k_spinlock move_lock;
+
+static const char *move_state_names[] = {"idle", "running", "done", "aborted"};
+
+static int32_t move_get_position(const struct move_axis *axis) {
+    return (encoder_get_count(axis->encoder) - axis->start) * axis->sign;
+}
+
+/* End a running move and report it, the move lock must be held */
+static void move_finish(struct move_axis *axis, enum move_state state, enum event_reason reason) {
+    axis->state = state;
+    axis->reason = reason;
+    events_post(axis->id, axis->motor->name, state == MOVE_STATE_DONE ? EVENT_DONE : EVENT_ABORTED, reason);
+    if (state != MOVE_STATE_ABORTED) {
+        return;
+    }
+    // Abort the other motor of a move of both motors
+    for (int i = 0; i < MOVE_AXIS_COUNT; i++) {
+        struct move_axis *other = &axes[i];
+        if (other != axis && other->state == MOVE_STATE_RUNNING && other->id == axis->id) {
+            other->state = MOVE_STATE_ABORTED;
+            other->reason = reason;
+            other->stop_pending = reason != EVENT_REASON_FAULT;
+            events_post(other->id, other->motor->name, EVENT_ABORTED, reason);
+        }
+    }
+}
+
+/* Advance the trapezoidal profile by one control tick */
+static void move_profile_step(struct move_axis *axis) {
+    if (axis->profile_done) {
+        return;
+    }
+    int64_t remaining_q16 = axis->distance_q16 - axis->ref_q16;
+    int64_t braking_q16 = axis->speed_q16 * axis->speed_q16 / (2 * axis->acceleration_q16);
+    bool braking = remaining_q16 <= braking_q16;
+    if (braking) {
+        axis->speed_q16 = MAX(0, axis->speed_q16 - axis->speed_step_q16);
+    } else {
+        axis->speed_q16 = MIN(axis->max_speed_q16, axis->speed_q16 + axis->speed_step_q16);
+    }
+    axis->ref_q16 += axis->speed_q16 * PLUTO_CONTROL_PERIOD_US / USEC_PER_SEC;
+    // Stop at the target, or where braking reached standstill a fraction of a count before
+    if (axis->ref_q16 >= axis->distance_q16 || (braking && axis->speed_q16 == 0)) {
+        axis->ref_q16 = axis->distance_q16;
+        axis->speed_q16 = 0;
+        axis->profile_done = true;
+    }
+}
+
+static void move_axis_update(struct move_axis *axis, uint32_t fault_count) {
+    k_spinlock_key_t key = k_spin_lock(&move_lock);
+    if (axis->stop_pending) {
+        // Braked from here, so that no later write of this loop cancels the ramp
+        axis->stop_pending = false;
+        k_spin_unlock(&move_lock, key);
+        motordriver_stop_motor(axis->motor, MOTOR_STOP_CONTROLLED);
+        return;
+    }
+    if (axis->state != MOVE_STATE_RUNNING) {
+        k_spin_unlock(&move_lock, key);
+        return;
+    }
+    if (fault_count != axis->fault_count) {
+        // The safety module already stops the motor
+        move_finish(axis, MOVE_STATE_ABORTED, EVENT_REASON_FAULT);
+        k_spin_unlock(&move_lock, key);
+        return;
+    }
+    move_profile_step(axis);
+    int32_t position = move_get_position(axis);
+    int32_t error = (int32_t)(axis->ref_q16 >> 16) - position;
+    bool stop = false;
+    if (axis->profile_done) {
+        if (abs((int32_t)(axis->distance_q16 >> 16) - position) <= tolerance) {
+            move_finish(axis, MOVE_STATE_DONE, EVENT_REASON_NONE);
+            stop = true;
+        } else if (++axis->settle_ticks * PLUTO_CONTROL_PERIOD_US >= settle_timeout_ms * USEC_PER_MSEC) {
+            move_finish(axis, MOVE_STATE_ABORTED, EVENT_REASON_TIMEOUT);
+            stop = true;
+        }
+    }
+    // Speed command in 0.001 %: feed forward of the profile speed plus position correction
+    int32_t command = stop ? 0 : (int32_t)((axis->speed_q16 >> 16) * 100000 / max_speed) + kp * error;
+    bool forward = (command >= 0) == (axis->sign > 0);
+    k_spin_unlock(&move_lock, key);
+
+    bool dir = forward ? PLUTO_MOVE_FORWARD_DIR : !PLUTO_MOVE_FORWARD_DIR;
+    uint32_t speed = MIN(100u, ((uint32_t)abs(command) + 500u) / 1000u);
+    if (motordriver_drive(axis->motor, stop ? axis->motor->direction : dir, speed) == -EPERM) {
+        move_abort(axis - axes, EVENT_REASON_FAULT);
+    }
+}
+
+/**
+ * @brief Run the position moves, called once per control tick.
+ */
+void move_update(void) {
+    uint32_t fault_count = safety_get_fault_count();
+    for (int i = 0; i < MOVE_AXIS_COUNT; i++) {
+        move_axis_update(&axes[i], fault_count);
+    }
+}
+
+/**
+ * @brief Start a position move of one motor.
+ *
+ * **Usage**
+ * ```
+ * move_start(MOVE_AXIS_1, 1440, 1000, 2000, events_next_id()); // one wheel revolution forward
+ * ```
+ *
+ * @param axis_id Motor to move.
+ * @param counts Distance in encoder counts, negative for backward.
+ * @param max_speed_counts Max speed in encoder counts/s, limited to the speed at 100 %.
+ * @param acceleration Acceleration and deceleration in encoder counts/s^2.
+ * @param id Motion command ID from events_next_id(), shared by the motors of one move.
+ * @return 0 on success, -ENODEV without encoder, -EINVAL for a zero speed or
+ *         acceleration, -EBUSY if the motor is moving, -EACCES if a control source
+ *         owns the motors.
+ */
+int move_start(enum move_axis_id axis_id, int32_t counts, uint32_t max_speed_counts, uint32_t acceleration,
+               uint32_t id) {
+    if (axis_id >= MOVE_AXIS_COUNT) {
+        return -EINVAL;
+    }
+    struct move_axis *axis = &axes[axis_id];
+    if (!encoder_is_present(axis->encoder)) {
+        return -ENODEV;
+    }
+    if (max_speed_counts == 0 || acceleration == 0) {
+        return -EINVAL;
+    }
+    if (arbiter_get_owner() != ARBITER_SOURCE_NONE) {
+        return -EACCES;
+    }
+    k_spinlock_key_t key = k_spin_lock(&move_lock);
+    if (axis->state == MOVE_STATE_RUNNING || axis->motor->speed != 0 || axis->motor->target_speed != 0) {
+        k_spin_unlock(&move_lock, key);
+        return -EBUSY;
+    }
+    axis->start = encoder_get_count(axis->encoder);
+    axis->sign = (counts < 0) ? -1 : 1;
+    axis->distance_q16 = (int64_t)abs(counts) << 16;
+    axis->ref_q16 = 0;
+    axis->speed_q16 = 0;
+    // Faster than 100 % speed cannot be followed, the clamp also keeps speed_q16^2 in range
+    axis->max_speed_q16 = (int64_t)MIN(max_speed_counts, (uint32_t)max_speed) << 16;
+    axis->acceleration_q16 = (int64_t)acceleration << 16;
+    axis->speed_step_q16 = MAX(1, axis->acceleration_q16 * PLUTO_CONTROL_PERIOD_US / USEC_PER_SEC);
+    axis->profile_done = false;
+    axis->stop_pending = false;
+    axis->settle_ticks = 0;
+    axis->fault_count = safety_get_fault_count();
+    axis->reason = EVENT_REASON_NONE;
+    axis->id = id;
+    axis->state = MOVE_STATE_RUNNING;
+    k_spin_unlock(&move_lock, key);
+    return 0;
+}
+
+/**
+ * @brief Abort a running position move, the motor brakes to standstill.
+ *
+ * @param axis_id Motor of the move.
+ * @param reason Reason reported in the abort event.
+ */
+void move_abort(enum move_axis_id axis_id, enum event_reason reason) {
+    struct move_axis *axis = &axes[axis_id];
+    k_spinlock_key_t key = k_spin_lock(&move_lock);
+    if (axis->state == MOVE_STATE_RUNNING) {
+        move_finish(axis, MOVE_STATE_ABORTED, reason);
+        // On a fault the safety module stops the motor
+        axis->stop_pending = reason != EVENT_REASON_FAULT;
+    }
+    k_spin_unlock(&move_lock, key);
+}
+
+/* Withdraw a move that was started but not reported, without an event; the motor brakes */
+static void move_cancel(enum move_axis_id axis_id) {
+    struct move_axis *axis = &axes[axis_id];
+    k_spinlock_key_t key = k_spin_lock(&move_lock);
+    if (axis->state == MOVE_STATE_RUNNING) {
+        axis->state = MOVE_STATE_IDLE;
+        axis->stop_pending = true;
+    }
+    k_spin_unlock(&move_lock, key);
+}
+
+/**
+ * @brief Get the state of the last position move of a motor.
+ */
+enum move_state move_get_state(enum move_axis_id axis_id) {
+    return axes[axis_id].state;
+}
+
+static int move_print_error(const struct shell *shell, int ret) {
+    switch (ret) {
+        case -ENODEV:
+            shell_error(shell, "No encoder.");
+            break;
+        case -EBUSY:
+            shell_error(shell, "Motor is moving.");
+            break;
+        case -EACCES:
+            shell_error(shell, "Motors are owned by %s.", arbiter_source_to_string(arbiter_get_owner()));
+            break;
+        default:
+            shell_error(shell, "Invalid move.");
+            break;
+    }
+    return ret;
+}
+
+static int cmd_move_counts(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 5) {
+        shell_error(shell, "Invalid number of arguments. Usage: move counts <1|2> <counts> <speed> <acceleration>");
+        return -EINVAL;
+    }
+    uint8_t number = simple_strtou8(argv[1]);
+    if (number < 1 || number > MOVE_AXIS_COUNT) {
+        shell_error(shell, "Invalid motor.");
+        return -EINVAL;
+    }
+    events_set_shell(shell);
+    uint32_t id = events_next_id();
+    int ret = move_start(number - 1, atoi(argv[2]), simple_strtou32(argv[3]), simple_strtou32(argv[4]), id);
+    if (ret < 0) {
+        return move_print_error(shell, ret);
+    }
+    shell_print(shell, "%s %u", move_state_names[MOVE_STATE_RUNNING], id);
+    return 0;
+}
+
+static int cmd_move_mm(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 4) {
+        shell_error(shell, "Invalid number of arguments. Usage: move mm <mm> <speed_mm_s> <acceleration_mm_s2>");
+        return -EINVAL;
+    }
+    int32_t counts = odometry_mm_to_counts(atoi(argv[1]));
+    uint32_t speed = (uint32_t)odometry_mm_to_counts((int32_t)simple_strtou32(argv[2]));
+    uint32_t acceleration = (uint32_t)odometry_mm_to_counts((int32_t)simple_strtou32(argv[3]));
+    events_set_shell(shell);
+    uint32_t id = events_next_id();
+    int ret = move_start(MOVE_AXIS_1, counts, speed, acceleration, id);
+    if (ret == 0) {
+        ret = move_start(MOVE_AXIS_2, counts, speed, acceleration, id);
+        if (ret < 0) {
+            // Reported as not started, so no event for this ID
+            move_cancel(MOVE_AXIS_1);
+        }
+    }
+    if (ret < 0) {
+        return move_print_error(shell, ret);
+    }
+    shell_print(shell, "%s %d %u", move_state_names[MOVE_STATE_RUNNING], counts, id);
+    return 0;
+}
+
+static int cmd_move_abort(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = 0; i < MOVE_AXIS_COUNT; i++) {
+        move_abort(i, EVENT_REASON_COMMAND);
+    }
+    shell_print(shell, "0");
+    return 0;
+}
+
+/* Prints "<state> <target> <reference> <position> <reference_speed>" in counts and counts/s */
+static int cmd_move_get_state(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments. Usage: move get-state <1|2>");
+        return -EINVAL;
+    }
+    uint8_t number = simple_strtou8(argv[1]);
+    if (number < 1 || number > MOVE_AXIS_COUNT) {
+        shell_error(shell, "Invalid motor.");
+        return -EINVAL;
+    }
+    struct move_axis *axis = &axes[number - 1];
+    k_spinlock_key_t key = k_spin_lock(&move_lock);
+    enum move_state state = axis->state;
+    int32_t target = (int32_t)(axis->distance_q16 >> 16) * axis->sign;
+    int32_t reference = (int32_t)(axis->ref_q16 >> 16) * axis->sign;
+    int32_t position = (state == MOVE_STATE_IDLE) ? 0 : move_get_position(axis) * axis->sign;
+    int32_t speed = (int32_t)(axis->speed_q16 >> 16) * axis->sign;
+    k_spin_unlock(&move_lock, key);
+    shell_print(shell, "%s %d %d %d %d", move_state_names[state], target, reference, position, speed);
+    return 0;
+}
+
+static int cmd_move_config(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 5) {
+        int32_t new_max_speed = (int32_t)simple_strtou32(argv[1]);
+        if (new_max_speed <= 0 || new_max_speed > PLUTO_MOVE_MAX_SPEED_LIMIT) {
+            shell_error(shell, "Invalid max speed.");
+            return -EINVAL;
+        }
+        max_speed = new_max_speed;
+        kp = (int32_t)simple_strtou32(argv[2]);
+        tolerance = (int32_t)simple_strtou32(argv[3]);
+        settle_timeout_ms = simple_strtou32(argv[4]);
+    } else if (argc != 1) {
+        shell_error(shell, "Invalid number of arguments. "
+                           "Usage: move config [<max_speed> <kp> <tolerance> <settle_timeout_ms>]");
+        return -EINVAL;
+    }
+    shell_print(shell, "%d %d %d %u", max_speed, kp, tolerance, settle_timeout_ms);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "move". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_move,
+                               SHELL_CMD(counts, NULL,
+                                         "Move motor <1|2> by <counts> with max <speed> (counts/s) "
+                                         "and <acceleration> (counts/s^2).",
+                                         cmd_move_counts),
+                               SHELL_CMD(mm, NULL,
+                                         "Move both motors by <mm> with max <speed_mm_s> and <acceleration_mm_s2>.",
+                                         cmd_move_mm),
+                               SHELL_CMD(abort, NULL, "Abort all moves.", cmd_move_abort),
+                               SHELL_CMD(get-state, NULL,
+                                         "Get <state> <target> <reference> <position> <reference_speed> of motor <1|2>.",
+                                         cmd_move_get_state),
+                               SHELL_CMD(config, NULL,
+                                         "Get or set <max_speed> (counts/s at 100 %) <kp> (0.001 % per count) "
+                                         "<tolerance> (counts) <settle_timeout_ms>.",
+                                         cmd_move_config),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "move" */
+SHELL_CMD_REGISTER(move, &sub_move, "Position moves.", NULL);
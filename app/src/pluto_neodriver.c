@@ -14,31 +14,28 @@
 
 #include "inc/pluto_neodriver.h"
 #include "inc/pluto_config.h"
+#include "inc/pluto_trace.h"
 
 
 LOG_MODULE_REGISTER(pluto_neodriver, LOG_LEVEL_WRN);
 
 #define NEODRIVER_NODE DT_NODELABEL(neodriver)
-#define NEODRIVER_I2C_ADDR DT_REG_ADDR(NEODRIVER_NODE)
 #define NEOPIXEL_PIN 15
 
-static struct pluto_neodriver driver;
+/* Bus and address come from devicetree, whichever controller the node sits on */
+static struct pluto_neodriver driver = {
+        .i2c = I2C_DT_SPEC_GET(NEODRIVER_NODE),
+};
 static uint16_t max_led_index = 120;
 static uint8_t animation_mode = 0;
 
 int neodriver_init(void) {
-    driver.i2c_dev = DEVICE_DT_GET(DT_BUS(NEODRIVER_NODE));
-    if (!driver.i2c_dev) {
-        LOG_ERR("I2C: Device driver not found");
-        return -ENODEV;
-    }
-    driver.i2c_addr = NEODRIVER_I2C_ADDR;
-    if (!device_is_ready(driver.i2c_dev)) {
+    if (!i2c_is_ready_dt(&driver.i2c)) {
         LOG_ERR("I2C device not ready");
         return -ENODEV;
     }
     uint8_t buf[2] = { SEESAW_NEOPIXEL_PIN, NEOPIXEL_PIN };
-    int ret = i2c_write(driver.i2c_dev, buf, sizeof(buf), driver.i2c_addr);
+    int ret = i2c_write_dt(&driver.i2c, buf, sizeof(buf));
     if (ret) {
         LOG_ERR("Failed to set Neopixel pin");
         return ret;
@@ -58,7 +55,9 @@ int neodriver_set_color(uint16_t led_index, uint8_t red, uint8_t green, uint8_t
     buf[4] = green;
     buf[5] = blue;
     buf[6] = white;
-    int ret = i2c_write(driver.i2c_dev, buf, sizeof(buf), driver.i2c_addr);
+    pluto_trace(PLUTO_TRACE_I2C_SUBMIT, driver.i2c.addr, PLUTO_TRACE_I2C_LEN(sizeof(buf), 0));
+    int ret = i2c_write_dt(&driver.i2c, buf, sizeof(buf));
+    pluto_trace(PLUTO_TRACE_I2C_COMPLETE, driver.i2c.addr, (uint16_t)ret);
     if (ret) {
         LOG_ERR("Failed to set Neopixel color");
     }
@@ -78,7 +77,11 @@ int neodriver_set_all_colors(uint8_t red, uint8_t green, uint8_t blue, uint8_t w
 
 int neodriver_show(void) {
     uint8_t cmd = SEESAW_NEOPIXEL_SHOW;
-    return i2c_write(driver.i2c_dev, &cmd, 1, driver.i2c_addr);
+    pluto_trace(PLUTO_TRACE_LED_FLUSH, max_led_index, 0);
+    pluto_trace(PLUTO_TRACE_I2C_SUBMIT, driver.i2c.addr, PLUTO_TRACE_I2C_LEN(1, 0));
+    int ret = i2c_write_dt(&driver.i2c, &cmd, 1);
+    pluto_trace(PLUTO_TRACE_I2C_COMPLETE, driver.i2c.addr, (uint16_t)ret);
+    return ret;
 }
 
 void running_light_animation(void) {
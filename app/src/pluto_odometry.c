@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_odometry.c
+ * @brief Wheel Odometry Module
+ *
+ * Integrates the pose (x, y, heading) of the differential drive from the wheel
+ * encoders once per control tick. motor1 drives the left wheel, motor2 the right
+ * wheel, both encoders have to count up when driving forward.
+ *
+ * The integration is done in fixed point only:
+ * - wheel travel in Q16 micrometers per encoder count,
+ * - position in Q16 micrometers (64 bit),
+ * - heading as binary angle (2^32 is one turn, wraps naturally),
+ * - sine/cosine from a quarter wave Q15 table with linear interpolation.
+ * Each step moves along the mean heading of the step (midpoint rule).
+ *
+ * Wheel radius, track width and encoder counts per wheel revolution are set with
+ * "odom config", the pose is read with "odom get" and in telemetry.
+ *
+ * Without both encoders the pose is not updated.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "inc/pluto_odometry.h"
+#include "inc/pluto_encoder.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_odometry, LOG_LEVEL_WRN);
+
+#define SIN_TABLE_SIZE      256
+#define BAM_QUARTER         (1u << 30)
+/* Narrowest track whose heading scale 2^48 / (2 pi track) still fits bam_per_um_q32 */
+#define MIN_TRACK_UM        (10431u)
+
+BUILD_ASSERT(PLUTO_ODOM_TRACK_UM >= MIN_TRACK_UM, "PLUTO_ODOM_TRACK_UM too narrow for the heading scale");
+
+/* sin over a quarter turn in Q15, one extra entry for interpolation */
+static int16_t sin_table[SIN_TABLE_SIZE + 1];
+
+struct odometry_config {
+    uint32_t wheel_radius_um;
+    uint32_t track_um;
+    uint32_t counts_per_rev;
+    int64_t um_per_count_q16;   // wheel travel per encoder count
+    uint32_t bam_per_um_q32;    // heading change per um of wheel travel difference, scaled by 2^16
+};
+
+static struct odometry_config config;
+static struct odometry_pose pose;
+static int64_t x_q16;
+static int64_t y_q16;
+static int32_t last_left;
+static int32_t last_right;
+static struct k_spinlock odometry_lock;
+
+/* sin of a binary angle in Q15 */
+static int32_t odometry_sin(uint32_t angle) {
+    uint32_t quadrant = angle >> 30;
+    uint32_t phase = angle & (BAM_QUARTER - 1);
+    if (quadrant & 1u) {
+        phase = BAM_QUARTER - phase;
+    }
+    uint32_t index = phase >> 22;
+    uint32_t frac = (phase >> 14) & 0xFFu;
+    int32_t value = sin_table[index];
+    if (frac != 0) {
+        value += ((sin_table[index + 1] - value) * (int32_t)frac) >> 8;
+    }
+    return (quadrant & 2u) ? -value : value;
+}
+
+static int32_t odometry_cos(uint32_t angle) {
+    return odometry_sin(angle + BAM_QUARTER);
+}
+
+static int odometry_configure(uint32_t wheel_radius_um, uint32_t track_um, uint32_t counts_per_rev) {
+    if (wheel_radius_um == 0 || track_um < MIN_TRACK_UM || counts_per_rev == 0) {
+        return -EINVAL;
+    }
+    k_spinlock_key_t key = k_spin_lock(&odometry_lock);
+    config.wheel_radius_um = wheel_radius_um;
+    config.track_um = track_um;
+    config.counts_per_rev = counts_per_rev;
+    // Only done on configuration, the integration itself uses no floating point
+    config.um_per_count_q16 = (int64_t)(2.0 * M_PI * wheel_radius_um * 65536.0 / counts_per_rev);
+    config.bam_per_um_q32 = (uint32_t)(281474976710656.0 / (2.0 * M_PI * track_um)); // 2^48
+    k_spin_unlock(&odometry_lock, key);
+    return 0;
+}
+
+/**
+ * @brief Integrate the wheel travel since the last tick, called once per control tick.
+ */
+void odometry_update(void) {
+    if (!encoder_is_present(ENCODER_1) || !encoder_is_present(ENCODER_2)) {
+        return;
+    }
+    int32_t left = encoder_get_count(ENCODER_1);
+    int32_t right = encoder_get_count(ENCODER_2);
+    int32_t speed_left = encoder_get_speed(ENCODER_1);
+    int32_t speed_right = encoder_get_speed(ENCODER_2);
+
+    k_spinlock_key_t key = k_spin_lock(&odometry_lock);
+    int64_t travel_left = (int64_t)(left - last_left) * config.um_per_count_q16;
+    int64_t travel_right = (int64_t)(right - last_right) * config.um_per_count_q16;
+    last_left = left;
+    last_right = right;
+    if (travel_left != 0 || travel_right != 0) {
+        int64_t distance = (travel_left + travel_right) / 2;
+        int32_t turn = (int32_t)(((travel_right - travel_left) * config.bam_per_um_q32) >> 32);
+        uint32_t mid_heading = pose.heading + (uint32_t)(turn / 2);
+        x_q16 += (distance * odometry_cos(mid_heading)) >> 15;
+        y_q16 += (distance * odometry_sin(mid_heading)) >> 15;
+        pose.heading += (uint32_t)turn;
+        pose.x_um = x_q16 >> 16;
+        pose.y_um = y_q16 >> 16;
+    }
+    pose.v_mm_s = (int32_t)((((int64_t)speed_left + speed_right) * config.um_per_count_q16 / 2) >> 16) / 1000;
+    pose.w_mrad_s = (int32_t)(((((int64_t)speed_right - speed_left) * config.um_per_count_q16) >> 16) * 1000 /
+                              config.track_um);
+    pose.timestamp = k_uptime_ticks();
+    k_spin_unlock(&odometry_lock, key);
+}
+
+/**
+ * @brief Get a consistent copy of the pose.
+ *
+ * @param out Pose, the timestamp is 0 if the pose was never updated.
+ */
+void odometry_get_pose(struct odometry_pose *out) {
+    k_spinlock_key_t key = k_spin_lock(&odometry_lock);
+    *out = pose;
+    k_spin_unlock(&odometry_lock, key);
+}
+
+/**
+ * @brief Set the pose, e.g. to the origin.
+ *
+ * @param x_um X position in micrometers.
+ * @param y_um Y position in micrometers.
+ * @param heading Heading as binary angle.
+ */
+void odometry_reset(int64_t x_um, int64_t y_um, uint32_t heading) {
+    k_spinlock_key_t key = k_spin_lock(&odometry_lock);
+    x_q16 = x_um << 16;
+    y_q16 = y_um << 16;
+    pose.x_um = x_um;
+    pose.y_um = y_um;
+    pose.heading = heading;
+    k_spin_unlock(&odometry_lock, key);
+}
+
+/**
+ * @brief Convert a wheel travel in millimeters to encoder counts.
+ *
+ * @param mm Wheel travel in millimeters.
+ * @return Encoder counts, rounded towards zero.
+ */
+int32_t odometry_mm_to_counts(int32_t mm) {
+    return (int32_t)(((int64_t)mm * 1000 << 16) / config.um_per_count_q16);
+}
+
+void odometry_init(void) {
+    for (int i = 0; i <= SIN_TABLE_SIZE; i++) {
+        sin_table[i] = (int16_t)lround(32767.0 * sin(M_PI / 2.0 * i / SIN_TABLE_SIZE));
+    }
+    odometry_configure(PLUTO_ODOM_WHEEL_RADIUS_UM, PLUTO_ODOM_TRACK_UM, PLUTO_ODOM_COUNTS_PER_REV);
+    last_left = encoder_get_count(ENCODER_1);
+    last_right = encoder_get_count(ENCODER_2);
+}
+
+/* Prints "<x_mm> <y_mm> <heading_mdeg> <v_mm_s> <w_mrad_s> <age_ms>" */
+static int cmd_odom_get(const struct shell *shell, size_t argc, char **argv) {
+    struct odometry_pose current;
+    odometry_get_pose(&current);
+    int64_t age_ms = current.timestamp ? k_ticks_to_ms_floor64(k_uptime_ticks() - current.timestamp) : -1;
+    shell_print(shell, "%lld %lld %u %d %d %lld", current.x_um / 1000, current.y_um / 1000,
+                ODOMETRY_BAM_TO_MDEG(current.heading), current.v_mm_s, current.w_mrad_s, age_ms);
+    return 0;
+}
+
+static int cmd_odom_reset(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 1 && argc != 4) {
+        shell_error(shell, "Invalid number of arguments. Usage: odom reset [<x_mm> <y_mm> <heading_mdeg>]");
+        return -EINVAL;
+    }
+    int64_t x_um = 0;
+    int64_t y_um = 0;
+    uint32_t heading = 0;
+    if (argc == 4) {
+        x_um = (int64_t)atoi(argv[1]) * 1000;
+        y_um = (int64_t)atoi(argv[2]) * 1000;
+        heading = (uint32_t)(((uint64_t)(simple_strtou32(argv[3]) % 360000u) << 32) / 360000u);
+    }
+    odometry_reset(x_um, y_um, heading);
+    shell_print(shell, "%lld %lld %u", x_um / 1000, y_um / 1000, ODOMETRY_BAM_TO_MDEG(heading));
+    return 0;
+}
+
+static int cmd_odom_config(const struct shell *shell, size_t argc, char **argv) {
+    if (argc == 1) {
+        shell_print(shell, "%u %u %u", config.wheel_radius_um, config.track_um, config.counts_per_rev);
+        return 0;
+    }
+    if (argc != 4) {
+        shell_error(shell, "Invalid number of arguments. Usage: odom config <wheel_radius_um> <track_um> <counts_per_rev>");
+        return -EINVAL;
+    }
+    if (odometry_configure(simple_strtou32(argv[1]), simple_strtou32(argv[2]), simple_strtou32(argv[3])) != 0) {
+        shell_error(shell, "Invalid configuration.");
+        return -EINVAL;
+    }
+    shell_print(shell, "%u %u %u", config.wheel_radius_um, config.track_um, config.counts_per_rev);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "odom". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_odom,
+                               SHELL_CMD(get, NULL, "Get <x_mm> <y_mm> <heading_mdeg> <v_mm_s> <w_mrad_s> <age_ms>.",
+                                         cmd_odom_get),
+                               SHELL_CMD(reset, NULL, "Reset pose to origin or [<x_mm> <y_mm> <heading_mdeg>].",
+                                         cmd_odom_reset),
+                               SHELL_CMD(config, NULL, "Get or set <wheel_radius_um> <track_um (>= 10431)> <counts_per_rev>.",
+                                         cmd_odom_config),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "odom" */
+SHELL_CMD_REGISTER(odom, &sub_odom, "Wheel odometry.", NULL);
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_profiler.c
+ * @brief Sampling Profiler Module
+ *
+ * The Cortex-M0+ has no cycle counter, so CPU time is measured statistically: a
+ * kernel timer interrupts the CPU periodically and records which thread was running
+ * and at which program counter. The PC is taken from the exception frame the
+ * hardware pushed on the process stack of the interrupted thread.
+ *
+ * Samples are accumulated into fixed tables (an open addressing PC histogram and a
+ * per-thread histogram), so the profiler needs no memory allocation and a sample
+ * costs a few table lookups. The sampling period is jittered by a few ticks to avoid
+ * locking onto threads that wake up on the same ticks as the timer.
+ *
+ * Limitations:
+ * - Time spent in an interrupt that is interrupted by the sampling timer is
+ *   attributed to the PC of the thread below it.
+ * - On targets other than Cortex-M (e.g. native_sim) no PC is available and only
+ *   the per-thread profile is recorded, PCs are reported as 0.
+ *
+ * The "prof" shell command starts, stops and dumps the profile,
+ * scripts/pluto_prof.py symbolizes a dump against zephyr.elf into a flat profile.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <string.h>
+
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_profiler, LOG_LEVEL_WRN);
+
+BUILD_ASSERT((PLUTO_PROFILER_PC_SLOTS & (PLUTO_PROFILER_PC_SLOTS - 1)) == 0,
+             "PLUTO_PROFILER_PC_SLOTS must be a power of two");
+
+#define PLUTO_PROFILER_DUMP_VERSION 1
+/** @brief Number of probes before a PC sample is dropped. */
+#define PLUTO_PROFILER_MAX_PROBES   8
+/** @brief Index of the stacked PC in the Cortex-M exception frame (r0-r3, r12, lr, pc, xpsr). */
+#define EXC_FRAME_PC_INDEX          6
+
+struct profiler_pc_slot {
+    uint32_t pc;
+    uint32_t count;
+};
+
+struct profiler_thread_slot {
+    k_tid_t thread;
+    uint32_t count;
+};
+
+static struct profiler_pc_slot pc_slots[PLUTO_PROFILER_PC_SLOTS];
+static struct profiler_thread_slot thread_slots[PLUTO_PROFILER_THREAD_SLOTS];
+static uint32_t samples;
+static uint32_t dropped;
+static uint32_t period_ticks;
+static uint32_t jitter_state = 0xACE1u;
+static bool running;
+static volatile bool paused;        // Set while a dump reads the slots, the timer keeps running
+
+static void profiler_timer_expiry(struct k_timer *timer_id);
+
+K_TIMER_DEFINE(profiler_timer, profiler_timer_expiry, NULL);
+
+/**
+ * @brief Get the PC of the thread interrupted by the sampling timer.
+ *
+ * @return Interrupted program counter, 0 if not available on this architecture.
+ */
+static uint32_t profiler_get_interrupted_pc(void) {
+#ifdef CONFIG_CPU_CORTEX_M
+    uint32_t *psp;
+    __asm__ volatile("mrs %0, psp" : "=r"(psp));
+    return psp[EXC_FRAME_PC_INDEX];
+#else
+    return 0;
+#endif
+}
+
+static void profiler_record_pc(uint32_t pc) {
+    // Thumb instructions are at least 2 byte aligned, drop bit 0 from the hash
+    uint32_t index = (pc >> 1) & (PLUTO_PROFILER_PC_SLOTS - 1);
+    for (int probe = 0; probe < PLUTO_PROFILER_MAX_PROBES; probe++) {
+        struct profiler_pc_slot *slot = &pc_slots[(index + probe) & (PLUTO_PROFILER_PC_SLOTS - 1)];
+        if (slot->count == 0) {
+            slot->pc = pc;
+        }
+        if (slot->pc == pc) {
+            slot->count++;
+            return;
+        }
+    }
+    dropped++;
+}
+
+static void profiler_record_thread(k_tid_t thread) {
+    for (int i = 0; i < PLUTO_PROFILER_THREAD_SLOTS; i++) {
+        if (thread_slots[i].count == 0) {
+            thread_slots[i].thread = thread;
+        }
+        if (thread_slots[i].thread == thread) {
+            thread_slots[i].count++;
+            return;
+        }
+    }
+}
+
+/* Next period in ticks, jittered by 0..3 ticks with a 16 bit LFSR */
+static k_timeout_t profiler_next_period(void) {
+    uint32_t bit = ((jitter_state >> 0) ^ (jitter_state >> 2) ^ (jitter_state >> 3) ^ (jitter_state >> 5)) & 1u;
+    jitter_state = (jitter_state >> 1) | (bit << 15);
+    return K_TICKS(period_ticks + (jitter_state & 0x3u));
+}
+
+static void profiler_timer_expiry(struct k_timer *timer_id) {
+    if (!running) {
+        return;
+    }
+    // A dump reads the slots, skip the sample but keep the timer running
+    if (!paused) {
+        samples++;
+        profiler_record_pc(profiler_get_interrupted_pc());
+        profiler_record_thread(k_current_get());
+    }
+    k_timer_start(timer_id, profiler_next_period(), K_NO_WAIT);
+}
+
+static void profiler_reset(void) {
+    unsigned int key = irq_lock();
+    memset(pc_slots, 0, sizeof(pc_slots));
+    memset(thread_slots, 0, sizeof(thread_slots));
+    samples = 0;
+    dropped = 0;
+    irq_unlock(key);
+}
+
+static int cmd_prof_start(const struct shell *shell, size_t argc, char **argv) {
+    uint32_t period_us = PLUTO_PROFILER_DEFAULT_PERIOD_US;
+    if (argc == 2) {
+        period_us = simple_strtou32(argv[1]);
+    }
+    period_ticks = (uint32_t)k_us_to_ticks_ceil64(period_us);
+    if (period_ticks == 0) {
+        shell_error(shell, "Invalid period.");
+        return -EINVAL;
+    }
+    running = true;
+    k_timer_start(&profiler_timer, profiler_next_period(), K_NO_WAIT);
+    shell_print(shell, "%u", (uint32_t)k_ticks_to_us_floor64(period_ticks));
+    return 0;
+}
+
+static int cmd_prof_stop(const struct shell *shell, size_t argc, char **argv) {
+    running = false;
+    k_timer_stop(&profiler_timer);
+    shell_print(shell, "%u", samples);
+    return 0;
+}
+
+static int cmd_prof_reset(const struct shell *shell, size_t argc, char **argv) {
+    profiler_reset();
+    shell_print(shell, "0");
+    return 0;
+}
+
+/**
+ * @brief Dump the profile.
+ *
+ * The output format is:
+ * ```
+ * # pluto-prof <version> <samples> <dropped> <period_us>
+ * T <thread> <name> <count>
+ * P <pc> <count>
+ * ```
+ * with thread and PC in hex.
+ */
+static int cmd_prof_dump(const struct shell *shell, size_t argc, char **argv) {
+    paused = true;
+    shell_print(shell, "# pluto-prof %d %u %u %u", PLUTO_PROFILER_DUMP_VERSION, samples, dropped,
+                (uint32_t)k_ticks_to_us_floor64(period_ticks));
+    for (int i = 0; i < PLUTO_PROFILER_THREAD_SLOTS; i++) {
+        if (thread_slots[i].count == 0) {
+            continue;
+        }
+        const char *name = k_thread_name_get(thread_slots[i].thread);
+        shell_print(shell, "T %08x %s %u", (uint32_t)(uintptr_t)thread_slots[i].thread,
+                    (name != NULL && name[0] != '\0') ? name : "-", thread_slots[i].count);
+    }
+    for (int i = 0; i < PLUTO_PROFILER_PC_SLOTS; i++) {
+        if (pc_slots[i].count != 0) {
+            shell_print(shell, "P %08x %u", pc_slots[i].pc, pc_slots[i].count);
+        }
+    }
+    paused = false;
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "prof". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_prof,
+                               SHELL_CMD(start, NULL, "Start sampling, optional period <us>.", cmd_prof_start),
+                               SHELL_CMD(stop, NULL, "Stop sampling.", cmd_prof_stop),
+                               SHELL_CMD(reset, NULL, "Clear the profile.", cmd_prof_reset),
+                               SHELL_CMD(dump, NULL, "Dump the profile.", cmd_prof_dump),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "prof" */
+SHELL_CMD_REGISTER(prof, &sub_prof, "Sampling CPU profiler.", NULL);
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_safety.c
+ * @brief Safety Supervisor Module
+ *
+ * All conditions which stop the motors are reported to this module with a reason
+ * code, the last fault is kept for the host to read back.
+ *
+ * Producers of safety relevant values (proximity distances, ADC inputs, motor PWM
+ * writes) register the 64 bit uptime timestamp (in ticks) of their latest sample as
+ * a signal. A supervisor thread checks the age of every armed signal against its
+ * configurable maximum age and raises SAFETY_FAULT_STALE_SIGNAL when a producer
+ * stops publishing, so that a stalled thread cannot leave a stale "safe" value.
+ *
+ * The age of an armed signal is counted from the newer of its last sample and the
+ * time it was armed, a signal which was just enabled is not stale right away.
+ *
+ * Each fault reason selects a stop category: faults which leave time to brake
+ * (temperature, supply voltage) use the normal braking profile, faults which
+ * indicate an obstacle or lost sensing use the emergency braking profile and the
+ * emergency button cuts the motors at once. The category per reason can be
+ * changed with "safety config-stop".
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <string.h>
+
+#include "inc/pluto_safety.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_arbiter.h"
+#include "inc/pluto_scope.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_safety, LOG_LEVEL_WRN);
+
+struct safety_signal {
+    const char *name;
+    const int64_t *timestamp;
+    int64_t armed_since;
+    uint32_t max_age_ms;
+    bool armed;
+    bool stale;
+};
+
+struct safety_fault {
+    enum safety_fault_reason reason;
+    const char *source;
+    int64_t timestamp;
+    uint32_t count;
+};
+
+static struct safety_signal signals[SAFETY_SIGNAL_COUNT] = {
+        [SAFETY_SIGNAL_PROXY_0] = {.max_age_ms = PLUTO_SAFETY_PROXY_MAX_AGE_MS},
+        [SAFETY_SIGNAL_PROXY_1] = {.max_age_ms = PLUTO_SAFETY_PROXY_MAX_AGE_MS},
+        [SAFETY_SIGNAL_PROXY_2] = {.max_age_ms = PLUTO_SAFETY_PROXY_MAX_AGE_MS},
+        [SAFETY_SIGNAL_PROXY_3] = {.max_age_ms = PLUTO_SAFETY_PROXY_MAX_AGE_MS},
+        [SAFETY_SIGNAL_ADC_0] = {.max_age_ms = PLUTO_SAFETY_ADC_MAX_AGE_MS},
+        [SAFETY_SIGNAL_ADC_1] = {.max_age_ms = PLUTO_SAFETY_ADC_MAX_AGE_MS},
+        [SAFETY_SIGNAL_ADC_2] = {.max_age_ms = PLUTO_SAFETY_ADC_MAX_AGE_MS},
+        [SAFETY_SIGNAL_ADC_3] = {.max_age_ms = PLUTO_SAFETY_ADC_MAX_AGE_MS},
+        [SAFETY_SIGNAL_MOTOR_1] = {.max_age_ms = PLUTO_SAFETY_MOTOR_MAX_AGE_MS},
+        [SAFETY_SIGNAL_MOTOR_2] = {.max_age_ms = PLUTO_SAFETY_MOTOR_MAX_AGE_MS},
+};
+
+static struct safety_fault last_fault = {.reason = SAFETY_FAULT_NONE, .source = "-"};
+
+static struct k_spinlock safety_lock;
+
+K_THREAD_STACK_DEFINE(safety_stack, PLUTO_SAFETY_THREAD_STACK_SIZE);
+static struct k_thread safety_thread_data;
+
+static enum motor_stop_category stop_categories[] = {
+        [SAFETY_FAULT_NONE] = MOTOR_STOP_CONTROLLED,
+        [SAFETY_FAULT_EM_BUTTON] = MOTOR_STOP_IMMEDIATE,
+        [SAFETY_FAULT_PROXIMITY] = MOTOR_STOP_QUICK,
+        [SAFETY_FAULT_SENSOR_ERROR] = MOTOR_STOP_QUICK,
+        [SAFETY_FAULT_ADC_THRESHOLD] = MOTOR_STOP_CONTROLLED,
+        [SAFETY_FAULT_OVERTEMPERATURE] = MOTOR_STOP_CONTROLLED,
+        [SAFETY_FAULT_STALE_SIGNAL] = MOTOR_STOP_QUICK,
+        [SAFETY_FAULT_STALL] = MOTOR_STOP_QUICK,
+        [SAFETY_FAULT_BATTERY_LOW] = MOTOR_STOP_CONTROLLED,
+};
+
+static const char *const stop_category_names[] = {
+        [MOTOR_STOP_CONTROLLED] = "c",
+        [MOTOR_STOP_QUICK] = "q",
+        [MOTOR_STOP_IMMEDIATE] = "i",
+};
+
+static const char *const fault_names[] = {
+        [SAFETY_FAULT_NONE] = "none",
+        [SAFETY_FAULT_EM_BUTTON] = "em_button",
+        [SAFETY_FAULT_PROXIMITY] = "proximity",
+        [SAFETY_FAULT_SENSOR_ERROR] = "sensor_error",
+        [SAFETY_FAULT_ADC_THRESHOLD] = "adc_threshold",
+        [SAFETY_FAULT_OVERTEMPERATURE] = "overtemperature",
+        [SAFETY_FAULT_STALE_SIGNAL] = "stale_signal",
+        [SAFETY_FAULT_STALL] = "stall",
+        [SAFETY_FAULT_BATTERY_LOW] = "battery_low",
+};
+
+const char *safety_fault_to_string(enum safety_fault_reason reason) {
+    if ((size_t)reason >= ARRAY_SIZE(fault_names)) {
+        return "unknown";
+    }
+    return fault_names[reason];
+}
+
+/**
+ * @brief Read a 64 bit timestamp which may be written concurrently.
+ *
+ * The Cortex-M0+ stores 64 bit values with two word writes, the timestamp is read
+ * until two consecutive reads agree so that a torn value is never returned.
+ *
+ * @param timestamp Timestamp to read.
+ * @return Timestamp in ticks.
+ */
+int64_t safety_read_timestamp(const int64_t *timestamp) {
+    volatile const int64_t *ts = timestamp;
+    int64_t value;
+    do {
+        value = *ts;
+    } while (value != *ts);
+    return value;
+}
+
+/* Deferred part of a fault, submitted before the motor stop work so the lease comes first */
+static void safety_fault_work_handler(struct k_work *work) {
+    // Hold the motors at 0 for a while, other sources have to command again
+    arbiter_acquire(ARBITER_SOURCE_SAFETY, PLUTO_ARBITER_SAFETY_LEASE_MS);
+    k_spinlock_key_t key = k_spin_lock(&safety_lock);
+    struct safety_fault fault = last_fault;
+    k_spin_unlock(&safety_lock, key);
+    LOG_WRN("Fault %s from %s, stopping motors.", safety_fault_to_string(fault.reason), fault.source);
+}
+
+K_WORK_DEFINE(safety_fault_work, safety_fault_work_handler);
+
+/**
+ * @brief Stop the motors and record the reason.
+ *
+ * The motors are stopped with the stop category configured for the reason.
+ * Safe to call from ISRs: the fault is recorded under a spinlock and the stop is
+ * started lock-free by motordriver_stop_motors(). The safety lease, the motion events
+ * and the logging follow in the system workqueue.
+ *
+ * @param reason Reason code of the fault.
+ * @param source Name of the sensor or input which caused the fault.
+ */
+void safety_raise_fault(enum safety_fault_reason reason, const char *source) {
+    k_spinlock_key_t key = k_spin_lock(&safety_lock);
+    last_fault.reason = reason;
+    last_fault.source = source;
+    last_fault.timestamp = k_uptime_ticks();
+    last_fault.count++;
+    k_spin_unlock(&safety_lock, key);
+    scope_trigger_external(source);
+    k_work_submit(&safety_fault_work);
+    motordriver_stop_motors(stop_categories[reason]);
+}
+
+enum safety_fault_reason safety_get_last_fault(void) {
+    return last_fault.reason;
+}
+
+/**
+ * @brief Get the number of faults raised since the last clear.
+ *
+ * Long running operations compare the count to notice faults raised meanwhile.
+ */
+uint32_t safety_get_fault_count(void) {
+    return last_fault.count;
+}
+
+/**
+ * @brief Register the timestamp of a signal for supervision.
+ *
+ * @param id Signal ID.
+ * @param name Name of the signal, reported as source of a stale signal fault.
+ * @param timestamp Timestamp in ticks of the latest sample, 0 if no sample yet.
+ */
+void safety_signal_register(enum safety_signal_id id, const char *name, const int64_t *timestamp) {
+    signals[id].name = name;
+    signals[id].timestamp = timestamp;
+}
+
+/**
+ * @brief Enable or disable supervision of a signal.
+ *
+ * @param id Signal ID.
+ * @param armed True if the signal must not get stale.
+ */
+void safety_signal_arm(enum safety_signal_id id, bool armed) {
+    k_spinlock_key_t key = k_spin_lock(&safety_lock);
+    if (armed && !signals[id].armed) {
+        signals[id].armed_since = k_uptime_ticks();
+    }
+    signals[id].armed = armed;
+    signals[id].stale = false;
+    k_spin_unlock(&safety_lock, key);
+}
+
+/**
+ * @brief Get the age of the latest sample of a signal.
+ *
+ * @param id Signal ID.
+ * @return Age in ms, -1 if the signal has no sample yet.
+ */
+int64_t safety_signal_get_age_ms(enum safety_signal_id id) {
+    if (signals[id].timestamp == NULL) {
+        return -1;
+    }
+    int64_t timestamp = safety_read_timestamp(signals[id].timestamp);
+    if (timestamp == 0) {
+        return -1;
+    }
+    return k_ticks_to_ms_floor64(k_uptime_ticks() - timestamp);
+}
+
+static void safety_check_signal(struct safety_signal *signal, int64_t now) {
+    if (!signal->armed || signal->timestamp == NULL) {
+        return;
+    }
+    int64_t timestamp = MAX(safety_read_timestamp(signal->timestamp), signal->armed_since);
+    bool stale = k_ticks_to_ms_floor64(now - timestamp) > signal->max_age_ms;
+    if (stale && !signal->stale) {
+        safety_raise_fault(SAFETY_FAULT_STALE_SIGNAL, signal->name);
+    }
+    signal->stale = stale;
+}
+
+static void safety_thread(void *arg1, void *arg2, void *arg3) {
+    while (1) {
+        int64_t now = k_uptime_ticks();
+        for (int i = 0; i < SAFETY_SIGNAL_COUNT; i++) {
+            safety_check_signal(&signals[i], now);
+        }
+        k_msleep(PLUTO_SAFETY_THREAD_SLEEP_TIME_MS);
+    }
+}
+
+void safety_init(void) {
+    k_tid_t tid = k_thread_create(&safety_thread_data, safety_stack,
+                                  K_THREAD_STACK_SIZEOF(safety_stack),
+                                  safety_thread, NULL, NULL, NULL,
+                                  PLUTO_SAFETY_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, "safety");
+}
+
+static int get_signal_by_name(const char *name) {
+    for (int i = 0; i < SAFETY_SIGNAL_COUNT; i++) {
+        if (signals[i].name != NULL && strcmp(signals[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+static int cmd_safety_get_fault(const struct shell *shell, size_t argc, char **argv) {
+    k_spinlock_key_t key = k_spin_lock(&safety_lock);
+    struct safety_fault fault = last_fault;
+    k_spin_unlock(&safety_lock, key);
+    if (fault.reason == SAFETY_FAULT_NONE) {
+        shell_print(shell, "%s", safety_fault_to_string(fault.reason));
+        return 0;
+    }
+    shell_print(shell, "%s %s %lld %u", safety_fault_to_string(fault.reason), fault.source,
+                k_ticks_to_ms_floor64(k_uptime_ticks() - fault.timestamp), fault.count);
+    return 0;
+}
+
+static int cmd_safety_clear_fault(const struct shell *shell, size_t argc, char **argv) {
+    k_spinlock_key_t key = k_spin_lock(&safety_lock);
+    last_fault.reason = SAFETY_FAULT_NONE;
+    last_fault.source = "-";
+    last_fault.count = 0;
+    k_spin_unlock(&safety_lock, key);
+    shell_print(shell, "%s", safety_fault_to_string(SAFETY_FAULT_NONE));
+    return 0;
+}
+
+/* Prints "<name> <armed> <age_ms> <max_age_ms>" per signal, age -1 if no sample yet. */
+static int cmd_safety_list_signals(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = 0; i < SAFETY_SIGNAL_COUNT; i++) {
+        if (signals[i].name == NULL) {
+            continue;
+        }
+        shell_print(shell, "%s %d %lld %u", signals[i].name, signals[i].armed,
+                    safety_signal_get_age_ms(i), signals[i].max_age_ms);
+    }
+    return 0;
+}
+
+static int cmd_safety_config_max_age(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: safety config-max-age <signal> <ms>");
+        return -EINVAL;
+    }
+    int id = get_signal_by_name(argv[1]);
+    if (id < 0) {
+        shell_error(shell, "Unknown signal: %s", argv[1]);
+        return -EINVAL;
+    }
+    uint32_t max_age_ms = simple_strtou32(argv[2]);
+    if (max_age_ms == 0) {
+        shell_error(shell, "Invalid maximum age.");
+        return -EINVAL;
+    }
+    signals[id].max_age_ms = max_age_ms;
+    shell_print(shell, "%u", max_age_ms);
+    return 0;
+}
+
+static int get_index_by_name(const char *const *names, size_t count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+static int cmd_safety_get_stop(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = SAFETY_FAULT_NONE + 1; i < ARRAY_SIZE(stop_categories); i++) {
+        shell_print(shell, "%s %s", fault_names[i], stop_category_names[stop_categories[i]]);
+    }
+    return 0;
+}
+
+static int cmd_safety_config_stop(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: safety config-stop <reason> <c|q|i>");
+        return -EINVAL;
+    }
+    int reason = get_index_by_name(fault_names, ARRAY_SIZE(fault_names), argv[1]);
+    if (reason <= SAFETY_FAULT_NONE) {
+        shell_error(shell, "Unknown reason: %s", argv[1]);
+        return -EINVAL;
+    }
+    int category = get_index_by_name(stop_category_names, ARRAY_SIZE(stop_category_names), argv[2]);
+    if (category < 0) {
+        shell_error(shell, "Unknown stop category: %s", argv[2]);
+        return -EINVAL;
+    }
+    stop_categories[reason] = category;
+    shell_print(shell, "%s", stop_category_names[category]);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "safety". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_safety,
+                               SHELL_CMD(get-fault, NULL, "Get last fault: <reason> <source> <age_ms> <count>.",
+                                         cmd_safety_get_fault),
+                               SHELL_CMD(clear-fault, NULL, "Clear last fault.", cmd_safety_clear_fault),
+                               SHELL_CMD(list-signals, NULL, "List signals: <name> <armed> <age_ms> <max_age_ms>.",
+                                         cmd_safety_list_signals),
+                               SHELL_CMD(config-max-age, NULL, "Set maximum age <signal> <ms>.",
+                                         cmd_safety_config_max_age),
+                               SHELL_CMD(get-stop, NULL, "List stop category per fault reason.",
+                                         cmd_safety_get_stop),
+                               SHELL_CMD(config-stop, NULL,
+                                         "Set stop category for <reason> to controlled (c), quick (q) "
+                                         "or immediate (i).",
+                                         cmd_safety_config_stop),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "safety" */
+SHELL_CMD_REGISTER(safety, &sub_safety, "Safety supervisor.", NULL);
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_scope.c
+ * @brief Triggered Waveform Capture Module
+ *
+ * Captures one ADS1115 input around an event, like the trigger of an oscilloscope.
+ * While armed the ADS1115 converts continuously at 860 SPS and the ADC thread reads
+ * every PLUTO_SCOPE_PERIOD_US into a circular buffer. A trigger is accepted once the
+ * pre-trigger part of the buffer is filled. The buffer then fills up with the
+ * post-trigger samples and is frozen until it is dumped or the scope is armed again.
+ *
+ * Triggers:
+ * - level: the sample is at or above (rising) / at or below (falling) the threshold,
+ * - edge: the sample crosses the threshold in the given direction,
+ * - ext: a safety fault is raised (e-stop, stall, overtemperature, ...) or
+ *   "scope force" is called. Events before the pre-trigger part is filled are kept.
+ *
+ * Per sample the armed scope costs one compare and one atomic read, the buffer is
+ * statically allocated. Each sample is stored with the cycle counter at the end of
+ * its read, so gaps and jitter of the sampling show in the dump.
+ *
+ * While capturing, the ADC thread samples no other input, so arming is refused while
+ * an input threshold is enabled or an input feeds the stall detection or the battery
+ * monitor, and those cannot be configured while the scope is armed.
+ *
+ * "scope dump" prints the frozen buffer oldest first:
+ * ```
+ * # pluto-scope <version> <input> <lsb_nV> <cycles_per_s> <samples> <pretrigger> <trigger_index> <source>
+ * D <hex records>
+ * ```
+ * Each record is 6 bytes little endian: the uint32 cycle counter and the int16 raw
+ * sample, PLUTO_SCOPE_DUMP_RECORDS_PER_LINE records per line. scripts/pluto_scope.py
+ * converts a dump into CSV.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inc/pluto_scope.h"
+#include "inc/pluto_ads1115.h"
+#include "inc/pluto_stall.h"
+#include "inc/pluto_battery.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_scope, LOG_LEVEL_WRN);
+
+#define PLUTO_SCOPE_DUMP_VERSION 1
+#define SCOPE_RECORD_SIZE 6
+
+enum scope_state {
+    SCOPE_IDLE,
+    SCOPE_ARMED,
+    SCOPE_TRIGGERED,
+    SCOPE_FROZEN,
+    SCOPE_ERROR,
+};
+
+enum scope_trigger_mode {
+    SCOPE_TRIGGER_LEVEL,
+    SCOPE_TRIGGER_EDGE,
+    SCOPE_TRIGGER_EXT,
+};
+
+struct scope_trigger {
+    enum scope_trigger_mode mode;
+    bool rising;
+    int16_t level_raw;
+    int32_t level_mv;
+};
+
+static int16_t samples[PLUTO_SCOPE_SAMPLES];
+static uint32_t cycles[PLUTO_SCOPE_SAMPLES];
+static uint32_t head;
+static uint32_t filled;
+static uint32_t trigger_pos;
+static uint32_t pretrigger;
+static uint8_t input;
+static uint32_t lsb_nv;
+static const char *trigger_source = "-";
+static struct scope_trigger trigger;
+
+static atomic_t state = ATOMIC_INIT(SCOPE_IDLE);
+static atomic_t external;
+
+static const char *scope_state_to_string(enum scope_state value) {
+    switch (value) {
+        case SCOPE_IDLE:
+            return "idle";
+        case SCOPE_ARMED:
+            return "armed";
+        case SCOPE_TRIGGERED:
+            return "triggered";
+        case SCOPE_FROZEN:
+            return "frozen";
+        case SCOPE_ERROR:
+            return "error";
+        default:
+            return "unknown";
+    }
+}
+
+static inline bool scope_check_trigger(int16_t prev, int16_t raw) {
+    switch (trigger.mode) {
+        case SCOPE_TRIGGER_LEVEL:
+            return trigger.rising ? raw >= trigger.level_raw : raw <= trigger.level_raw;
+        case SCOPE_TRIGGER_EDGE:
+            return trigger.rising ? (prev < trigger.level_raw && raw >= trigger.level_raw)
+                                  : (prev > trigger.level_raw && raw <= trigger.level_raw);
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Trigger an armed scope from an external event.
+ *
+ * Safe to call from ISRs, does nothing if the scope is not armed.
+ *
+ * @param source Name of the event, shown in the dump.
+ */
+void scope_trigger_external(const char *source) {
+    if (atomic_get(&state) == SCOPE_ARMED && atomic_cas(&external, 0, 1)) {
+        trigger_source = source;
+    }
+}
+
+/**
+ * @brief Check whether the scope is armed or filling, the ADC thread then captures.
+ */
+bool scope_is_active(void) {
+    atomic_val_t value = atomic_get(&state);
+    return value == SCOPE_ARMED || value == SCOPE_TRIGGERED;
+}
+
+/**
+ * @brief Capture until the buffer is frozen or the scope is stopped.
+ *
+ * Runs in the ADC thread, which owns the ADS1115. The conversion settings of the
+ * ADC are restored afterwards.
+ *
+ * @param ads ADS1115 to capture from.
+ */
+void scope_capture(ADS1115 *ads) {
+    static const adc_Ch_t channels[] = { CH_0, CH_1, CH_2, CH_3 };
+    adsCONV_t mode = ADS1115_getCONV(ads);
+    adsSPS_t sps = ADS1115_getSPS(ads);
+    ADS1115_setCONV(ads, CONT_CONV);
+    ADS1115_setSPS(ads, SPS_860);
+    lsb_nv = (uint32_t)(ADS1115_getLsbMultiplier(ads) * 1e9f);
+    trigger.level_raw = (int16_t)CLAMP((int64_t)trigger.level_mv * 1000000 / lsb_nv, INT16_MIN, INT16_MAX);
+
+    struct k_timer timer;
+    k_timer_init(&timer, NULL, NULL);
+    k_timer_start(&timer, K_USEC(PLUTO_SCOPE_PERIOD_US), K_USEC(PLUTO_SCOPE_PERIOD_US));
+    uint32_t post_left = 0;
+    int16_t prev = 0;
+    while (scope_is_active()) {
+        k_timer_status_sync(&timer);
+        int16_t raw;
+        int ret = ADS1115_readADC_raw(ads, channels[input], &raw);
+        if (ret) {
+            LOG_ERR("Capture failed: %d", ret);
+            atomic_cas(&state, SCOPE_ARMED, SCOPE_ERROR);
+            atomic_cas(&state, SCOPE_TRIGGERED, SCOPE_ERROR);
+            break;
+        }
+        uint32_t pos = head;
+        samples[pos] = raw;
+        cycles[pos] = k_cycle_get_32();
+        head = (head + 1) % PLUTO_SCOPE_SAMPLES;
+        filled = MIN(filled + 1, PLUTO_SCOPE_SAMPLES);
+        if (atomic_get(&state) == SCOPE_ARMED) {
+            if (filled > pretrigger && (atomic_get(&external) || (filled > 1 && scope_check_trigger(prev, raw)))) {
+                if (!atomic_get(&external)) {
+                    trigger_source = "input";
+                }
+                trigger_pos = pos;
+                post_left = PLUTO_SCOPE_SAMPLES - pretrigger - 1;
+                atomic_cas(&state, SCOPE_ARMED, post_left ? SCOPE_TRIGGERED : SCOPE_FROZEN);
+            }
+        } else if (--post_left == 0) {
+            atomic_cas(&state, SCOPE_TRIGGERED, SCOPE_FROZEN);
+        }
+        prev = raw;
+    }
+    k_timer_stop(&timer);
+    ADS1115_setCONV(ads, mode);
+    ADS1115_setSPS(ads, sps);
+}
+
+static int cmd_scope_arm(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 6) {
+        shell_error(shell, "Invalid number of arguments. "
+                           "Usage: scope arm <input> <level|edge|ext> <rising|falling> <threshold_mV> <pretrigger>");
+        return -EINVAL;
+    }
+    int index = atoi(argv[1]);
+    uint32_t new_pretrigger = simple_strtou32(argv[5]);
+    if (index < 0 || index > 3 || new_pretrigger >= PLUTO_SCOPE_SAMPLES) {
+        shell_error(shell, "Invalid input or pretrigger, at most %u samples.", PLUTO_SCOPE_SAMPLES - 1);
+        return -EINVAL;
+    }
+    enum scope_trigger_mode mode;
+    if (strcmp(argv[2], "level") == 0) {
+        mode = SCOPE_TRIGGER_LEVEL;
+    } else if (strcmp(argv[2], "edge") == 0) {
+        mode = SCOPE_TRIGGER_EDGE;
+    } else if (strcmp(argv[2], "ext") == 0) {
+        mode = SCOPE_TRIGGER_EXT;
+    } else {
+        shell_error(shell, "Invalid trigger, expected level, edge or ext.");
+        return -EINVAL;
+    }
+    if (scope_is_active()) {
+        shell_error(shell, "Scope is already armed.");
+        return -EBUSY;
+    }
+    if (ads1115_is_guarded()) {
+        shell_error(shell, "An input threshold is enabled, capturing would stop its supervision.");
+        return -EBUSY;
+    }
+    if (stall_uses_input(-1) || battery_uses_input(-1)) {
+        shell_error(shell, "An input is used by the stall detection or the battery, capturing would stop it.");
+        return -EBUSY;
+    }
+    input = (uint8_t)index;
+    trigger.mode = mode;
+    trigger.rising = strcmp(argv[3], "falling") != 0;
+    trigger.level_mv = atoi(argv[4]);
+    pretrigger = new_pretrigger;
+    head = 0;
+    filled = 0;
+    trigger_pos = 0;
+    trigger_source = "-";
+    atomic_clear(&external);
+    atomic_set(&state, SCOPE_ARMED);
+    ads1115_wakeup();
+    shell_print(shell, "%s", scope_state_to_string(SCOPE_ARMED));
+    return 0;
+}
+
+static int cmd_scope_force(const struct shell *shell, size_t argc, char **argv) {
+    scope_trigger_external("force");
+    shell_print(shell, "%s", scope_state_to_string(atomic_get(&state)));
+    return 0;
+}
+
+static int cmd_scope_stop(const struct shell *shell, size_t argc, char **argv) {
+    atomic_set(&state, SCOPE_IDLE);
+    shell_print(shell, "%s", scope_state_to_string(SCOPE_IDLE));
+    return 0;
+}
+
+/* Prints "<state> <filled> <source>" */
+static int cmd_scope_status(const struct shell *shell, size_t argc, char **argv) {
+    shell_print(shell, "%s %u %s", scope_state_to_string(atomic_get(&state)), filled, trigger_source);
+    return 0;
+}
+
+static int cmd_scope_dump(const struct shell *shell, size_t argc, char **argv) {
+    if (atomic_get(&state) != SCOPE_FROZEN) {
+        shell_error(shell, "Nothing captured, scope is %s.", scope_state_to_string(atomic_get(&state)));
+        return -ENODATA;
+    }
+    uint32_t start = filled < PLUTO_SCOPE_SAMPLES ? 0 : head;
+    shell_print(shell, "# pluto-scope %d %u %u %u %u %u %u %s", PLUTO_SCOPE_DUMP_VERSION, input, lsb_nv,
+                sys_clock_hw_cycles_per_sec(), filled, pretrigger,
+                (trigger_pos + PLUTO_SCOPE_SAMPLES - start) % PLUTO_SCOPE_SAMPLES, trigger_source);
+    char line[2 + 2 * SCOPE_RECORD_SIZE * PLUTO_SCOPE_DUMP_RECORDS_PER_LINE + 1];
+    size_t len = 0;
+    for (uint32_t i = 0; i < filled; i++) {
+        uint32_t pos = (start + i) % PLUTO_SCOPE_SAMPLES;
+        uint8_t record[SCOPE_RECORD_SIZE];
+        sys_put_le32(cycles[pos], record);
+        sys_put_le16((uint16_t)samples[pos], record + 4);
+        if (len == 0) {
+            line[len++] = 'D';
+            line[len++] = ' ';
+        }
+        len += bin2hex(record, sizeof(record), line + len, sizeof(line) - len);
+        if ((i + 1) % PLUTO_SCOPE_DUMP_RECORDS_PER_LINE == 0 || i + 1 == filled) {
+            shell_print(shell, "%s", line);
+            len = 0;
+        }
+    }
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "scope". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_scope,
+                               SHELL_CMD(arm, NULL,
+                                         "Arm on <input> <level|edge|ext> <rising|falling> <threshold_mV> <pretrigger>.",
+                                         cmd_scope_arm),
+                               SHELL_CMD(force, NULL, "Trigger the armed scope now.", cmd_scope_force),
+                               SHELL_CMD(stop, NULL, "Stop capturing and discard the buffer.", cmd_scope_stop),
+                               SHELL_CMD(status, NULL, "Get <state> <filled> <trigger_source>.", cmd_scope_status),
+                               SHELL_CMD(dump, NULL, "Dump the frozen capture.", cmd_scope_dump),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "scope" */
+SHELL_CMD_REGISTER(scope, &sub_scope, "Triggered waveform capture of an ADS1115 input.", NULL);
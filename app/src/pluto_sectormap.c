@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_sectormap.c
+ * @brief Proximity Sector Map Module
+ *
+ * Fuses the VL53L0X samples into a polar map of PLUTO_SECTORMAP_SECTORS sectors
+ * around the robot, sector 0 centred on the front, counting counter clockwise. Each
+ * sensor has a mounting pose (bearing and offset from the centre); from the bearing
+ * and the field of view the sectors a sensor sees are computed once, so a sample
+ * updates only those sectors. A sector keeps the nearest range with its timestamp
+ * and which sensors are under their threshold there.
+ *
+ * The map gates the motors: the motion of the robot heading into a blocked sector is
+ * taken away, everything else stays allowed. A differential drive moves along its
+ * front/rear axis only, so
+ * - a wheel driving towards a blocked cone (sectors within PLUTO_SECTORMAP_CONE_DEG of
+ *   the front or the rear) is capped to the speed of the other wheel if that one turns
+ *   the other way, else to 0. Turning in place stays possible, driving forward not.
+ * - motion away from the blocked cone is not touched, so the robot can back off.
+ * The cap applies at once and is released by 1 % speed per PLUTO_SECTORMAP_RELEASE_MS.
+ *
+ * Staleness of the sensors is watched by the safety module, blocked entries of a sensor
+ * are cleared when it leaves the proximity mode.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "inc/pluto_sectormap.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_sectormap, LOG_LEVEL_WRN);
+
+BUILD_ASSERT(PLUTO_SECTORMAP_SECTORS <= 32, "sectors are kept in a 32 bit mask");
+BUILD_ASSERT(SECTORMAP_NUM_SENSORS <= 8, "blocked sensors are kept in an 8 bit mask");
+
+#define SECTORMAP_RELEASE_TICKS (PLUTO_SECTORMAP_RELEASE_MS * USEC_PER_MSEC / PLUTO_CONTROL_PERIOD_US)
+#define SECTOR_BEARING_DEG(k) ((int32_t)((k) * 360u / PLUTO_SECTORMAP_SECTORS))
+
+static struct sectormap_pose poses[SECTORMAP_NUM_SENSORS] = {
+        PLUTO_SECTORMAP_POSE_P_0,
+        PLUTO_SECTORMAP_POSE_P_1,
+        PLUTO_SECTORMAP_POSE_P_2,
+        PLUTO_SECTORMAP_POSE_P_3,
+};
+
+static struct sectormap_sector sectors[PLUTO_SECTORMAP_SECTORS];
+static uint32_t sensor_masks[SECTORMAP_NUM_SENSORS];   // sectors seen by a sensor
+static uint32_t front_mask;
+static uint32_t rear_mask;
+static uint32_t blocked_sectors;
+static struct k_spinlock sectormap_lock;
+
+static motor_t *const motors[] = {&motor1, &motor2};
+static uint32_t gates[] = {100, 100};
+static uint32_t release_ticks;
+
+/* Angle difference wrapped to -180..179 degrees */
+static int32_t angle_diff(int32_t a, int32_t b) {
+    int32_t diff = (a - b) % 360;
+    if (diff < -180) {
+        diff += 360;
+    } else if (diff >= 180) {
+        diff -= 360;
+    }
+    return diff;
+}
+
+/* Sectors overlapping the field of view of a sensor looking to bearing_deg */
+static uint32_t sectormap_fov_mask(int32_t bearing_deg) {
+    uint32_t mask = 0;
+    for (uint32_t k = 0; k < PLUTO_SECTORMAP_SECTORS; k++) {
+        // Overlap if the centres are closer than half a sector plus half the field of view
+        uint32_t diff = abs(angle_diff(bearing_deg, SECTOR_BEARING_DEG(k)));
+        if (2u * diff * PLUTO_SECTORMAP_SECTORS < 360u + PLUTO_SECTORMAP_FOV_DEG * PLUTO_SECTORMAP_SECTORS) {
+            mask |= BIT(k);
+        }
+    }
+    return mask;
+}
+
+/* Sectors with the centre within PLUTO_SECTORMAP_CONE_DEG of a direction */
+static uint32_t sectormap_cone_mask(int32_t bearing_deg) {
+    uint32_t mask = 0;
+    for (uint32_t k = 0; k < PLUTO_SECTORMAP_SECTORS; k++) {
+        if (abs(angle_diff(bearing_deg, SECTOR_BEARING_DEG(k))) <= PLUTO_SECTORMAP_CONE_DEG) {
+            mask |= BIT(k);
+        }
+    }
+    return mask;
+}
+
+/* Recompute the blocked flag of the sectors in mask, the lock must be held */
+static void sectormap_update_blocked(uint32_t mask) {
+    for (uint32_t k = 0; k < PLUTO_SECTORMAP_SECTORS; k++) {
+        if ((mask & BIT(k)) == 0) {
+            continue;
+        }
+        if (sectors[k].blocked != 0) {
+            blocked_sectors |= BIT(k);
+        } else {
+            blocked_sectors &= ~BIT(k);
+        }
+    }
+}
+
+/**
+ * @brief Initialize the sector map from the configured mounting poses.
+ */
+void sectormap_init(void) {
+    for (int i = 0; i < SECTORMAP_NUM_SENSORS; i++) {
+        sensor_masks[i] = sectormap_fov_mask(poses[i].bearing_deg);
+    }
+    front_mask = sectormap_cone_mask(0);
+    rear_mask = sectormap_cone_mask(180);
+}
+
+/**
+ * @brief Set the mounting pose of a sensor.
+ *
+ * The entries of the sensor are removed from the map.
+ *
+ * @param sensor Index of the sensor (0 for "p_0").
+ * @param bearing_deg Direction the sensor looks to, 0 is the front, counter clockwise positive.
+ * @param offset_mm Distance of the sensor from the centre of the robot.
+ * @return 0 on success, -EINVAL for an unknown sensor.
+ */
+int sectormap_set_pose(int sensor, int16_t bearing_deg, uint16_t offset_mm) {
+    if (sensor < 0 || sensor >= SECTORMAP_NUM_SENSORS) {
+        return -EINVAL;
+    }
+    sectormap_clear_sensor(sensor);
+    k_spinlock_key_t key = k_spin_lock(&sectormap_lock);
+    poses[sensor].bearing_deg = bearing_deg;
+    poses[sensor].offset_mm = offset_mm;
+    sensor_masks[sensor] = sectormap_fov_mask(bearing_deg);
+    k_spin_unlock(&sectormap_lock, key);
+    return 0;
+}
+
+/**
+ * @brief Add a distance sample of a sensor to the map.
+ *
+ * Only the sectors seen by the sensor are touched. The range of a sector is replaced
+ * if the sample is nearer, comes from the same sensor or the range is older than
+ * PLUTO_SECTORMAP_MAX_AGE_MS.
+ *
+ * @param sensor Index of the sensor (0 for "p_0").
+ * @param distance_mm Measured distance.
+ * @param blocked True if the distance is under the threshold of the sensor.
+ */
+void sectormap_add_sample(int sensor, uint32_t distance_mm, bool blocked) {
+    if (sensor < 0 || sensor >= SECTORMAP_NUM_SENSORS) {
+        return;
+    }
+    int64_t now = k_uptime_ticks();
+    k_spinlock_key_t key = k_spin_lock(&sectormap_lock);
+    uint32_t range_mm = distance_mm + poses[sensor].offset_mm;
+    uint32_t mask = sensor_masks[sensor];
+    for (uint32_t k = 0; k < PLUTO_SECTORMAP_SECTORS; k++) {
+        if ((mask & BIT(k)) == 0) {
+            continue;
+        }
+        struct sectormap_sector *sector = &sectors[k];
+        if (sector->timestamp == 0 || sector->sensor == sensor || range_mm <= sector->range_mm ||
+            k_ticks_to_ms_floor64(now - sector->timestamp) > PLUTO_SECTORMAP_MAX_AGE_MS) {
+            sector->range_mm = range_mm;
+            sector->timestamp = now;
+            sector->sensor = sensor;
+        }
+        WRITE_BIT(sector->blocked, sensor, blocked);
+    }
+    sectormap_update_blocked(mask);
+    k_spin_unlock(&sectormap_lock, key);
+}
+
+/**
+ * @brief Remove the blocked state of a sensor from the map.
+ *
+ * @param sensor Index of the sensor (0 for "p_0").
+ */
+void sectormap_clear_sensor(int sensor) {
+    if (sensor < 0 || sensor >= SECTORMAP_NUM_SENSORS) {
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&sectormap_lock);
+    uint32_t mask = sensor_masks[sensor];
+    for (uint32_t k = 0; k < PLUTO_SECTORMAP_SECTORS; k++) {
+        if ((mask & BIT(k)) != 0) {
+            WRITE_BIT(sectors[k].blocked, sensor, false);
+        }
+    }
+    sectormap_update_blocked(mask);
+    k_spin_unlock(&sectormap_lock, key);
+}
+
+/**
+ * @brief Get the blocked sectors, bit k is set if sector k is blocked.
+ */
+uint32_t sectormap_get_blocked(void) {
+    return blocked_sectors;
+}
+
+/**
+ * @brief Get a copy of a sector.
+ *
+ * @param index Index of the sector, 0 is the front.
+ * @param sector Copy of the sector.
+ * @return 0 on success, -EINVAL for an unknown sector.
+ */
+int sectormap_get_sector(int index, struct sectormap_sector *sector) {
+    if (index < 0 || index >= PLUTO_SECTORMAP_SECTORS) {
+        return -EINVAL;
+    }
+    k_spinlock_key_t key = k_spin_lock(&sectormap_lock);
+    *sector = sectors[index];
+    k_spin_unlock(&sectormap_lock, key);
+    return 0;
+}
+
+/* Largest output speed of a motor for the blocked sectors */
+static uint32_t sectormap_gate_speed(const motor_t *motor, const motor_t *other, uint32_t blocked) {
+    bool forward = motor->direction == PLUTO_MOVE_FORWARD_DIR;
+    if (motor->speed == 0 || (blocked & (forward ? front_mask : rear_mask)) == 0) {
+        return 100;
+    }
+    // Only the part of the motion into the blocked cone is taken away
+    bool other_forward = other->direction == PLUTO_MOVE_FORWARD_DIR;
+    return (other_forward != forward) ? other->speed : 0;
+}
+
+/**
+ * @brief Gate the motors by the blocked sectors, called once per control tick.
+ */
+void sectormap_update(void) {
+    uint32_t blocked = blocked_sectors;
+    bool release = ++release_ticks >= SECTORMAP_RELEASE_TICKS;
+    if (release) {
+        release_ticks = 0;
+    }
+    for (int i = 0; i < ARRAY_SIZE(motors); i++) {
+        uint32_t cap = sectormap_gate_speed(motors[i], motors[1 - i], blocked);
+        if (cap < gates[i]) {
+            gates[i] = cap;
+        } else if (cap > gates[i] && release) {
+            gates[i]++;
+        }
+        // A busy motor is updated on the next tick
+        motordriver_set_gate(motors[i], gates[i]);
+    }
+}
+
+/* Prints "<sector> <bearing_deg> <range_mm> <age_ms> <sensor> <blocked_sensors>" per sector */
+static int cmd_sectormap_get(const struct shell *shell, size_t argc, char **argv) {
+    int64_t now = k_uptime_ticks();
+    for (int k = 0; k < PLUTO_SECTORMAP_SECTORS; k++) {
+        struct sectormap_sector sector;
+        sectormap_get_sector(k, &sector);
+        int64_t age_ms = sector.timestamp ? k_ticks_to_ms_floor64(now - sector.timestamp) : -1;
+        shell_print(shell, "%d %d %u %lld %u 0x%02x", k, SECTOR_BEARING_DEG(k), sector.range_mm, age_ms,
+                    sector.sensor, sector.blocked);
+    }
+    return 0;
+}
+
+/* Prints "<blocked_sectors> <motor1_gate> <motor2_gate>" */
+static int cmd_sectormap_get_gate(const struct shell *shell, size_t argc, char **argv) {
+    shell_print(shell, "0x%02x %u %u", blocked_sectors, motor1.gate_speed, motor2.gate_speed);
+    return 0;
+}
+
+static int cmd_sectormap_config_pose(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 4) {
+        shell_error(shell, "Invalid number of arguments. Usage: sectormap config-pose <sensor> <bearing_deg> <offset_mm>");
+        return -EINVAL;
+    }
+    int sensor = atoi(argv[1]);
+    int bearing_deg = atoi(argv[2]);
+    uint16_t offset_mm = simple_strtou16(argv[3]);
+    if (bearing_deg < -180 || bearing_deg > 360 || sectormap_set_pose(sensor, bearing_deg, offset_mm) != 0) {
+        shell_error(shell, "Invalid sensor or bearing.");
+        return -EINVAL;
+    }
+    shell_print(shell, "%d %d %u 0x%02x", sensor, bearing_deg, offset_mm, sensor_masks[sensor]);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "sectormap". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_sectormap,
+                               SHELL_CMD(get, NULL,
+                                         "Get <sector> <bearing_deg> <range_mm> <age_ms> <sensor> <blocked_sensors> per sector.",
+                                         cmd_sectormap_get),
+                               SHELL_CMD(get-gate, NULL, "Get <blocked_sectors> <motor1_gate> <motor2_gate>.",
+                                         cmd_sectormap_get_gate),
+                               SHELL_CMD(config-pose, NULL,
+                                         "Set mounting pose of sensor <0..3> to <bearing_deg> <offset_mm>.",
+                                         cmd_sectormap_config_pose),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "sectormap" */
+SHELL_CMD_REGISTER(sectormap, &sub_sectormap, "Proximity sector map and motor gating.", NULL);
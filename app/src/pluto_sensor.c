@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_sensor.c
+ * @brief Sensor Channel and Sampling Scheduler Module
+ *
+ * Every measured value of the VL53L0X, ADS1115 and MCP9808 sensors is a channel with
+ * the name of its input ("p_0", "a_0", "t_0", ...). A reading of a channel is an
+ * integer value in the unit of the channel, the timestamp of the sample and its
+ * quality, whatever device is behind it.
+ *
+ * One scheduler thread owns the sampling periods and deadlines of all channels. At
+ * the deadline of a channel it requests a sample from the device; the device threads
+ * stay the executors of their bus transfers and only sample on a request:
+ * - VL53L0X: the lane of the sensor ranges it on its next sweep.
+ * - ADS1115: the ADC thread converts the requested inputs. While sampling is
+ *   synchronized to the control tick (ads1115 config-sync), the tick triggers the
+ *   conversions and the requests only check the deadlines.
+ * - MCP9808: the monitoring thread reads both sensors. It is still woken by the
+ *   ALERT outputs as well.
+ * The bus load therefore follows from the configured periods. A period is at most the
+ * shortest max sample age of the consumers of the channel (safety supervision, stall
+ * current, battery) less PLUTO_SENSOR_AGE_MARGIN_MS for the latency of a sample. A channel without a new
+ * sample at its next deadline missed it; the misses are counted and a reading older
+ * than its period plus PLUTO_SENSOR_SLACK_MS is reported as stale. A switched off
+ * VL53L0X or a disabled ADS1115 input misses every deadline.
+ *
+ * "sensor list" prints per channel:
+ * ```
+ * <name> <unit> <period_ms> <misses>
+ * ```
+ * followed by "dropped <count>", the subscription lines dropped because the low
+ * priority publisher thread fell behind; the scheduler never waits for the shell.
+ * "sensor get <name>" and each line of "sensor subscribe <name>" print:
+ * ```
+ * <name> <value> <unit> <quality> <age_ms>
+ * ```
+ * An age of -1 means that there is no sample yet.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <string.h>
+
+#include "inc/pluto_sensor.h"
+#include "inc/pluto_vl53l0x.h"
+#include "inc/pluto_ads1115.h"
+#include "inc/pluto_mcp9808.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_sensor, LOG_LEVEL_WRN);
+
+/* How a device is read and asked for a new sample */
+struct sensor_device_api {
+    enum sensor_unit unit;
+    void (*read)(int index, struct sensor_reading *reading);
+    void (*request)(int index);
+};
+
+struct sensor_chan {
+    const char *name;
+    enum sensor_device device;
+    int index;
+    uint32_t period_ms;
+    uint32_t max_period_ms;         // Longest period the max sample age of every consumer allows
+    int64_t deadline_ms;            // Uptime of the next request
+    int64_t requested_timestamp;    // Timestamp of the reading when the last request was sent
+    bool is_requested;
+    uint32_t misses;                // Deadlines without a new sample since the previous one
+    const struct shell *subscriber;
+};
+
+#define SENSOR_CHAN(_name, _device, _index, _period_ms, _max_period_ms) \
+    { .name = _name, .device = _device, .index = _index, .period_ms = _period_ms, .max_period_ms = _max_period_ms }
+
+/*
+ * The proximity channels feed the safety supervision and the sector map, the analog
+ * channels can feed the input thresholds, the stall current and the battery monitor.
+ * Their periods are limited by the shortest max age of those consumers, whether a
+ * consumer is configured or not, so a later configuration cannot make them stale.
+ */
+static struct sensor_chan channels[] = {
+        SENSOR_CHAN("p_0", SENSOR_DEVICE_VL53L0X, 0, PLUTO_SENSOR_PROXY_PERIOD_MS, PLUTO_SENSOR_PROXY_MAX_PERIOD_MS),
+        SENSOR_CHAN("p_1", SENSOR_DEVICE_VL53L0X, 1, PLUTO_SENSOR_PROXY_PERIOD_MS, PLUTO_SENSOR_PROXY_MAX_PERIOD_MS),
+        SENSOR_CHAN("p_2", SENSOR_DEVICE_VL53L0X, 2, PLUTO_SENSOR_PROXY_PERIOD_MS, PLUTO_SENSOR_PROXY_MAX_PERIOD_MS),
+        SENSOR_CHAN("p_3", SENSOR_DEVICE_VL53L0X, 3, PLUTO_SENSOR_PROXY_PERIOD_MS, PLUTO_SENSOR_PROXY_MAX_PERIOD_MS),
+        SENSOR_CHAN("a_0", SENSOR_DEVICE_ADS1115, 0, PLUTO_SENSOR_ADC_PERIOD_MS, PLUTO_SENSOR_ADC_MAX_PERIOD_MS),
+        SENSOR_CHAN("a_1", SENSOR_DEVICE_ADS1115, 1, PLUTO_SENSOR_ADC_PERIOD_MS, PLUTO_SENSOR_ADC_MAX_PERIOD_MS),
+        SENSOR_CHAN("a_2", SENSOR_DEVICE_ADS1115, 2, PLUTO_SENSOR_ADC_PERIOD_MS, PLUTO_SENSOR_ADC_MAX_PERIOD_MS),
+        SENSOR_CHAN("a_3", SENSOR_DEVICE_ADS1115, 3, PLUTO_SENSOR_ADC_PERIOD_MS, PLUTO_SENSOR_ADC_MAX_PERIOD_MS),
+        SENSOR_CHAN("t_0", SENSOR_DEVICE_MCP9808, 0, PLUTO_SENSOR_TEMP_PERIOD_MS, PLUTO_SENSOR_TEMP_MAX_PERIOD_MS),
+        SENSOR_CHAN("t_1", SENSOR_DEVICE_MCP9808, 1, PLUTO_SENSOR_TEMP_PERIOD_MS, PLUTO_SENSOR_TEMP_MAX_PERIOD_MS),
+};
+
+BUILD_ASSERT(PLUTO_SENSOR_PROXY_PERIOD_MS <= PLUTO_SENSOR_PROXY_MAX_PERIOD_MS,
+             "PLUTO_SENSOR_PROXY_PERIOD_MS exceeds the max age of the proximity supervision");
+BUILD_ASSERT(PLUTO_SENSOR_ADC_PERIOD_MS <= PLUTO_SENSOR_ADC_MAX_PERIOD_MS,
+             "PLUTO_SENSOR_ADC_PERIOD_MS exceeds the max age of an analog consumer");
+BUILD_ASSERT(PLUTO_SENSOR_THREAD_PRIORITY < PLUTO_VL53L0X_THREAD_PRIORITY &&
+             PLUTO_SENSOR_THREAD_PRIORITY < PLUTO_ADS1115_THREAD_PRIORITY &&
+             PLUTO_SENSOR_THREAD_PRIORITY < PLUTO_MCP9808_THREAD_PRIORITY,
+             "The sensor scheduler must run above the sensor threads it releases");
+
+#define SENSOR_NUM_CHANNELS ARRAY_SIZE(channels)
+
+/* Reading of a subscribed channel, served by the scheduler and printed by the publisher */
+struct sensor_publication {
+    const struct shell *shell;
+    int channel;
+    struct sensor_reading reading;
+    int64_t age_ms;
+};
+
+static struct k_spinlock sensor_lock;
+static uint32_t publish_drops;      // Publications dropped because the queue was full
+
+K_MSGQ_DEFINE(sensor_publish_msgq, sizeof(struct sensor_publication), PLUTO_SENSOR_PUBLISH_QUEUE_SIZE, 4);
+
+static struct k_thread sensor_thread_data;
+K_THREAD_STACK_DEFINE(sensor_stack_area, PLUTO_SENSOR_THREAD_STACK_SIZE);
+
+/* Given when a period changes, so the scheduler recomputes its next deadline */
+K_SEM_DEFINE(sensor_sched_sem, 0, 1);
+
+static void sensor_read_vl53l0x(int index, struct sensor_reading *reading) {
+    struct vl53l0x_sample sample;
+    vl53l0x_get_sample(index, &sample);
+    reading->value = (int32_t)sample.distance_mm;
+    reading->timestamp = sample.timestamp;
+    reading->quality = sample.is_valid ? SENSOR_QUALITY_OK : SENSOR_QUALITY_INVALID;
+}
+
+static void sensor_read_ads1115(int index, struct sensor_reading *reading) {
+    double voltage;
+    ads1115_get_input(index, &voltage, &reading->timestamp);
+    reading->value = (int32_t)(voltage * 1000);
+    reading->quality = SENSOR_QUALITY_OK;
+}
+
+static void sensor_read_mcp9808(int index, struct sensor_reading *reading) {
+    int ret = mcp9808_get_sample(index, &reading->value, &reading->timestamp);
+    reading->quality = ret ? SENSOR_QUALITY_ERROR : SENSOR_QUALITY_OK;
+}
+
+static const struct sensor_device_api devices[] = {
+        [SENSOR_DEVICE_VL53L0X] = { SENSOR_UNIT_MM, sensor_read_vl53l0x, vl53l0x_request },
+        [SENSOR_DEVICE_ADS1115] = { SENSOR_UNIT_MV, sensor_read_ads1115, ads1115_request },
+        [SENSOR_DEVICE_MCP9808] = { SENSOR_UNIT_MC, sensor_read_mcp9808, mcp9808_request },
+};
+
+const char *sensor_unit_to_string(enum sensor_unit unit) {
+    switch (unit) {
+        case SENSOR_UNIT_MM:
+            return "mm";
+        case SENSOR_UNIT_MV:
+            return "mV";
+        case SENSOR_UNIT_MC:
+            return "mC";
+        default:
+            return "unknown";
+    }
+}
+
+const char *sensor_quality_to_string(enum sensor_quality quality) {
+    switch (quality) {
+        case SENSOR_QUALITY_OK:
+            return "ok";
+        case SENSOR_QUALITY_INVALID:
+            return "invalid";
+        case SENSOR_QUALITY_STALE:
+            return "stale";
+        case SENSOR_QUALITY_ERROR:
+            return "error";
+        case SENSOR_QUALITY_NONE:
+            return "none";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Find a channel by its name.
+ *
+ * @param name Name of the channel (e.g., "p_0").
+ * @return Index of the channel, -EINVAL for an unknown name.
+ */
+int sensor_find(const char *name) {
+    for (int i = 0; i < SENSOR_NUM_CHANNELS; i++) {
+        if (strcmp(name, channels[i].name) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+/**
+ * @brief Get the latest reading of a channel.
+ *
+ * @param channel Index of the channel, see sensor_find().
+ * @param reading Latest reading.
+ * @return 0 on success, -EINVAL for an unknown channel.
+ */
+int sensor_get(int channel, struct sensor_reading *reading) {
+    if (channel < 0 || channel >= SENSOR_NUM_CHANNELS) {
+        return -EINVAL;
+    }
+    const struct sensor_chan *chan = &channels[channel];
+    const struct sensor_device_api *device = &devices[chan->device];
+    reading->unit = device->unit;
+    device->read(chan->index, reading);
+    if (reading->timestamp == 0) {
+        reading->quality = SENSOR_QUALITY_NONE;
+    } else if (reading->quality < SENSOR_QUALITY_STALE &&
+               k_ticks_to_ms_floor64(k_uptime_ticks() - reading->timestamp) >
+               chan->period_ms + PLUTO_SENSOR_SLACK_MS) {
+        reading->quality = SENSOR_QUALITY_STALE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the sampling period of the channel of a device input.
+ *
+ * @param device Device of the channel.
+ * @param index Index of the input at the device.
+ * @return Period in milliseconds, 0 if the input has no channel.
+ */
+uint32_t sensor_get_period_ms(enum sensor_device device, int index) {
+    for (int i = 0; i < SENSOR_NUM_CHANNELS; i++) {
+        if (channels[i].device == device && channels[i].index == index) {
+            return channels[i].period_ms;
+        }
+    }
+    return 0;
+}
+
+static int64_t sensor_age_ms(const struct sensor_reading *reading) {
+    return reading->timestamp ? k_ticks_to_ms_floor64(k_uptime_ticks() - reading->timestamp) : -1;
+}
+
+static void sensor_print_reading(const struct shell *shell, int channel, const struct sensor_reading *reading,
+                                 int64_t age_ms) {
+    shell_print(shell, "%s %d %s %s %lld", channels[channel].name, reading->value,
+                sensor_unit_to_string(reading->unit), sensor_quality_to_string(reading->quality), age_ms);
+}
+
+static void sensor_print(const struct shell *shell, int channel) {
+    struct sensor_reading reading;
+    sensor_get(channel, &reading);
+    sensor_print_reading(shell, channel, &reading, sensor_age_ms(&reading));
+}
+
+/* Count a miss if the previous request brought no new sample, publish and request the next one */
+static void sensor_service(int channel) {
+    struct sensor_chan *chan = &channels[channel];
+    struct sensor_reading reading;
+    sensor_get(channel, &reading);
+    if (chan->is_requested && reading.timestamp == chan->requested_timestamp) {
+        chan->misses++;
+    }
+    const struct shell *subscriber = chan->subscriber;
+    if (subscriber != NULL) {
+        // Printing can block on the shell, the publisher thread does it; the age is taken now
+        struct sensor_publication publication = {
+                .shell = subscriber,
+                .channel = channel,
+                .reading = reading,
+                .age_ms = sensor_age_ms(&reading),
+        };
+        if (k_msgq_put(&sensor_publish_msgq, &publication, K_NO_WAIT) != 0) {
+            publish_drops++;
+        }
+    }
+    chan->requested_timestamp = reading.timestamp;
+    chan->is_requested = true;
+    devices[chan->device].request(chan->index);
+}
+
+/**
+ * @brief Sampling scheduler thread function.
+ *
+ * Serves every channel whose deadline passed and sleeps until the earliest next
+ * deadline. The deadlines advance by whole periods, so a late pass does not shift the
+ * phase of a channel; after falling more than a period behind, the channel restarts
+ * from now instead of catching up with a burst of requests.
+ *
+ * @param unused1 Unused parameter.
+ * @param unused2 Unused parameter.
+ * @param unused3 Unused parameter.
+ */
+static void sensor_sched_thread(void *unused1, void *unused2, void *unused3) {
+    while (1) {
+        int64_t now = k_uptime_get();
+        int64_t next = INT64_MAX;
+        for (int i = 0; i < SENSOR_NUM_CHANNELS; i++) {
+            k_spinlock_key_t key = k_spin_lock(&sensor_lock);
+            struct sensor_chan *chan = &channels[i];
+            bool is_due = now >= chan->deadline_ms;
+            if (is_due) {
+                chan->deadline_ms += chan->period_ms;
+                if (chan->deadline_ms <= now) {
+                    chan->deadline_ms = now + chan->period_ms;
+                }
+            }
+            next = MIN(next, chan->deadline_ms);
+            k_spin_unlock(&sensor_lock, key);
+            if (is_due) {
+                sensor_service(i);
+            }
+        }
+        k_sem_take(&sensor_sched_sem, K_MSEC(next - now));
+    }
+}
+
+/* Prints the readings of the subscribed channels, so the scheduler never waits for the shell */
+static void sensor_publish_thread(void *unused1, void *unused2, void *unused3) {
+    struct sensor_publication publication;
+    while (1) {
+        k_msgq_get(&sensor_publish_msgq, &publication, K_FOREVER);
+        sensor_print_reading(publication.shell, publication.channel, &publication.reading, publication.age_ms);
+    }
+}
+
+K_THREAD_DEFINE(sensor_publish_tid, PLUTO_SENSOR_PUBLISH_THREAD_STACK_SIZE, sensor_publish_thread, NULL, NULL, NULL,
+                PLUTO_SENSOR_PUBLISH_THREAD_PRIORITY, 0, 0);
+
+/**
+ * @brief Start the sampling scheduler, after the sensor modules are initialized.
+ */
+void sensor_init(void) {
+    int64_t now = k_uptime_get();
+    for (int i = 0; i < SENSOR_NUM_CHANNELS; i++) {
+        channels[i].deadline_ms = now;
+    }
+    k_tid_t sensor_tid = k_thread_create(&sensor_thread_data, sensor_stack_area,
+                                         K_THREAD_STACK_SIZEOF(sensor_stack_area),
+                                         sensor_sched_thread, NULL, NULL, NULL,
+                                         PLUTO_SENSOR_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(sensor_tid, "sensor");
+    k_thread_start(sensor_tid);
+}
+
+static int sensor_parse_channel(const struct shell *shell, const char *name) {
+    int channel = sensor_find(name);
+    if (channel < 0) {
+        shell_error(shell, "sensor channel not known.");
+    }
+    return channel;
+}
+
+static int cmd_sensor_list(const struct shell *shell, size_t argc, char **argv) {
+    for (int i = 0; i < SENSOR_NUM_CHANNELS; i++) {
+        shell_print(shell, "%s %s %u %u", channels[i].name, sensor_unit_to_string(devices[channels[i].device].unit),
+                    channels[i].period_ms, channels[i].misses);
+    }
+    shell_print(shell, "dropped %u", publish_drops);
+    return 0;
+}
+
+static int cmd_sensor_get(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Usage: sensor get <name>");
+        return -EINVAL;
+    }
+    int channel = sensor_parse_channel(shell, argv[1]);
+    if (channel < 0) {
+        return channel;
+    }
+    sensor_print(shell, channel);
+    return 0;
+}
+
+static int cmd_sensor_config_period(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Usage: sensor config-period <name> <period_ms>");
+        return -EINVAL;
+    }
+    int channel = sensor_parse_channel(shell, argv[1]);
+    if (channel < 0) {
+        return channel;
+    }
+    uint32_t period_ms = simple_strtou32(argv[2]);
+    uint32_t max_period_ms = channels[channel].max_period_ms;
+    if (period_ms < PLUTO_SENSOR_MIN_PERIOD_MS || period_ms > max_period_ms) {
+        // A longer period would let the sample go stale for a supervised consumer
+        shell_error(shell, "Period must be %u to %u ms.", PLUTO_SENSOR_MIN_PERIOD_MS, max_period_ms);
+        return -EINVAL;
+    }
+    k_spinlock_key_t key = k_spin_lock(&sensor_lock);
+    channels[channel].period_ms = period_ms;
+    channels[channel].deadline_ms = k_uptime_get();
+    channels[channel].misses = 0;
+    k_spin_unlock(&sensor_lock, key);
+    k_sem_give(&sensor_sched_sem);
+    shell_print(shell, "%u", period_ms);
+    return 0;
+}
+
+static int cmd_sensor_subscribe(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3 || (strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0)) {
+        shell_error(shell, "Usage: sensor subscribe <name> <on|off>");
+        return -EINVAL;
+    }
+    int channel = sensor_parse_channel(shell, argv[1]);
+    if (channel < 0) {
+        return channel;
+    }
+    bool subscribe = strcmp(argv[2], "on") == 0;
+    channels[channel].subscriber = subscribe ? shell : NULL;
+    shell_print(shell, "%s %s", channels[channel].name, subscribe ? "on" : "off");
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "sensor". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_sensor,
+                               SHELL_CMD(list, NULL,
+                                         "List <name> <unit> <period_ms> <misses> of all channels, then the "
+                                         "dropped subscription lines.",
+                                         cmd_sensor_list),
+                               SHELL_CMD(get, NULL, "Get <name> <value> <unit> <quality> <age_ms> of channel <name>.",
+                                         cmd_sensor_get),
+                               SHELL_CMD(subscribe, NULL,
+                                         "Print the reading of channel <name> at each of its deadlines <on|off>.",
+                                         cmd_sensor_subscribe),
+                               SHELL_CMD(config-period, NULL, "Sample channel <name> every <period_ms>.",
+                                         cmd_sensor_config_period),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "sensor" */
+SHELL_CMD_REGISTER(sensor, &sub_sensor, "Readings and sampling periods of all sensor channels.", NULL);
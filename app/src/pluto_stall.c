@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_stall.c
+ * @brief Stall and Collision Detection Module
+ *
+ * Detects a motor which is driven but blocked, e.g. when the robot pushes against
+ * an obstacle the proximity sensors cannot see. A motor is suspect while its duty
+ * is at least the minimum duty and
+ * - its encoder speed is below the stall speed (only with encoder), or
+ * - its current, measured over a shunt on an ADS1115 input, is above the stall
+ *   current (only with a configured current input and a sample not older than
+ *   PLUTO_STALL_CURRENT_MAX_AGE_MS).
+ *
+ * If a motor stays suspect for the detection window, SAFETY_FAULT_STALL is raised.
+ * The detector runs once per control tick with constant work, the detection latency
+ * is at most the window plus one control period, plus the age of the current sample
+ * when detecting by current.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "inc/pluto_stall.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_encoder.h"
+#include "inc/pluto_ads1115.h"
+#include "inc/pluto_scope.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_stall, LOG_LEVEL_WRN);
+
+#define STALL_NO_INPUT (-1)
+
+struct stall_detector {
+    motor_t *motor;
+    enum encoder_id encoder;
+    bool enabled;
+    int8_t current_input;           // ADS1115 input of the shunt, STALL_NO_INPUT for none
+    uint32_t current_gain;          // mA per V at the ADS1115 input
+    uint32_t min_duty;              // 0.01 %
+    int32_t stall_speed;            // encoder counts/s
+    int32_t stall_current_ma;
+    uint32_t window_ms;
+    int64_t current_timestamp;
+    int32_t current_ma;
+    uint32_t suspect_ticks;
+    bool tripped;
+};
+
+#define STALL_DETECTOR_DEFAULTS \
+        .enabled = true, \
+        .current_input = STALL_NO_INPUT, \
+        .current_gain = 1000, \
+        .min_duty = PLUTO_STALL_MIN_DUTY, \
+        .stall_speed = PLUTO_STALL_SPEED, \
+        .stall_current_ma = PLUTO_STALL_CURRENT_MA, \
+        .window_ms = PLUTO_STALL_WINDOW_MS
+
+static struct stall_detector detectors[] = {
+        {.motor = &motor1, .encoder = ENCODER_1, STALL_DETECTOR_DEFAULTS},
+        {.motor = &motor2, .encoder = ENCODER_2, STALL_DETECTOR_DEFAULTS},
+};
+
+/* Convert a new current sample only when it arrives, not on every tick */
+static bool stall_update_current(struct stall_detector *detector, int64_t now) {
+    if (detector->current_input == STALL_NO_INPUT) {
+        return false;
+    }
+    double voltage;
+    int64_t timestamp;
+    ads1115_get_input(detector->current_input, &voltage, &timestamp);
+    if (timestamp != detector->current_timestamp) {
+        detector->current_timestamp = timestamp;
+        detector->current_ma = (int32_t)(voltage * detector->current_gain);
+    }
+    return timestamp != 0 && k_ticks_to_ms_floor64(now - timestamp) <= PLUTO_STALL_CURRENT_MAX_AGE_MS;
+}
+
+static void stall_check(struct stall_detector *detector, int64_t now) {
+    bool current_valid = stall_update_current(detector, now);
+    if (!detector->enabled || detector->motor->gated_duty < detector->min_duty) {
+        detector->suspect_ticks = 0;
+        detector->tripped = false;
+        return;
+    }
+    bool blocked = encoder_is_present(detector->encoder) &&
+                   abs(encoder_get_speed(detector->encoder)) < detector->stall_speed;
+    bool overcurrent = current_valid && detector->current_ma > detector->stall_current_ma;
+    if (!blocked && !overcurrent) {
+        detector->suspect_ticks = 0;
+        detector->tripped = false;
+        return;
+    }
+    detector->suspect_ticks++;
+    if (!detector->tripped &&
+        detector->suspect_ticks * PLUTO_CONTROL_PERIOD_US >= detector->window_ms * USEC_PER_MSEC) {
+        detector->tripped = true;
+        LOG_WRN("%s stalled (blocked %d, overcurrent %d)", detector->motor->name, blocked, overcurrent);
+        safety_raise_fault(SAFETY_FAULT_STALL, detector->motor->name);
+    }
+}
+
+/**
+ * @brief Run the stall detection for all motors, called once per control tick.
+ */
+void stall_update(void) {
+    int64_t now = k_uptime_ticks();
+    for (int i = 0; i < ARRAY_SIZE(detectors); i++) {
+        stall_check(&detectors[i], now);
+    }
+}
+
+/**
+ * @brief Check whether an ADS1115 input is the current input of a stall detector.
+ *
+ * @param input Index of the input, -1 for any input.
+ */
+bool stall_uses_input(int input) {
+    for (int i = 0; i < ARRAY_SIZE(detectors); i++) {
+        int8_t current_input = detectors[i].current_input;
+        if (current_input != STALL_NO_INPUT && (input < 0 || current_input == input)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct stall_detector *get_detector(const struct shell *shell, const char *arg) {
+    uint8_t number = simple_strtou8(arg);
+    if (number < 1 || number > ARRAY_SIZE(detectors)) {
+        shell_error(shell, "Invalid motor.");
+        return NULL;
+    }
+    return &detectors[number - 1];
+}
+
+/* Prints "<duty> <speed> <current_mA> <suspect_ms> <tripped>" */
+static int cmd_stall_get_state(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments. Usage: stall get-state <1|2>");
+        return -EINVAL;
+    }
+    struct stall_detector *detector = get_detector(shell, argv[1]);
+    if (detector == NULL) {
+        return -EINVAL;
+    }
+    shell_print(shell, "%u %d %d %u %d", detector->motor->duty,
+                encoder_is_present(detector->encoder) ? encoder_get_speed(detector->encoder) : -1,
+                detector->current_input == STALL_NO_INPUT ? -1 : detector->current_ma,
+                detector->suspect_ticks * PLUTO_CONTROL_PERIOD_US / USEC_PER_MSEC, detector->tripped);
+    return 0;
+}
+
+static int cmd_stall_enable(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Invalid number of arguments. Usage: stall enable <1|2> <0|1>");
+        return -EINVAL;
+    }
+    struct stall_detector *detector = get_detector(shell, argv[1]);
+    if (detector == NULL) {
+        return -EINVAL;
+    }
+    detector->enabled = simple_strtou8(argv[2]) != 0;
+    shell_print(shell, "%d", detector->enabled);
+    return 0;
+}
+
+static int cmd_stall_config_current(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 4) {
+        shell_error(shell, "Invalid number of arguments. Usage: stall config-current <1|2> <input|-1> <mA_per_V>");
+        return -EINVAL;
+    }
+    struct stall_detector *detector = get_detector(shell, argv[1]);
+    if (detector == NULL) {
+        return -EINVAL;
+    }
+    int input = atoi(argv[2]);
+    if (input < STALL_NO_INPUT || input > 3) {
+        shell_error(shell, "Invalid input index.");
+        return -EINVAL;
+    }
+    if (input != STALL_NO_INPUT && scope_is_active()) {
+        shell_error(shell, "Scope is armed, the input would not be sampled.");
+        return -EBUSY;
+    }
+    detector->current_input = (int8_t)input;
+    detector->current_gain = simple_strtou32(argv[3]);
+    detector->current_timestamp = 0;
+    shell_print(shell, "%d %u", detector->current_input, detector->current_gain);
+    return 0;
+}
+
+static int cmd_stall_config_thresholds(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 6) {
+        shell_error(shell, "Invalid number of arguments. "
+                           "Usage: stall config-thresholds <1|2> <min_duty> <speed> <current_mA> <window_ms>");
+        return -EINVAL;
+    }
+    struct stall_detector *detector = get_detector(shell, argv[1]);
+    if (detector == NULL) {
+        return -EINVAL;
+    }
+    uint32_t window_ms = simple_strtou32(argv[5]);
+    if (window_ms == 0) {
+        shell_error(shell, "Invalid window.");
+        return -EINVAL;
+    }
+    detector->min_duty = simple_strtou16(argv[2]);
+    detector->stall_speed = (int32_t)simple_strtou32(argv[3]);
+    detector->stall_current_ma = (int32_t)simple_strtou32(argv[4]);
+    detector->window_ms = window_ms;
+    shell_print(shell, "%u %d %d %u", detector->min_duty, detector->stall_speed, detector->stall_current_ma,
+                detector->window_ms);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "stall". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_stall,
+                               SHELL_CMD(get-state, NULL,
+                                         "Get <duty> <speed> <current_mA> <suspect_ms> <tripped> of motor <1|2>.",
+                                         cmd_stall_get_state),
+                               SHELL_CMD(enable, NULL, "Enable(1)/disable(0) detection for motor <1|2>.",
+                                         cmd_stall_enable),
+                               SHELL_CMD(config-current, NULL,
+                                         "Set ADS1115 current input <input|-1> and gain <mA_per_V> of motor <1|2>.",
+                                         cmd_stall_config_current),
+                               SHELL_CMD(config-thresholds, NULL,
+                                         "Set <min_duty(0.01 %)> <speed> <current_mA> <window_ms> of motor <1|2>.",
+                                         cmd_stall_config_thresholds),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "stall" */
+SHELL_CMD_REGISTER(stall, &sub_stall, "Stall and collision detection.", NULL);
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_telemetry.c
+ * @brief Telemetry Module
+ *
+ * Reports a snapshot of all safety relevant values in one line, each value together
+ * with the age of its sample, so that the host can tell a fresh value from a stale
+ * one. A snapshot is either requested with "telemetry get" or pushed periodically
+ * with "telemetry stream <period_ms>".
+ *
+ * Line format:
+ * ```
+ * <uptime_ms> motor1=<speed>,<age_ms> motor2=<speed>,<age_ms>
+ *     p_0=<mm>,<age_ms>,<range_status>,<signal_kcps>,<ambient_kcps>,<spads>,<valid> ...
+ *     a_0=<mV>,<age_ms> ... pose=<x_mm>,<y_mm>,<heading_mdeg>,<v_mm_s>,<w_mrad_s>,<age_ms>
+ *     owner=<source> fault=<reason>
+ * ```
+ * An age of -1 means that there is no sample yet.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdio.h>
+
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_vl53l0x.h"
+#include "inc/pluto_ads1115.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_odometry.h"
+#include "inc/pluto_arbiter.h"
+#include "inc/pluto_config.h"
+#include "inc/usb_cli.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_telemetry, LOG_LEVEL_WRN);
+
+#define TELEMETRY_LINE_SIZE 448
+#define TELEMETRY_NUM_PROXY 4
+#define TELEMETRY_NUM_ADC   4
+
+static const struct shell *stream_shell;
+static uint32_t stream_period_ms;
+
+static void telemetry_stream_work_handler(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(telemetry_stream_work, telemetry_stream_work_handler);
+
+static int64_t telemetry_age_ms(int64_t timestamp, int64_t now) {
+    if (timestamp == 0) {
+        return -1;
+    }
+    return k_ticks_to_ms_floor64(now - timestamp);
+}
+
+static void telemetry_format(char *line, size_t size) {
+    int64_t now = k_uptime_ticks();
+    size_t len = snprintf(line, size, "%lld", k_ticks_to_ms_floor64(now));
+
+    motor_t *motors[] = {&motor1, &motor2};
+    for (int i = 0; i < ARRAY_SIZE(motors) && len < size; i++) {
+        len += snprintf(line + len, size - len, " %s=%u,%lld", motors[i]->name, motors[i]->speed,
+                        telemetry_age_ms(safety_read_timestamp(&motors[i]->speed_timestamp), now));
+    }
+    for (int i = 0; i < TELEMETRY_NUM_PROXY && len < size; i++) {
+        struct vl53l0x_sample sample;
+        vl53l0x_get_sample(i, &sample);
+        len += snprintf(line + len, size - len, " p_%d=%u,%lld,%u,%u,%u,%u,%d", i, sample.distance_mm,
+                        telemetry_age_ms(sample.timestamp, now), sample.range_status, sample.signal_kcps,
+                        sample.ambient_kcps, sample.spad_count, sample.is_valid);
+    }
+    for (int i = 0; i < TELEMETRY_NUM_ADC && len < size; i++) {
+        double voltage;
+        int64_t timestamp;
+        ads1115_get_input(i, &voltage, &timestamp);
+        len += snprintf(line + len, size - len, " a_%d=%d,%lld", i, (int32_t)(voltage * 1000),
+                        telemetry_age_ms(timestamp, now));
+    }
+    if (len < size) {
+        struct odometry_pose pose;
+        odometry_get_pose(&pose);
+        len += snprintf(line + len, size - len, " pose=%lld,%lld,%u,%d,%d,%lld", pose.x_um / 1000, pose.y_um / 1000,
+                        ODOMETRY_BAM_TO_MDEG(pose.heading), pose.v_mm_s, pose.w_mrad_s,
+                        telemetry_age_ms(pose.timestamp, now));
+    }
+    if (len < size) {
+        len += snprintf(line + len, size - len, " owner=%s", arbiter_source_to_string(arbiter_get_owner()));
+    }
+    if (len < size) {
+        snprintf(line + len, size - len, " fault=%s", safety_fault_to_string(safety_get_last_fault()));
+    }
+}
+
+static void telemetry_stream_work_handler(struct k_work *work) {
+    if (stream_shell == NULL || stream_period_ms == 0) {
+        return;
+    }
+    char line[TELEMETRY_LINE_SIZE];
+    telemetry_format(line, sizeof(line));
+    shell_print(stream_shell, "%s", line);
+    k_work_schedule(&telemetry_stream_work, K_MSEC(stream_period_ms));
+}
+
+static int cmd_telemetry_get(const struct shell *shell, size_t argc, char **argv) {
+    char line[TELEMETRY_LINE_SIZE];
+    telemetry_format(line, sizeof(line));
+    shell_print(shell, "%s", line);
+    return 0;
+}
+
+static int cmd_telemetry_stream(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments. Usage: telemetry stream <period_ms|0>");
+        return -EINVAL;
+    }
+    uint32_t period_ms = simple_strtou32(argv[1]);
+    if (period_ms != 0 && period_ms < PLUTO_TELEMETRY_MIN_PERIOD_MS) {
+        shell_error(shell, "Period must be 0 or at least %u ms.", PLUTO_TELEMETRY_MIN_PERIOD_MS);
+        return -EINVAL;
+    }
+    stream_period_ms = period_ms;
+    stream_shell = shell;
+    if (period_ms == 0) {
+        k_work_cancel_delayable(&telemetry_stream_work);
+    } else {
+        k_work_reschedule(&telemetry_stream_work, K_NO_WAIT);
+    }
+    shell_print(shell, "%u", period_ms);
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "telemetry". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_telemetry,
+                               SHELL_CMD(get, NULL, "Print one telemetry snapshot.", cmd_telemetry_get),
+                               SHELL_CMD(stream, NULL, "Print a snapshot every <period_ms>, 0 stops.",
+                                         cmd_telemetry_stream),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "telemetry" */
+SHELL_CMD_REGISTER(telemetry, &sub_telemetry, "Snapshot of sensor values with sample ages.", NULL);
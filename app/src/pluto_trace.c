@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file pluto_trace.c
+ * @brief Event Tracing Module
+ *
+ * This module records a timeline of thread switches, interrupts and application
+ * trace points into a statically allocated RAM ring buffer. Kernel events are taken
+ * from the Zephyr user tracing hooks (CONFIG_TRACING_USER), application events are
+ * recorded with pluto_trace().
+ *
+ * Each event is a fixed 12 byte record with a hardware cycle timestamp. Recording
+ * only takes an interrupt lock around the ring buffer index, no formatting is done
+ * on the device. The buffer is controlled and dumped with the "trace" shell command,
+ * scripts/pluto_trace2ctf.py converts a dump to CTF (TraceCompass) or to the Chrome
+ * JSON trace format (Perfetto).
+ *
+ * The cost of one event is measured on the target with "trace overhead".
+ *
+ * @author Jannis Ruellmann
+ */
+
+#ifdef CONFIG_PLUTO_TRACE
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "inc/pluto_trace.h"
+#include "inc/pluto_config.h"
+
+/* Enable logging for module. Change Log Level for debugging. */
+LOG_MODULE_REGISTER(pluto_trace, LOG_LEVEL_WRN);
+
+BUILD_ASSERT((PLUTO_TRACE_BUFFER_EVENTS & (PLUTO_TRACE_BUFFER_EVENTS - 1)) == 0,
+             "PLUTO_TRACE_BUFFER_EVENTS must be a power of two");
+
+#define PLUTO_TRACE_DUMP_VERSION 1
+
+static struct pluto_trace_event trace_buffer[PLUTO_TRACE_BUFFER_EVENTS];
+/* Total number of recorded events, the ring buffer position is head % size */
+static uint32_t trace_head;
+static bool trace_enabled;
+
+/**
+ * @brief Record an event in the trace ring buffer.
+ *
+ * Safe to call from threads and ISRs. The oldest events are overwritten when the
+ * buffer is full.
+ *
+ * **Usage**
+ * ```
+ * pluto_trace(PLUTO_TRACE_LED_FLUSH, 0, 0);
+ * ```
+ *
+ * @param id Event ID.
+ * @param arg First event argument.
+ * @param arg2 Second event argument.
+ */
+void pluto_trace(enum pluto_trace_event_id id, uint32_t arg, uint16_t arg2) {
+    if (!trace_enabled) {
+        return;
+    }
+    unsigned int key = irq_lock();
+    struct pluto_trace_event *event = &trace_buffer[trace_head & (PLUTO_TRACE_BUFFER_EVENTS - 1)];
+    trace_head++;
+    event->timestamp = k_cycle_get_32();
+    event->arg = arg;
+    event->id = id;
+    event->arg2 = arg2;
+    irq_unlock(key);
+}
+
+static uint32_t trace_get_exception_number(void) {
+#ifdef CONFIG_CPU_CORTEX_M
+    uint32_t ipsr;
+    __asm__ volatile("mrs %0, ipsr" : "=r"(ipsr));
+    return ipsr & 0x1FF;
+#else
+    return 0;
+#endif
+}
+
+/* Zephyr user tracing hooks, prototypes in subsys/tracing/user/tracing_user.h */
+
+void sys_trace_thread_switched_in_user(void) {
+    pluto_trace(PLUTO_TRACE_THREAD_SWITCHED_IN, (uint32_t)(uintptr_t)k_current_get(), 0);
+}
+
+void sys_trace_thread_switched_out_user(void) {
+    pluto_trace(PLUTO_TRACE_THREAD_SWITCHED_OUT, (uint32_t)(uintptr_t)k_current_get(), 0);
+}
+
+void sys_trace_isr_enter_user(int nested_interrupts) {
+    ARG_UNUSED(nested_interrupts);
+    pluto_trace(PLUTO_TRACE_ISR_ENTER, trace_get_exception_number(), 0);
+}
+
+void sys_trace_isr_exit_user(int nested_interrupts) {
+    ARG_UNUSED(nested_interrupts);
+    pluto_trace(PLUTO_TRACE_ISR_EXIT, 0, 0);
+}
+
+void sys_trace_idle_user(void) {
+    pluto_trace(PLUTO_TRACE_IDLE, 0, 0);
+}
+
+static void trace_dump_thread(const struct k_thread *thread, void *user_data) {
+    const struct shell *shell = user_data;
+    const char *name = k_thread_name_get((k_tid_t)thread);
+    shell_print(shell, "T %08x %s", (uint32_t)(uintptr_t)thread, (name != NULL && name[0] != '\0') ? name : "-");
+}
+
+static int cmd_trace_start(const struct shell *shell, size_t argc, char **argv) {
+    trace_enabled = true;
+    shell_print(shell, "1");
+    return 0;
+}
+
+static int cmd_trace_stop(const struct shell *shell, size_t argc, char **argv) {
+    trace_enabled = false;
+    shell_print(shell, "0");
+    return 0;
+}
+
+static int cmd_trace_clear(const struct shell *shell, size_t argc, char **argv) {
+    unsigned int key = irq_lock();
+    trace_head = 0;
+    irq_unlock(key);
+    shell_print(shell, "0");
+    return 0;
+}
+
+/**
+ * @brief Dump the trace buffer, oldest event first.
+ *
+ * Tracing is stopped for the dump. The output format is:
+ * ```
+ * # pluto-trace <version> <cycles_per_sec> <events> <lost>
+ * T <thread> <name>
+ * E <timestamp> <id> <arg> <arg2>
+ * ```
+ * with all numbers except the header in hex.
+ */
+static int cmd_trace_dump(const struct shell *shell, size_t argc, char **argv) {
+    trace_enabled = false;
+    uint32_t head = trace_head;
+    uint32_t count = MIN(head, PLUTO_TRACE_BUFFER_EVENTS);
+    shell_print(shell, "# pluto-trace %d %u %u %u", PLUTO_TRACE_DUMP_VERSION, sys_clock_hw_cycles_per_sec(),
+                count, head - count);
+    k_thread_foreach(trace_dump_thread, (void *)shell);
+    for (uint32_t i = head - count; i != head; i++) {
+        const struct pluto_trace_event *event = &trace_buffer[i & (PLUTO_TRACE_BUFFER_EVENTS - 1)];
+        shell_print(shell, "E %08x %x %x %x", event->timestamp, event->id, event->arg, event->arg2);
+    }
+    return 0;
+}
+
+/**
+ * @brief Measure the cost of recording one event.
+ *
+ * Records PLUTO_TRACE_OVERHEAD_EVENTS events back to back with interrupts locked
+ * and prints the average cost in cycles and nanoseconds. The trace buffer is
+ * cleared afterwards.
+ */
+static int cmd_trace_overhead(const struct shell *shell, size_t argc, char **argv) {
+    bool was_enabled = trace_enabled;
+    unsigned int key = irq_lock();
+    trace_enabled = true;
+    uint32_t start = k_cycle_get_32();
+    for (uint32_t i = 0; i < PLUTO_TRACE_OVERHEAD_EVENTS; i++) {
+        pluto_trace(PLUTO_TRACE_IDLE, i, 0);
+    }
+    uint32_t cycles = k_cycle_get_32() - start;
+    trace_head = 0;
+    trace_enabled = was_enabled;
+    irq_unlock(key);
+    uint32_t per_event = cycles / PLUTO_TRACE_OVERHEAD_EVENTS;
+    shell_print(shell, "%u cycles, %u ns per event", per_event, k_cyc_to_ns_floor32(per_event));
+    return 0;
+}
+
+/* Creating subcommands (level 1 command) array for command "trace". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_trace,
+                               SHELL_CMD(start, NULL, "Start recording events.", cmd_trace_start),
+                               SHELL_CMD(stop, NULL, "Stop recording events.", cmd_trace_stop),
+                               SHELL_CMD(clear, NULL, "Clear the trace buffer.", cmd_trace_clear),
+                               SHELL_CMD(dump, NULL, "Stop recording and dump the trace buffer.", cmd_trace_dump),
+                               SHELL_CMD(overhead, NULL, "Measure cost per event (clears the buffer).",
+                                         cmd_trace_overhead),
+                               SHELL_SUBCMD_SET_END
+);
+
+/* Creating root (level 0) command "trace" */
+SHELL_CMD_REGISTER(trace, &sub_trace, "Record an event trace to RAM.", NULL);
+
+#endif /* CONFIG_PLUTO_TRACE */
@@ -19,6 +19,20 @@
  * - Configuring the mode of the sensor (proximity, distance, or off).
  * - Command-line interface for sensor control.
  * - Initialization and configuration of VL53L0X sensors.
+ * - Range status, signal rate, ambient rate and effective SPAD count of every sample,
+ *   with a quality gate deciding which samples may block motion. A sunlight saturated
+ *   or out of range reading is reported and counts as clear. Every sample the sensor
+ *   delivers refreshes the safety supervision.
+ * - Ranging groups: sensors of a group never range at the same time (overlapping fields
+ *   of view), the groups are distributed over PLUTO_VL53L0X_LANES threads which range
+ *   concurrently. The sensor scheduler (pluto_sensor.c) requests the samples at the
+ *   periods of the sensor channels, a lane ranges the requested sensors of a sweep.
+ * - Reference SPAD, temperature (VHV and phase), offset and crosstalk calibration
+ *   with the ST API. The results are stored with the settings subsystem and the
+ *   offset is applied after the driver started a sensor at boot; the crosstalk is
+ *   stored for reference only, the driver's ST API handle is private. A calibrated
+ *   sensor stays off until the next boot, the ST API overwrote the driver's ranging
+ *   configuration, so calibration is refused while the motors run.
  *
  * This module is designed to be integrated into larger systems requiring precise
  * distance measurements and proximity detection, such as robotics, home automation,
@@ -30,17 +44,25 @@
 #include <devicetree_generated.h>
 #include <zephyr/logging/log.h>
 #include <string.h>
+#include <stdlib.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/drivers/sensor/vl53l0x.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/shell/shell.h>
+#include <zephyr/settings/settings.h>
 #include "inc/pluto_vl53l0x.h"
 #include "vl53l0x_types.h"
 #include "vl53l0x_api.h"
 #include "inc/usb_cli.h"
-#include "inc/pluto_motordriver.h"
 #include "inc/pluto_config.h"
+#include "inc/pluto_trace.h"
+#include "inc/pluto_safety.h"
+#include "inc/pluto_sectormap.h"
+#include "inc/pluto_sensor.h"
+#include "inc/pluto_motordriver.h"
+#include "inc/pluto_arbiter.h"
 
 /* Enable logging for module. Change Log Level for debugging. */
 LOG_MODULE_REGISTER(vl53l0x, LOG_LEVEL_WRN);
@@ -51,8 +73,35 @@ LOG_MODULE_REGISTER(vl53l0x, LOG_LEVEL_WRN);
 #define SENSOR_POLL_INTERVAL K_MSEC(1000)
 #define PLUTO_VL53L0X_NUM_SENSORS 4
 
-static struct k_thread vl53l0x_thread_data;
-K_THREAD_STACK_DEFINE(vl53l0x_stack_area, 1024u);
+/* Calibration steps in the order they must be done, bits of vl53l0x_calibration.valid */
+enum vl53l0x_calib_step {
+    VL53L0X_CALIB_SPAD,         // Reference SPAD management
+    VL53L0X_CALIB_TEMP,         // Reference (VHV and phase) calibration, depends on temperature
+    VL53L0X_CALIB_OFFSET,       // Offset calibration at a known distance
+    VL53L0X_CALIB_XTALK,        // Crosstalk calibration at a known distance
+};
+
+/* ST API handle of a sensor, the driver moved it to the address in the device tree */
+#define VL53L0X_DEV_INIT(node) { \
+        .I2cDevAddr = DT_REG_ADDR(node), \
+        .comms_type = 1, \
+        .comms_speed_khz = 100, \
+        .i2c = DEVICE_DT_GET(DT_BUS(node)), \
+}
+
+/* Persisted calibration of a sensor */
+struct vl53l0x_calibration {
+    uint8_t valid;                  // Bit n set if step n is done
+    uint8_t is_aperture_spads;
+    uint8_t vhv_settings;
+    uint8_t phase_cal;
+    uint32_t ref_spad_count;
+    int32_t offset_um;
+    FixPoint1616_t xtalk_mcps;
+};
+
+static struct k_thread vl53l0x_thread_data[PLUTO_VL53L0X_LANES];
+K_THREAD_STACK_ARRAY_DEFINE(vl53l0x_stack_area, PLUTO_VL53L0X_LANES, PLUTO_VL53L0X_THREAD_STACK_SIZE);
 
 K_SEM_DEFINE(data_sem, 1, 1); // Semaphore to protect shared data
 
@@ -62,26 +111,188 @@ struct vl53l0x {
     enum sensor_mode mode;
     bool is_ready_checked;
     uint32_t distance_mm;
+    int64_t timestamp;              // Uptime in ticks of distance_mm
     VL53L0X_Dev_t vl53l0x;
     bool is_proxy;
+    const struct device *dev;
+    struct vl53l0x_calibration calibration;
+    bool is_calibration_applied;    // Stored offset and crosstalk written after the driver started
+    uint8_t range_status;           // VL53L0X_RANGE_STATUS_* of distance_mm
+    uint32_t signal_kcps;           // Return signal rate of distance_mm
+    uint32_t ambient_kcps;          // Return ambient rate of distance_mm
+    uint32_t spad_count;            // Effective return SPADs of distance_mm
+    bool is_valid;                  // distance_mm passed the quality gate
+    uint8_t group;                  // Ranging group, sensors of a group never range at the same time
+    uint32_t samples;               // Samples since the last schedule, for the measured rate
+    atomic_t busy;                  // Set while a lane samples or the shell calibrates the sensor
+    bool needs_reboot;              // Calibrated, the driver's ranging configuration is lost
+};
+
+/* Sensors ranged one after another by one thread */
+struct vl53l0x_lane {
+    uint8_t sensors[PLUTO_VL53L0X_NUM_SENSORS];
+    uint8_t count;
+};
+
+static struct vl53l0x_lane lanes[PLUTO_VL53L0X_LANES];
+static struct k_mutex group_mutexes[PLUTO_VL53L0X_NUM_SENSORS];  // Held while a sensor of the group ranges
+static int64_t rate_timestamp;      // Uptime in ticks of the last schedule
+static struct k_spinlock schedule_lock;
+static struct k_sem lane_sems[PLUTO_VL53L0X_LANES];    // Given by the sensor scheduler
+static atomic_t requested_sensors;  // Bit per sensor, set by the sensor scheduler
+
+/* Which samples are trusted for the proximity gating and the safety supervision */
+struct vl53l0x_quality_gate {
+    uint32_t status_mask;           // Bit n set if range status n is accepted
+    uint32_t min_signal_kcps;
+    uint32_t max_ambient_kcps;
+    uint32_t min_spads;
+};
+
+static struct vl53l0x_quality_gate quality_gate = {
+        .status_mask = PLUTO_VL53L0X_QUALITY_STATUS_MASK,
+        .min_signal_kcps = PLUTO_VL53L0X_QUALITY_MIN_SIGNAL_KCPS,
+        .max_ambient_kcps = PLUTO_VL53L0X_QUALITY_MAX_AMBIENT_KCPS,
+        .min_spads = PLUTO_VL53L0X_QUALITY_MIN_SPADS,
 };
 
 uint8_t set_threshold_by_name(const char* name, uint16_t threshold);
 uint8_t get_threshold_by_name(const char* name);
-uint32_t get_distance_by_name(const char* name);
 enum sensor_mode get_mode_by_name(const char* name);
 uint8_t set_mode_by_name(const char* name, enum sensor_mode mode);
 const char* get_proxy_name(int proxy_number);
 uint32_t get_is_proxy_state_by_name(const char* name);
+static void vl53l0x_schedule(void);
 
 // Define configurations and data for each sensor
 struct vl53l0x vl53l0x_sensors[PLUTO_VL53L0X_NUM_SENSORS] = {
-        {"p_0", 100, VL53L0X_MODE_OFF, false},
-        {"p_1", 100, VL53L0X_MODE_OFF, false},
-        {"p_2", 100, VL53L0X_MODE_OFF, false},
-        {"p_3", 100, VL53L0X_MODE_OFF, false}
+        {"p_0", 100, VL53L0X_MODE_OFF, false, .vl53l0x = VL53L0X_DEV_INIT(DT_NODELABEL(vl53l0x_0)),
+         .dev = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_0)), .group = PLUTO_VL53L0X_GROUP_P_0},
+        {"p_1", 100, VL53L0X_MODE_OFF, false, .vl53l0x = VL53L0X_DEV_INIT(DT_NODELABEL(vl53l0x_1)),
+         .dev = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_1)), .group = PLUTO_VL53L0X_GROUP_P_1},
+        {"p_2", 100, VL53L0X_MODE_OFF, false, .vl53l0x = VL53L0X_DEV_INIT(DT_NODELABEL(vl53l0x_2)),
+         .dev = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_2)), .group = PLUTO_VL53L0X_GROUP_P_2},
+        {"p_3", 100, VL53L0X_MODE_OFF, false, .vl53l0x = VL53L0X_DEV_INIT(DT_NODELABEL(vl53l0x_3)),
+         .dev = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_3)), .group = PLUTO_VL53L0X_GROUP_P_3}
 };
 
+static int get_index_by_name(const char *name) {
+    for (int i = 0; i < PLUTO_VL53L0X_NUM_SENSORS; i++) {
+        if (strcmp(name, vl53l0x_sensors[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int vl53l0x_settings_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg) {
+    int index = get_index_by_name(key);
+    if (index < 0) {
+        return -ENOENT;
+    }
+    if (len != sizeof(struct vl53l0x_calibration)) {
+        return -EINVAL;
+    }
+    ssize_t ret = read_cb(cb_arg, &vl53l0x_sensors[index].calibration, len);
+    return (ret < 0) ? (int)ret : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vl53l0x, "vl53l0x", NULL, vl53l0x_settings_set, NULL, NULL);
+
+static int vl53l0x_save_calibration(const struct vl53l0x *sensor) {
+    char key[16];
+    snprintk(key, sizeof(key), "vl53l0x/%s", sensor->name);
+    return settings_save_one(key, &sensor->calibration, sizeof(sensor->calibration));
+}
+
+/*
+ * Write the stored offset to a running sensor. Reference SPADs and VHV/phase are measured
+ * again by the driver whenever it starts a sensor, which also follows the temperature, so
+ * they are only applied before a calibration.
+ *
+ * The crosstalk is not applied: its rate and enable flag are kept in the PAL data of the
+ * ST API handle, not in a register, and the driver ranges through its own private handle.
+ * Written to this handle they would be silently ignored. The offset is a sensor register
+ * and takes effect on the driver's ranging too.
+ */
+static VL53L0X_Error vl53l0x_apply_calibration(struct vl53l0x *sensor) {
+    VL53L0X_Dev_t *dev = &sensor->vl53l0x;
+    const struct vl53l0x_calibration *calib = &sensor->calibration;
+    if (!(calib->valid & BIT(VL53L0X_CALIB_OFFSET))) {
+        return VL53L0X_ERROR_NONE;
+    }
+    return VL53L0X_SetOffsetCalibrationDataMicroMeter(dev, calib->offset_um);
+}
+
+/*
+ * Bring a sensor into the state for a calibration step: initialise the ST API data and
+ * apply the stored results of the earlier steps, as required by the ST calibration flow.
+ */
+static VL53L0X_Error vl53l0x_prepare_calibration(struct vl53l0x *sensor, enum vl53l0x_calib_step step) {
+    VL53L0X_Dev_t *dev = &sensor->vl53l0x;
+    const struct vl53l0x_calibration *calib = &sensor->calibration;
+    VL53L0X_Error err = VL53L0X_DataInit(dev);
+    if (err == VL53L0X_ERROR_NONE) {
+        err = VL53L0X_StaticInit(dev);
+    }
+    if (err == VL53L0X_ERROR_NONE && step > VL53L0X_CALIB_SPAD && (calib->valid & BIT(VL53L0X_CALIB_SPAD))) {
+        err = VL53L0X_SetReferenceSpads(dev, calib->ref_spad_count, calib->is_aperture_spads);
+    }
+    if (err == VL53L0X_ERROR_NONE && step > VL53L0X_CALIB_TEMP && (calib->valid & BIT(VL53L0X_CALIB_TEMP))) {
+        err = VL53L0X_SetRefCalibration(dev, calib->vhv_settings, calib->phase_cal);
+    }
+    if (err == VL53L0X_ERROR_NONE && step > VL53L0X_CALIB_OFFSET && (calib->valid & BIT(VL53L0X_CALIB_OFFSET))) {
+        err = VL53L0X_SetOffsetCalibrationDataMicroMeter(dev, calib->offset_um);
+    }
+    if (err == VL53L0X_ERROR_NONE) {
+        err = VL53L0X_SetDeviceMode(dev, VL53L0X_DEVICEMODE_SINGLE_RANGING);
+    }
+    return err;
+}
+
+/*
+ * Run one calibration step on a sensor which is switched off and store the result.
+ * A step invalidates the stored results of the later steps, they must be done again.
+ *
+ * The ST API runs DataInit and StaticInit on the sensor, which overwrites the ranging
+ * configuration the driver wrote when it started the sensor. The driver does not know,
+ * so the sensor stays off until the next boot, where the driver starts it again.
+ */
+static int vl53l0x_calibrate(struct vl53l0x *sensor, enum vl53l0x_calib_step step, uint32_t distance_mm) {
+    struct vl53l0x_calibration *calib = &sensor->calibration;
+    // The driver powers up and starts the sensor on its first sample
+    int ret = sensor_sample_fetch(sensor->dev);
+    if (ret) {
+        return ret;
+    }
+    VL53L0X_Dev_t *dev = &sensor->vl53l0x;
+    sensor->needs_reboot = true;
+    VL53L0X_Error err = vl53l0x_prepare_calibration(sensor, step);
+    if (err == VL53L0X_ERROR_NONE) {
+        switch (step) {
+            case VL53L0X_CALIB_SPAD:
+                err = VL53L0X_PerformRefSpadManagement(dev, &calib->ref_spad_count, &calib->is_aperture_spads);
+                break;
+            case VL53L0X_CALIB_TEMP:
+                err = VL53L0X_PerformRefCalibration(dev, &calib->vhv_settings, &calib->phase_cal);
+                break;
+            case VL53L0X_CALIB_OFFSET:
+                err = VL53L0X_PerformOffsetCalibration(dev, distance_mm << 16, &calib->offset_um);
+                break;
+            case VL53L0X_CALIB_XTALK:
+                err = VL53L0X_PerformXTalkCalibration(dev, distance_mm << 16, &calib->xtalk_mcps);
+                break;
+        }
+    }
+    if (err != VL53L0X_ERROR_NONE) {
+        LOG_ERR("Calibration of %s failed, err %d", sensor->name, err);
+        return -EIO;
+    }
+    calib->valid = (calib->valid & BIT_MASK(step)) | BIT(step);
+    return vl53l0x_save_calibration(sensor);
+}
+
+
 /**
  * @brief Root command function for relays.
  *
@@ -121,18 +332,6 @@ static int cmd_proxy_get_threshold(const struct shell *shell, size_t argc, char
     return 0;
 }
 
-static int cmd_proxy_get_distance(const struct shell *shell, size_t argc, char **argv) {
-    if (argc == 2) {
-        const char *name = argv[1];
-        uint32_t distance = get_distance_by_name(name);
-        shell_print(shell, "%d", distance);
-    } else {
-        shell_error(shell, "Invalid number of arguments for subcommand");
-    }
-    return 0;
-}
-
-
 static int cmd_proxy_get_proxy_state(const struct shell *shell, size_t argc, char **argv) {
     if (argc == 2) {
         const char *name = argv[1];
@@ -160,6 +359,11 @@ static int cmd_proxy_set_mode(const struct shell *shell, size_t argc, char **arg
             isError = true;
             shell_error(shell, "mode not known.");
         }
+        int index = get_index_by_name(name);
+        if (!isError && sensor_mode != VL53L0X_MODE_OFF && index >= 0 && vl53l0x_sensors[index].needs_reboot) {
+            isError = true;
+            shell_error(shell, "Sensor calibrated, reboot to start it again.");
+        }
         if (!isError) {
             shell_print(shell, "%u", sensor_mode);
             set_mode_by_name(name, sensor_mode);
@@ -198,6 +402,177 @@ static int cmd_proxy_get_mode(const struct shell *shell, size_t argc, char **arg
     return 0;
 }
 
+static int cmd_proxy_calibrate(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3 && argc != 4) {
+        shell_error(shell, "Usage: proxy calibrate <name> <spad||temp||offset||xtalk> [distance_mm]");
+        return -EINVAL;
+    }
+    int index = get_index_by_name(argv[1]);
+    if (index < 0) {
+        shell_error(shell, "prox sensor not known.");
+        return -EINVAL;
+    }
+    enum vl53l0x_calib_step step;
+    if (strcmp(argv[2], "spad") == 0) {
+        step = VL53L0X_CALIB_SPAD;
+    } else if (strcmp(argv[2], "temp") == 0) {
+        step = VL53L0X_CALIB_TEMP;
+    } else if (strcmp(argv[2], "offset") == 0) {
+        step = VL53L0X_CALIB_OFFSET;
+    } else if (strcmp(argv[2], "xtalk") == 0) {
+        step = VL53L0X_CALIB_XTALK;
+    } else {
+        shell_error(shell, "calibration step not known.");
+        return -EINVAL;
+    }
+    uint32_t distance_mm = (argc == 4) ? simple_strtou32(argv[3]) : 0;
+    if ((step == VL53L0X_CALIB_OFFSET || step == VL53L0X_CALIB_XTALK) && (distance_mm == 0 || distance_mm > 2000)) {
+        shell_error(shell, "Target distance [1..2000(mm)] required.");
+        return -EINVAL;
+    }
+    // The calibrated sensor stays off until the next boot, no motion may rely on it
+    if (motor1.speed != 0 || motor1.target_speed != 0 || motor2.speed != 0 || motor2.target_speed != 0) {
+        shell_error(shell, "Stop the motors first.");
+        return -EBUSY;
+    }
+    if (arbiter_check_unowned(shell) != 0) {
+        return -EACCES;
+    }
+    struct vl53l0x *sensor = &vl53l0x_sensors[index];
+    if (sensor->mode != VL53L0X_MODE_OFF) {
+        shell_error(shell, "Switch the sensor off first (config-mode <name> o).");
+        return -EBUSY;
+    }
+    // Wait for a sweep which started before the sensor was switched off
+    while (!atomic_cas(&sensor->busy, 0, 1)) {
+        k_msleep(1);
+    }
+    // The other sensors of the group must not range meanwhile, their lane waits
+    uint8_t group = sensor->group;
+    k_mutex_lock(&group_mutexes[group], K_FOREVER);
+    int ret = vl53l0x_calibrate(sensor, step, distance_mm);
+    k_mutex_unlock(&group_mutexes[group]);
+    atomic_clear(&sensor->busy);
+    if (ret) {
+        shell_error(shell, "Calibration failed: %d", ret);
+        return ret;
+    }
+    shell_print(shell, "%u", sensor->calibration.valid);
+    return 0;
+}
+
+/* Prints "<valid> <ref_spad_count> <is_aperture> <vhv> <phase> <offset_um> <xtalk_kcps>" */
+static int cmd_proxy_get_calib(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments for subcommand");
+        return -EINVAL;
+    }
+    int index = get_index_by_name(argv[1]);
+    if (index < 0) {
+        shell_error(shell, "prox sensor not known.");
+        return -EINVAL;
+    }
+    const struct vl53l0x_calibration *calib = &vl53l0x_sensors[index].calibration;
+    shell_print(shell, "%u %u %u %u %u %d %u", calib->valid, calib->ref_spad_count, calib->is_aperture_spads,
+                calib->vhv_settings, calib->phase_cal, calib->offset_um,
+                (uint32_t)(((uint64_t)calib->xtalk_mcps * 1000u) >> 16));
+    return 0;
+}
+
+static int cmd_proxy_clear_calib(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments for subcommand");
+        return -EINVAL;
+    }
+    int index = get_index_by_name(argv[1]);
+    if (index < 0) {
+        shell_error(shell, "prox sensor not known.");
+        return -EINVAL;
+    }
+    memset(&vl53l0x_sensors[index].calibration, 0, sizeof(struct vl53l0x_calibration));
+    int ret = vl53l0x_save_calibration(&vl53l0x_sensors[index]);
+    shell_print(shell, "%d", ret);
+    return ret;
+}
+
+/* Prints "<distance_mm> <range_status> <signal_kcps> <ambient_kcps> <spads> <valid> <age_ms>" */
+static int cmd_proxy_get_metrics(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "Invalid number of arguments for subcommand");
+        return -EINVAL;
+    }
+    struct vl53l0x_sample sample;
+    if (vl53l0x_get_sample(get_index_by_name(argv[1]), &sample) != 0) {
+        shell_error(shell, "prox sensor not known.");
+        return -EINVAL;
+    }
+    int64_t age_ms = sample.timestamp ? k_ticks_to_ms_floor64(k_uptime_ticks() - sample.timestamp) : -1;
+    shell_print(shell, "%u %u %u %u %u %d %lld", sample.distance_mm, sample.range_status, sample.signal_kcps,
+                sample.ambient_kcps, sample.spad_count, sample.is_valid, age_ms);
+    return 0;
+}
+
+static int cmd_proxy_config_quality(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 5) {
+        shell_error(shell, "Usage: proxy config-quality <status_mask> <min_signal_kcps> <max_ambient_kcps> <min_spads>");
+        return -EINVAL;
+    }
+    k_sem_take(&data_sem, K_FOREVER);
+    quality_gate.status_mask = strtoul(argv[1], NULL, 0);
+    quality_gate.min_signal_kcps = simple_strtou32(argv[2]);
+    quality_gate.max_ambient_kcps = simple_strtou32(argv[3]);
+    quality_gate.min_spads = simple_strtou32(argv[4]);
+    k_sem_give(&data_sem);
+    shell_print(shell, "0x%x %u %u %u", quality_gate.status_mask, quality_gate.min_signal_kcps,
+                quality_gate.max_ambient_kcps, quality_gate.min_spads);
+    return 0;
+}
+
+static int cmd_proxy_config_group(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "Usage: proxy config-group <name> <group[0..3]>");
+        return -EINVAL;
+    }
+    int index = get_index_by_name(argv[1]);
+    uint8_t group = simple_strtou8(argv[2]);
+    if (index < 0 || group >= PLUTO_VL53L0X_NUM_SENSORS) {
+        shell_error(shell, "Invalid sensor or group.");
+        return -EINVAL;
+    }
+    vl53l0x_sensors[index].group = group;
+    vl53l0x_schedule();
+    shell_print(shell, "%u", group);
+    return 0;
+}
+
+/*
+ * Prints "<name> <group> <lane> <expected_mHz> <measured_mHz>" per scheduled sensor. The
+ * expected rate is the channel period, limited by a lane sweep which takes
+ * PLUTO_VL53L0X_RANGING_TIME_MS per sensor. The measured rate counts the samples since
+ * the last schedule.
+ */
+static int cmd_proxy_get_schedule(const struct shell *shell, size_t argc, char **argv) {
+    k_spinlock_key_t key = k_spin_lock(&schedule_lock);
+    struct vl53l0x_lane lanes_copy[PLUTO_VL53L0X_LANES];
+    memcpy(lanes_copy, lanes, sizeof(lanes));
+    int64_t elapsed_ms = k_ticks_to_ms_floor64(k_uptime_ticks() - rate_timestamp);
+    k_spin_unlock(&schedule_lock, key);
+    uint32_t total_mhz = 0;
+    for (int l = 0; l < PLUTO_VL53L0X_LANES; l++) {
+        uint32_t sweep_ms = lanes_copy[l].count * PLUTO_VL53L0X_RANGING_TIME_MS;
+        for (int k = 0; k < lanes_copy[l].count; k++) {
+            const struct vl53l0x *sensor = &vl53l0x_sensors[lanes_copy[l].sensors[k]];
+            uint32_t period_ms = sensor_get_period_ms(SENSOR_DEVICE_VL53L0X, lanes_copy[l].sensors[k]);
+            uint32_t expected_mhz = 1000000u / MAX(MAX(sweep_ms, period_ms), 1u);
+            uint32_t measured_mhz = elapsed_ms ? (uint32_t)((uint64_t)sensor->samples * 1000000u / elapsed_ms) : 0;
+            total_mhz += expected_mhz;
+            shell_print(shell, "%s %u %d %u %u", sensor->name, sensor->group, l, expected_mhz, measured_mhz);
+        }
+    }
+    shell_print(shell, "total %u", total_mhz);
+    return 0;
+}
+
 static int cmd_proxy_list_prox(const struct shell *shell, size_t argc, char **argv) {
     for (int i = 0; i <= 3; i++) {
         shell_print(shell, "%s", get_proxy_name(i));
@@ -281,6 +656,16 @@ uint8_t set_mode_by_name(const char* name, enum sensor_mode mode) {
     } else {
         LOG_ERR("prox sensor not known.");
     }
+    // Only sensors in proximity mode guard the motors and must not get stale
+    for (int i = 0; i < PLUTO_VL53L0X_NUM_SENSORS; i++) {
+        bool is_guard = vl53l0x_sensors[i].mode == VL53L0X_MODE_PROXIMITY;
+        safety_signal_arm(SAFETY_SIGNAL_PROXY_0 + i, is_guard);
+        if (!is_guard) {
+            vl53l0x_sensors[i].is_proxy = false;
+            sectormap_clear_sensor(i);
+        }
+    }
+    vl53l0x_schedule();
     return 0;
 }
 
@@ -308,25 +693,80 @@ enum sensor_mode get_mode_by_name(const char* name) {
 }
 
 /**
- * @brief Get the current distance measurement of a specific sensor by name.
+ * @brief Get the latest distance sample of a sensor with its timestamp.
  *
- * @param name Name of the sensor (e.g., "p_0").
- * @return Distance measurement in millimeters.
+ * @param index Index of the sensor (0 for "p_0").
+ * @param distance_mm Distance measurement in millimeters.
+ * @param timestamp Uptime in ticks of the measurement, 0 if there is none yet.
+ * @return 0 on success, -EINVAL for an unknown sensor.
  */
-uint32_t get_distance_by_name(const char* name) {
-    uint32_t distance_mm = 0;
-    if (strcmp(name, "p_0") == 0) {
-        distance_mm = vl53l0x_sensors[0].distance_mm;
-    } else if (strcmp(name, "p_1") == 0) {
-        distance_mm = vl53l0x_sensors[1].distance_mm;
-    } else if (strcmp(name, "p_2") == 0) {
-        distance_mm = vl53l0x_sensors[2].distance_mm;
-    } else if (strcmp(name, "p_3") == 0) {
-        distance_mm = vl53l0x_sensors[3].distance_mm;
-    } else {
-        LOG_ERR("prox sensor not known.");
+int vl53l0x_get_distance(int index, uint32_t *distance_mm, int64_t *timestamp) {
+    if (index < 0 || index >= PLUTO_VL53L0X_NUM_SENSORS) {
+        return -EINVAL;
     }
-    return distance_mm;
+    k_sem_take(&data_sem, K_FOREVER);
+    *distance_mm = vl53l0x_sensors[index].distance_mm;
+    *timestamp = vl53l0x_sensors[index].timestamp;
+    k_sem_give(&data_sem);
+    return 0;
+}
+
+/**
+ * @brief Get the latest sample of a sensor with its quality metrics.
+ *
+ * @param index Index of the sensor (0 for "p_0").
+ * @param sample Copy of the sample, timestamp 0 if there is none yet.
+ * @return 0 on success, -EINVAL for an unknown sensor.
+ */
+int vl53l0x_get_sample(int index, struct vl53l0x_sample *sample) {
+    if (index < 0 || index >= PLUTO_VL53L0X_NUM_SENSORS) {
+        return -EINVAL;
+    }
+    const struct vl53l0x *sensor = &vl53l0x_sensors[index];
+    k_sem_take(&data_sem, K_FOREVER);
+    sample->distance_mm = sensor->distance_mm;
+    sample->range_status = sensor->range_status;
+    sample->signal_kcps = sensor->signal_kcps;
+    sample->ambient_kcps = sensor->ambient_kcps;
+    sample->spad_count = sensor->spad_count;
+    sample->is_valid = sensor->is_valid;
+    sample->timestamp = sensor->timestamp;
+    k_sem_give(&data_sem);
+    return 0;
+}
+
+static bool vl53l0x_passes_quality_gate(const struct vl53l0x *sensor) {
+    return sensor->range_status < 32 && (quality_gate.status_mask & BIT(sensor->range_status)) != 0 &&
+           sensor->signal_kcps >= quality_gate.min_signal_kcps &&
+           sensor->ambient_kcps <= quality_gate.max_ambient_kcps &&
+           sensor->spad_count >= quality_gate.min_spads;
+}
+
+/* Read the quality metrics of the fetched sample, rates in kcps */
+static int vl53l0x_read_metrics(const struct device *dev, uint8_t *range_status, uint32_t *signal_kcps,
+                                uint32_t *ambient_kcps, uint32_t *spad_count) {
+    struct sensor_value value;
+    int ret = sensor_channel_get(dev, (enum sensor_channel)SENSOR_CHAN_VL53L0X_RANGE_STATUS, &value);
+    if (ret) {
+        return ret;
+    }
+    *range_status = (uint8_t)value.val1;
+    ret = sensor_channel_get(dev, (enum sensor_channel)SENSOR_CHAN_VL53L0X_SIGNAL_RATE_RTN_CPS, &value);
+    if (ret) {
+        return ret;
+    }
+    *signal_kcps = (uint32_t)value.val1 / 1000u;
+    ret = sensor_channel_get(dev, (enum sensor_channel)SENSOR_CHAN_VL53L0X_AMBIENT_RATE_RTN_CPS, &value);
+    if (ret) {
+        return ret;
+    }
+    *ambient_kcps = (uint32_t)value.val1 / 1000u;
+    ret = sensor_channel_get(dev, (enum sensor_channel)SENSOR_CHAN_VL53L0X_EFFECTIVE_SPAD_RTN_COUNT, &value);
+    if (ret) {
+        return ret;
+    }
+    *spad_count = (uint32_t)value.val1;
+    return 0;
 }
 
 /**
@@ -351,92 +791,231 @@ uint32_t get_is_proxy_state_by_name(const char* name) {
     return is_proxy;
 }
 
+/* Sample one sensor and update its state, the sector map and the safety supervision */
+static void vl53l0x_sample_sensor(int i) {
+    struct vl53l0x *sensor = &vl53l0x_sensors[i];
+    // Skip to the next sensor if inactive
+    if (sensor->mode == VL53L0X_MODE_OFF || sensor->mode == VL53L0X_MODE_ERROR) {
+        return;
+    }
+    int ret = sensor_sample_fetch(sensor->dev);
+    if (ret) {
+        sensor->mode = VL53L0X_MODE_ERROR;
+        LOG_ERR("sensor_sample_fetch failed for %s, ret %d", sensor->name, ret);
+        sectormap_clear_sensor(i);
+        safety_signal_arm(SAFETY_SIGNAL_PROXY_0 + i, false);
+        safety_raise_fault(SAFETY_FAULT_SENSOR_ERROR, sensor->name);
+        return;
+    }
+    if (!sensor->is_calibration_applied) {
+        // The driver starts the sensor on its first sample, the stored calibration goes on top
+        sensor->is_calibration_applied = true;
+        if (vl53l0x_apply_calibration(sensor) != VL53L0X_ERROR_NONE) {
+            LOG_ERR("Could not apply the calibration of %s", sensor->name);
+        }
+    }
+    struct sensor_value dist_value;
+    ret = sensor_channel_get(sensor->dev, SENSOR_CHAN_DISTANCE, &dist_value);
+    if (ret) {
+        LOG_ERR("sensor_channel_get failed for %s, ret %d", sensor->name, ret);
+        return;
+    }
+    uint8_t range_status;
+    uint32_t signal_kcps, ambient_kcps, spad_count;
+    ret = vl53l0x_read_metrics(sensor->dev, &range_status, &signal_kcps, &ambient_kcps, &spad_count);
+    if (ret) {
+        LOG_ERR("reading the metrics failed for %s, ret %d", sensor->name, ret);
+        return;
+    }
+    k_sem_take(&data_sem, K_FOREVER); // Take semaphore before accessing shared data
+    sensor->distance_mm = (dist_value.val1 * 1000) + (dist_value.val2 / 1000);
+    sensor->timestamp = k_uptime_ticks();
+    sensor->range_status = range_status;
+    sensor->signal_kcps = signal_kcps;
+    sensor->ambient_kcps = ambient_kcps;
+    sensor->spad_count = spad_count;
+    sensor->is_valid = vl53l0x_passes_quality_gate(sensor);
+    sensor->samples++;
+    LOG_DBG("distance of %s is: %d", sensor->name, sensor->distance_mm);
+    k_sem_give(&data_sem); // Give semaphore after accessing shared data
+    // The sensor answered, so the supervision is refreshed by the timestamp. A rejected sample
+    // (out of range, low signal, saturated) cannot see an obstacle and counts as clear.
+    if (!sensor->is_valid) {
+        LOG_DBG("%s sample rejected, status %u", sensor->name, range_status);
+        if (sensor->is_proxy) {
+            LOG_INF("%s above threshold.", sensor->name);
+        }
+        sensor->is_proxy = false;
+        sectormap_add_sample(i, PLUTO_VL53L0X_CLEAR_DISTANCE_MM, false);
+        return;
+    }
+    // Done if the sensor just measures distance, it still feeds the map
+    if (sensor->mode == VL53L0X_MODE_DISTANCE) {
+        sectormap_add_sample(i, sensor->distance_mm, false);
+        return;
+    }
+    if (sensor->distance_mm == 0u) {
+        sensor->mode = VL53L0X_MODE_ERROR;
+        LOG_ERR("measured distance is 0");
+        sectormap_clear_sensor(i);
+        safety_signal_arm(SAFETY_SIGNAL_PROXY_0 + i, false);
+        safety_raise_fault(SAFETY_FAULT_SENSOR_ERROR, sensor->name);
+        return;
+    }
+    bool is_proxy = sensor->distance_mm < sensor->threshold;
+    if (is_proxy != sensor->is_proxy) {
+        LOG_INF("%s %s threshold.", sensor->name, is_proxy ? "under" : "above");
+    }
+    sensor->is_proxy = is_proxy;
+    sectormap_add_sample(i, sensor->distance_mm, is_proxy);
+}
+
+static void vl53l0x_sample(int i) {
+    // A new schedule can move a sensor to another lane while the old lane is still sweeping
+    if (!atomic_cas(&vl53l0x_sensors[i].busy, 0, 1)) {
+        return;
+    }
+    // The same can put two sensors of a group on two lanes for one sweep, the second one waits
+    uint8_t group = vl53l0x_sensors[i].group;
+    k_mutex_lock(&group_mutexes[group], K_FOREVER);
+    vl53l0x_sample_sensor(i);
+    k_mutex_unlock(&group_mutexes[group]);
+    atomic_clear(&vl53l0x_sensors[i].busy);
+}
+
+/*
+ * Distribute the ranging groups of the active sensors over the lanes. A group is never
+ * split, so its sensors range one after another; the lanes range concurrently. Every
+ * lane with a sensor adds one sample per ranging time to the aggregate rate, so as many
+ * lanes as possible are used. The largest group goes first to the least loaded lane,
+ * which keeps the sweeps short and the per sensor rates even.
+ */
+static void vl53l0x_schedule(void) {
+    struct vl53l0x_lane new_lanes[PLUTO_VL53L0X_LANES] = {0};
+    bool is_scheduled[PLUTO_VL53L0X_NUM_SENSORS] = {0};
+    while (1) {
+        // Largest group which is not scheduled yet
+        uint32_t group_size[PLUTO_VL53L0X_NUM_SENSORS] = {0};
+        int group = -1;
+        for (int i = 0; i < PLUTO_VL53L0X_NUM_SENSORS; i++) {
+            if (!is_scheduled[i] && vl53l0x_sensors[i].mode != VL53L0X_MODE_OFF) {
+                uint8_t g = vl53l0x_sensors[i].group;
+                group_size[g]++;
+                if (group < 0 || group_size[g] > group_size[group]) {
+                    group = g;
+                }
+            }
+        }
+        if (group < 0) {
+            break;
+        }
+        struct vl53l0x_lane *lane = &new_lanes[0];
+        for (int l = 1; l < PLUTO_VL53L0X_LANES; l++) {
+            if (new_lanes[l].count < lane->count) {
+                lane = &new_lanes[l];
+            }
+        }
+        for (int i = 0; i < PLUTO_VL53L0X_NUM_SENSORS; i++) {
+            if (!is_scheduled[i] && vl53l0x_sensors[i].mode != VL53L0X_MODE_OFF &&
+                vl53l0x_sensors[i].group == group) {
+                lane->sensors[lane->count++] = i;
+                is_scheduled[i] = true;
+            }
+        }
+    }
+    int64_t now = k_uptime_ticks();
+    k_spinlock_key_t key = k_spin_lock(&schedule_lock);
+    memcpy(lanes, new_lanes, sizeof(lanes));
+    for (int i = 0; i < PLUTO_VL53L0X_NUM_SENSORS; i++) {
+        vl53l0x_sensors[i].samples = 0;
+    }
+    rate_timestamp = now;
+    k_spin_unlock(&schedule_lock, key);
+}
+
 /**
- * @brief Sensor polling thread function.
+ * @brief Request a sample of a sensor, called by the sensor scheduler.
+ *
+ * The lane of the sensor is woken up, a switched off sensor is in no lane.
  *
- * This function polls the sensors at a defined interval, fetches the distance data,
- * and updates the sensor states. It also handles errors and stops the motors if necessary.
+ * @param index Index of the sensor (0 for "p_0").
+ */
+void vl53l0x_request(int index) {
+    int lane = -1;
+    k_spinlock_key_t key = k_spin_lock(&schedule_lock);
+    for (int l = 0; l < PLUTO_VL53L0X_LANES && lane < 0; l++) {
+        for (int k = 0; k < lanes[l].count; k++) {
+            if (lanes[l].sensors[k] == index) {
+                lane = l;
+                break;
+            }
+        }
+    }
+    k_spin_unlock(&schedule_lock, key);
+    if (lane < 0) {
+        return;
+    }
+    atomic_set_bit(&requested_sensors, index);
+    k_sem_give(&lane_sems[lane]);
+}
+
+/**
+ * @brief Sensor polling thread function, one thread per lane.
  *
- * @param unused1 Unused parameter.
+ * This function samples the requested sensors of its lane one after another, fetches
+ * the distance data and updates the sensor states and the sector map. A sensor in proximity mode
+ * under its threshold blocks its sectors, so the motion into them is gated while the
+ * robot can still move away. Sensor errors raise a safety fault. The driver sleeps
+ * while a sensor is ranging, so the other lanes range meanwhile.
+ *
+ * @param lane_index Index of the lane.
  * @param unused2 Unused parameter.
  * @param unused3 Unused parameter.
  */
-void sensor_thread(void *unused1, void *unused2, void *unused3) {
-    int ret;
+void sensor_thread(void *lane_index, void *unused2, void *unused3) {
+    int index = POINTER_TO_INT(lane_index);
     while (1) {
-        // Iterate through each sensor
-        for (int i = 0; i < ARRAY_SIZE(vl53l0x_sensors); i++) {
-            const struct device *vl53l0x;
-            // find correct DT_Sensor
-            if (strcmp(vl53l0x_sensors[i].name, "p_0") == 0) {
-                vl53l0x = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_0));
-            } else if (strcmp(vl53l0x_sensors[i].name, "p_1") == 0) {
-                vl53l0x = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_1));
-            } else if (strcmp(vl53l0x_sensors[i].name, "p_2") == 0) {
-                vl53l0x = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_2));
-            } else if (strcmp(vl53l0x_sensors[i].name, "p_3") == 0) {
-                vl53l0x = DEVICE_DT_GET(DT_NODELABEL(vl53l0x_3));
-            } else {
-                LOG_ERR("Could not get device binding for %s", vl53l0x_sensors[i].name);
-                continue; // Skip to the next sensor
-            }
-            // Skip to the next sensor if inactive
-            if (vl53l0x_sensors[i].mode == VL53L0X_MODE_OFF) {
-                continue;
-            }
-            if (vl53l0x_sensors[i].mode == VL53L0X_MODE_ERROR) {
-                continue;
-            }
-            ret = sensor_sample_fetch(vl53l0x);
-            if (ret) {
-                vl53l0x_sensors[i].mode = VL53L0X_MODE_ERROR;
-                LOG_ERR("sensor_sample_fetch failed for %s, ret %d", vl53l0x_sensors[i].name, ret);
-                motordriver_stop_motors();
-                continue; // Skip to the next sensor
-            }
-            struct sensor_value dist_value;
-            ret = sensor_channel_get(vl53l0x, SENSOR_CHAN_DISTANCE, &dist_value);
-            if (ret) {
-                LOG_ERR("sensor_channel_get failed for %s, ret %d", vl53l0x_sensors[i].name, ret);
-                continue; // Skip to the next sensor
-            }
-            k_sem_take(&data_sem, K_FOREVER); // Take semaphore before accessing shared data
-            vl53l0x_sensors[i].distance_mm = (dist_value.val1 * 1000) + (dist_value.val2 / 1000);
-            LOG_DBG("distance of %s is: %d", vl53l0x_sensors[i].name, vl53l0x_sensors[i].distance_mm);
-            k_sem_give(&data_sem); // Give semaphore after accessing shared data
-            // Skip to the next sensor if just measures distance
-            if (vl53l0x_sensors[i].mode == VL53L0X_MODE_DISTANCE) {
-                continue;
-            }
-            if (vl53l0x_sensors[i].distance_mm == 0u) {
-                vl53l0x_sensors[i].mode = VL53L0X_MODE_ERROR;
-                LOG_ERR("measured distance is 0");
-                motordriver_stop_motors();
-                continue;
-            }
-            if (vl53l0x_sensors[i].distance_mm < vl53l0x_sensors[i].threshold) {
-                LOG_INF("measured distance under defined threshold.");
-                vl53l0x_sensors[i].mode = VL53L0X_MODE_ERROR;
-                vl53l0x_sensors[i].is_proxy = true;
-                motordriver_stop_motors();
-            } else {
-                vl53l0x_sensors[i].is_proxy = false;
+        k_sem_take(&lane_sems[index], K_FOREVER);
+        k_spinlock_key_t key = k_spin_lock(&schedule_lock);
+        struct vl53l0x_lane lane = lanes[index];
+        k_spin_unlock(&schedule_lock, key);
+        pluto_trace(PLUTO_TRACE_SENSOR_SWEEP_START, index, lane.count);
+        for (int k = 0; k < lane.count; k++) {
+            if (atomic_test_and_clear_bit(&requested_sensors, lane.sensors[k])) {
+                vl53l0x_sample(lane.sensors[k]);
             }
         }
-        k_sleep(K_MSEC(PLUTO_VL53L0X_THREAD_SLEEP_TIME_MS));
+        pluto_trace(PLUTO_TRACE_SENSOR_SWEEP_END, index, lane.count);
     }
 }
 
 /**
- * @brief Initialize the VL53L0X sensors and start the sensor thread.
+ * @brief Initialize the VL53L0X sensors and start one sensor thread per lane.
  */
 void vl53l0x_init() {
-    // Create sensor thread
-    k_tid_t vl53l0x_tid = k_thread_create(&vl53l0x_thread_data, vl53l0x_stack_area,
-                                          K_THREAD_STACK_SIZEOF(vl53l0x_stack_area),
-                                          sensor_thread, NULL, NULL, NULL,
-                                          K_PRIO_PREEMPT(7), 0, K_NO_WAIT);
-    k_thread_start(vl53l0x_tid);
+    sectormap_init();
+    // Stored calibration, applied once a sensor is started
+    settings_load_subtree("vl53l0x");
+    for (int i = 0; i < PLUTO_VL53L0X_NUM_SENSORS; i++) {
+        safety_signal_register(SAFETY_SIGNAL_PROXY_0 + i, vl53l0x_sensors[i].name,
+                               &vl53l0x_sensors[i].timestamp);
+    }
+    for (int g = 0; g < PLUTO_VL53L0X_NUM_SENSORS; g++) {
+        k_mutex_init(&group_mutexes[g]);
+    }
+    vl53l0x_schedule();
+    // Create sensor threads
+    for (int l = 0; l < PLUTO_VL53L0X_LANES; l++) {
+        char name[16];
+        k_sem_init(&lane_sems[l], 0, 1);
+        k_tid_t vl53l0x_tid = k_thread_create(&vl53l0x_thread_data[l], vl53l0x_stack_area[l],
+                                              K_THREAD_STACK_SIZEOF(vl53l0x_stack_area[l]),
+                                              sensor_thread, INT_TO_POINTER(l), NULL, NULL,
+                                              PLUTO_VL53L0X_THREAD_PRIORITY, 0, K_NO_WAIT);
+        snprintk(name, sizeof(name), "vl53l0x_%d", l);
+        k_thread_name_set(vl53l0x_tid, name);
+        k_thread_start(vl53l0x_tid);
+    }
 }
 
 /* Creating subcommands (level 1 command) array for command "proxy". */
@@ -447,8 +1026,14 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_proxy,
                                          cmd_proxy_get_threshold),
                                SHELL_CMD(get-prox-state, NULL, "Get current proximity state of sensor <name>.",
                                          cmd_proxy_get_proxy_state),
-                               SHELL_CMD(get-dis, NULL, "Get current distance of sensor <name>.",
-                                         cmd_proxy_get_distance),
+                               SHELL_CMD(get-metrics, NULL,
+                                         "Get <distance_mm> <range_status> <signal_kcps> <ambient_kcps> <spads> "
+                                         "<valid> <age_ms> of sensor <name>.",
+                                         cmd_proxy_get_metrics),
+                               SHELL_CMD(config-quality, NULL,
+                                         "Configure the quality gate <status_mask> <min_signal_kcps> "
+                                         "<max_ambient_kcps> <min_spads>.",
+                                         cmd_proxy_config_quality),
                                SHELL_CMD(get-mode, NULL,
                                          "Get conf for sensor <name>.",
                                          cmd_proxy_get_mode),
@@ -458,6 +1043,23 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_proxy,
                                          cmd_proxy_set_mode),
                                SHELL_CMD(list-sensors, NULL, "List all sensors.",
                                          cmd_proxy_list_prox),
+                               SHELL_CMD(config-group, NULL,
+                                         "Put sensor <name> in ranging group <group[0..3]>, sensors of a group "
+                                         "never range at the same time.",
+                                         cmd_proxy_config_group),
+                               SHELL_CMD(get-schedule, NULL,
+                                         "Get <name> <group> <lane> <expected_mHz> <measured_mHz> per scheduled sensor.",
+                                         cmd_proxy_get_schedule),
+                               SHELL_CMD(calibrate, NULL,
+                                         "Calibrate switched off sensor <name> <spad||temp||offset||xtalk> "
+                                         "[target distance (mm)] and store the result.",
+                                         cmd_proxy_calibrate),
+                               SHELL_CMD(get-calib, NULL,
+                                         "Get <valid> <ref_spads> <aperture> <vhv> <phase> <offset_um> <xtalk_kcps> "
+                                         "of sensor <name>.",
+                                         cmd_proxy_get_calib),
+                               SHELL_CMD(clear-calib, NULL, "Delete the stored calibration of sensor <name>.",
+                                         cmd_proxy_clear_calib),
                                SHELL_SUBCMD_SET_END
 );
 
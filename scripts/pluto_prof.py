@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) Jannis Ruellmann 2024
+#
+# SPDX-License-Identifier: Apache-2.0
+"""Symbolize a pluto "prof dump" into a flat profile.
+
+Capture the output of the "prof dump" shell command into a file, then run:
+
+    pluto_prof.py dump.txt build/zephyr/zephyr.elf
+
+The symbols are read with nm, use --nm to select the toolchain's nm
+(e.g. arm-zephyr-eabi-nm).
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def parse_dump(lines):
+    header = None
+    threads = []
+    pcs = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith("# pluto-prof"):
+            _, _, _, samples, dropped, period_us = line.split()
+            header = (int(samples), int(dropped), int(period_us))
+        elif line.startswith("T "):
+            _, tid, name, count = line.split()
+            threads.append((name if name != "-" else tid, int(count)))
+        elif line.startswith("P "):
+            _, pc, count = line.split()
+            pcs.append((int(pc, 16), int(count)))
+    if header is None:
+        sys.exit("no '# pluto-prof' header found")
+    return header, threads, pcs
+
+
+def read_symbols(nm, elf):
+    out = subprocess.run([nm, "-n", "-S", "--defined-only", elf], check=True,
+                         capture_output=True, text=True).stdout
+    addrs = []
+    names = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3:
+            # symbol without size
+            parts.insert(1, "0")
+        if len(parts) != 4 or parts[2] not in "tTwW":
+            continue
+        # Thumb function symbols have bit 0 set
+        addrs.append(int(parts[0], 16) & ~1)
+        names.append((parts[3], int(parts[1], 16)))
+    return addrs, names
+
+
+def symbolize(pc, addrs, names):
+    if pc == 0:
+        return "<no pc>"
+    i = bisect.bisect_right(addrs, pc) - 1
+    if i < 0:
+        return "0x%08x" % pc
+    name, size = names[i]
+    if size and pc >= addrs[i] + size:
+        return "0x%08x" % pc
+    return name
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="captured output of 'prof dump'")
+    parser.add_argument("elf", help="zephyr.elf of the profiled firmware")
+    parser.add_argument("--nm", default="nm", help="nm executable of the toolchain")
+    parser.add_argument("--top", type=int, default=30, help="number of functions to print")
+    args = parser.parse_args()
+
+    with open(args.dump) as f:
+        (samples, dropped, period_us), threads, pcs = parse_dump(f)
+    addrs, names = read_symbols(args.nm, args.elf)
+
+    print("%d samples every ~%d us, %d dropped (PC table full)" % (samples, period_us, dropped))
+    print()
+    print("%7s %8s  %s" % ("%", "samples", "thread"))
+    for name, count in sorted(threads, key=lambda t: -t[1]):
+        print("%6.2f%% %8d  %s" % (100.0 * count / max(samples, 1), count, name))
+
+    functions = collections.Counter()
+    for pc, count in pcs:
+        functions[symbolize(pc, addrs, names)] += count
+    print()
+    print("%7s %8s  %s" % ("%", "samples", "function"))
+    for name, count in functions.most_common(args.top):
+        print("%6.2f%% %8d  %s" % (100.0 * count / max(samples, 1), count, name))
+
+
+if __name__ == "__main__":
+    main()
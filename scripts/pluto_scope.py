@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) Jannis Ruellmann 2024
+#
+# SPDX-License-Identifier: Apache-2.0
+"""Convert a pluto "scope dump" into CSV.
+
+Capture the output of the "scope dump" shell command into a file, then run:
+
+    pluto_scope.py dump.txt > capture.csv
+
+Each row is the time in us relative to the trigger sample, the raw sample and the
+voltage at the ADS1115 input.
+"""
+
+import argparse
+import struct
+import sys
+
+
+def parse_dump(lines):
+    header = None
+    records = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith("# pluto-scope"):
+            fields = line.split()
+            _, _, version, channel, lsb_nv, cycles_per_s, samples, pretrigger, trigger_index, source = fields
+            if int(version) != 1:
+                sys.exit("unsupported dump version %s" % version)
+            header = dict(input=int(channel), lsb_nv=int(lsb_nv), cycles_per_s=int(cycles_per_s),
+                          samples=int(samples), pretrigger=int(pretrigger), trigger_index=int(trigger_index),
+                          source=source)
+        elif line.startswith("D "):
+            data = bytes.fromhex(line[2:])
+            records.extend(struct.iter_unpack("<Ih", data))
+    if header is None:
+        sys.exit("no '# pluto-scope' header found")
+    if len(records) != header["samples"]:
+        sys.exit("expected %d samples, found %d" % (header["samples"], len(records)))
+    return header, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="captured output of 'scope dump'")
+    args = parser.parse_args()
+
+    with open(args.dump) as f:
+        header, records = parse_dump(f)
+
+    trigger_cycles = records[header["trigger_index"]][0]
+    print("# input a_%d, trigger %s, %d pretrigger samples" % (header["input"], header["source"], header["pretrigger"]))
+    print("time_us,raw,voltage_v")
+    for cycles, raw in records:
+        # The cycle counter wraps at 32 bit, the difference is taken modulo 2^32
+        delta = (cycles - trigger_cycles + 2**31) % 2**32 - 2**31
+        time_us = delta * 1e6 / header["cycles_per_s"]
+        print("%.1f,%d,%.6f" % (time_us, raw, raw * header["lsb_nv"] * 1e-9))
+
+
+if __name__ == "__main__":
+    main()
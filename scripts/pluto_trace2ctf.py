@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) Jannis Ruellmann 2024
+#
+# SPDX-License-Identifier: Apache-2.0
+"""Convert a pluto "trace dump" to CTF (TraceCompass) or Chrome JSON (Perfetto).
+
+Capture the output of the "trace dump" shell command into a file, then run:
+
+    pluto_trace2ctf.py dump.txt out_dir           # CTF trace in out_dir/
+    pluto_trace2ctf.py --json dump.txt trace.json # open in ui.perfetto.dev
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+CTF_MAGIC = 0xC1FC1FC1
+
+# id: (name, [(field, kind)]), keep in sync with enum pluto_trace_event_id
+EVENTS = {
+    1: ("thread_switched_in", [("thread_id", "u32"), ("name", "str")]),
+    2: ("thread_switched_out", [("thread_id", "u32"), ("name", "str")]),
+    3: ("isr_enter", [("exception", "u32")]),
+    4: ("isr_exit", []),
+    5: ("idle", []),
+    16: ("ramp_tick", [("speed", "u32"), ("motor", "u32")]),
+    17: ("sensor_sweep_start", []),
+    18: ("sensor_sweep_end", []),
+    19: ("i2c_submit", [("addr", "u32"), ("len", "u32")]),  # len: bytes written | bytes read << 8
+    20: ("i2c_complete", [("addr", "u32"), ("ret", "s32")]),
+    21: ("led_flush", [("leds", "u32")]),
+}
+
+
+def parse_dump(lines):
+    freq = None
+    threads = {}
+    events = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith("# pluto-trace"):
+            freq = int(line.split()[3])
+        elif line.startswith("T "):
+            _, tid, name = line.split(maxsplit=2)
+            threads[int(tid, 16)] = name
+        elif line.startswith("E "):
+            _, ts, ev_id, arg, arg2 = line.split()
+            events.append((int(ts, 16), int(ev_id, 16), int(arg, 16), int(arg2, 16)))
+    if freq is None:
+        sys.exit("no '# pluto-trace' header found")
+    # Unwrap the 32 bit cycle counter
+    unwrapped = []
+    offset = 0
+    last = None
+    for ts, ev_id, arg, arg2 in events:
+        if last is not None and ts < last:
+            offset += 1 << 32
+        last = ts
+        unwrapped.append((ts + offset, ev_id, arg, arg2))
+    return freq, threads, unwrapped
+
+
+def event_values(ev_id, arg, arg2, threads):
+    name, fields = EVENTS[ev_id]
+    values = []
+    # a thread name field is resolved from the thread ID in the first argument
+    for (field, kind), raw in zip(fields, (arg, arg2)):
+        if field == "name":
+            raw = threads.get(arg, "%08x" % arg)
+        elif kind == "s32":
+            raw = struct.unpack("<h", struct.pack("<H", raw))[0]
+        values.append((field, kind, raw))
+    return name, values
+
+
+def write_ctf(out_dir, freq, threads, events):
+    os.makedirs(out_dir, exist_ok=True)
+    tsdl = [
+        "/* CTF 1.8 */",
+        "typealias integer { size = 8; align = 8; signed = false; } := uint8_t;",
+        "typealias integer { size = 32; align = 8; signed = false; } := uint32_t;",
+        "typealias integer { size = 32; align = 8; signed = true; } := int32_t;",
+        "typealias integer { size = 64; align = 8; signed = false; } := uint64_t;",
+        "",
+        "trace {",
+        "    major = 1;",
+        "    minor = 8;",
+        "    byte_order = le;",
+        "    packet.header := struct { uint32_t magic; };",
+        "};",
+        "",
+        "clock {",
+        "    name = pluto_clock;",
+        "    freq = %d;" % freq,
+        "    offset = 0;",
+        "};",
+        "",
+        "typealias integer { size = 64; align = 8; signed = false; map = clock.pluto_clock.value; } := pluto_clock_t;",
+        "",
+        "stream {",
+        "    event.header := struct { uint8_t id; pluto_clock_t timestamp; };",
+        "};",
+        "",
+    ]
+    ctf_types = {"u32": "uint32_t", "s32": "int32_t", "str": "string"}
+    for ev_id, (name, fields) in sorted(EVENTS.items()):
+        members = " ".join("%s %s;" % (ctf_types[kind], field) for field, kind in fields)
+        tsdl.append("event { name = \"%s\"; id = %d; fields := struct { %s }; };" % (name, ev_id, members))
+    with open(os.path.join(out_dir, "metadata"), "w") as f:
+        f.write("\n".join(tsdl) + "\n")
+
+    with open(os.path.join(out_dir, "stream"), "wb") as f:
+        f.write(struct.pack("<I", CTF_MAGIC))
+        for ts, ev_id, arg, arg2 in events:
+            if ev_id not in EVENTS:
+                continue
+            f.write(struct.pack("<BQ", ev_id, ts))
+            _, values = event_values(ev_id, arg, arg2, threads)
+            for _, kind, value in values:
+                if kind == "u32":
+                    f.write(struct.pack("<I", value))
+                elif kind == "s32":
+                    f.write(struct.pack("<i", value))
+                else:
+                    f.write(value.encode() + b"\0")
+
+
+def write_json(out_file, freq, threads, events):
+    trace = []
+    for tid, name in threads.items():
+        trace.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid, "args": {"name": name}})
+    trace.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": 0, "args": {"name": "ISR"}})
+    current = 0
+    for ts, ev_id, arg, arg2 in events:
+        if ev_id not in EVENTS:
+            continue
+        us = ts * 1e6 / freq
+        name, values = event_values(ev_id, arg, arg2, threads)
+        args = {field: value for field, _, value in values}
+        if ev_id == 1:
+            current = arg
+            trace.append({"ph": "B", "name": "running", "pid": 0, "tid": arg, "ts": us})
+        elif ev_id == 2:
+            trace.append({"ph": "E", "name": "running", "pid": 0, "tid": arg, "ts": us})
+        elif ev_id == 3:
+            trace.append({"ph": "B", "name": "isr %d" % arg, "pid": 0, "tid": 0, "ts": us})
+        elif ev_id == 4:
+            trace.append({"ph": "E", "pid": 0, "tid": 0, "ts": us})
+        else:
+            trace.append({"ph": "i", "s": "t", "name": name, "pid": 0, "tid": current, "ts": us, "args": args})
+    with open(out_file, "w") as f:
+        json.dump({"traceEvents": trace, "displayTimeUnit": "ns"}, f)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="captured output of 'trace dump'")
+    parser.add_argument("output", help="CTF output directory, or JSON file with --json")
+    parser.add_argument("--json", action="store_true", help="write Chrome JSON trace for Perfetto")
+    args = parser.parse_args()
+
+    with open(args.dump) as f:
+        freq, threads, events = parse_dump(f)
+    if args.json:
+        write_json(args.output, freq, threads, events)
+    else:
+        write_ctf(args.output, freq, threads, events)
+    print("%d events converted" % len(events))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Jannis Ruellmann 2024
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/**
+ * @file main.c
+ * @brief Tests of the sigma-delta dithering of the PWM pulse.
+ *
+ * Runs motor_dither_step() over many PWM periods and checks that the mean of the
+ * written pulses is the Q8 target pulse.
+ *
+ * @author Jannis Ruellmann
+ */
+
+#include <zephyr/ztest.h>
+
+#include "inc/pluto_motordriver.h"
+
+#define DITHER_CYCLE BIT(MOTOR_DITHER_BITS)
+
+/* Target pulses in Q8, from no fraction over the smallest fractions to a 16 bit period */
+static const uint32_t targets_q8[] = {
+        0, 1, 127, 128, 255, 256, 257, 1000 * DITHER_CYCLE + 77, 12345, (65535u << MOTOR_DITHER_BITS) | 0xff,
+};
+
+/* Sum of the pulses of n periods, checks that each pulse is the target rounded down or up */
+static uint64_t dither_sum(uint32_t target_q8, uint32_t n) {
+    uint32_t acc = 0;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t pulse = motor_dither_step(&acc, target_q8);
+        zassert_true(pulse == target_q8 >> MOTOR_DITHER_BITS || pulse == (target_q8 >> MOTOR_DITHER_BITS) + 1,
+                     "pulse %u out of range for target %u", pulse, target_q8);
+        zassert_true(acc < DITHER_CYCLE, "accumulator %u overflowed", acc);
+        sum += pulse;
+    }
+    return sum;
+}
+
+ZTEST(motor_dither, test_mean_is_exact_over_full_cycle)
+{
+    for (int i = 0; i < ARRAY_SIZE(targets_q8); i++) {
+        for (uint32_t cycles = 1; cycles <= 4; cycles++) {
+            uint64_t sum = dither_sum(targets_q8[i], cycles * DITHER_CYCLE);
+            zassert_equal(sum, (uint64_t)targets_q8[i] * cycles, "target %u: mean %llu/%u",
+                          targets_q8[i], (unsigned long long)sum, cycles * DITHER_CYCLE);
+        }
+    }
+}
+
+ZTEST(motor_dither, test_mean_error_below_one_cycle)
+{
+    static const uint32_t periods[] = {1, 7, 100, 1000, 4099};
+    for (int i = 0; i < ARRAY_SIZE(targets_q8); i++) {
+        for (int k = 0; k < ARRAY_SIZE(periods); k++) {
+            // Sum of n pulses in Q8 against n times the target, the accumulator carries the difference
+            uint64_t sum_q8 = dither_sum(targets_q8[i], periods[k]) << MOTOR_DITHER_BITS;
+            uint64_t expected_q8 = (uint64_t)targets_q8[i] * periods[k];
+            zassert_true(sum_q8 <= expected_q8 && expected_q8 - sum_q8 < DITHER_CYCLE,
+                         "target %u over %u periods: sum %llu expected %llu (Q8)",
+                         targets_q8[i], periods[k], (unsigned long long)sum_q8,
+                         (unsigned long long)expected_q8);
+        }
+    }
+}
+
+ZTEST(motor_dither, test_integer_pulse_is_not_dithered)
+{
+    uint32_t acc = 0;
+    for (int i = 0; i < 1000; i++) {
+        zassert_equal(motor_dither_step(&acc, 500 * DITHER_CYCLE), 500);
+    }
+    zassert_equal(acc, 0);
+}
+
+ZTEST_SUITE(motor_dither, NULL, NULL, NULL, NULL, NULL);